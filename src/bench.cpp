@@ -0,0 +1,299 @@
+// afsha_bench: drives the live recognition path from an audio file and reports
+// real-time factor, sample-to-text latency, whisper timings and memory use as JSON.
+//
+// usage: afsha_bench -f audio.wav [-m model] [-t threads] [--step-ms N] [--length-ms N]
+//                    [--keep-ms N] [--fast] [--no-incremental-mel] [--label TEXT] [-o results.json]
+#include <stdio.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <SDL3/SDL.h>
+#include "whisper.h"
+#include "audio_source.h"
+#include "speech_stream.h"
+#include "transcript_format.h"
+
+#ifdef _WIN32
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+struct bench_params {
+    std::string model = "out/models/ggml-base.en.bin";
+    std::string file;
+    std::string output;
+    std::string label;
+    int n_threads = 4;
+    int step_ms = 3000;
+    int length_ms = 30000;
+    int keep_ms = 100;
+    // feed the file as fast as it's decoded instead of at the pace it was recorded
+    bool fast = false;
+    // compute the spectrogram frames as audio arrives and reuse them across
+    // windows, see mel_stream
+    bool incremental_mel = true;
+};
+
+struct bench_step {
+    double wall_ms;
+    double audio_ms;
+    float encode_ms;
+    float decode_ms;
+    float batchd_ms;
+    float prompt_ms;
+};
+
+static void print_usage(const char *program) {
+    fprintf(stderr, "usage: %s -f FILE [options]\n", program);
+    fprintf(stderr, "  -m, --model FILE    whisper model (default: out/models/ggml-base.en.bin)\n");
+    fprintf(stderr, "  -f, --file FILE     WAV or raw PCM file to replay\n");
+    fprintf(stderr, "  -t, --threads N     inference threads (default: 4)\n");
+    fprintf(stderr, "      --step-ms N     audio step (default: 3000)\n");
+    fprintf(stderr, "      --length-ms N   longest window handed to whisper (default: 30000)\n");
+    fprintf(stderr, "      --keep-ms N     overlap kept from the previous step (default: 100)\n");
+    fprintf(stderr, "      --fast          don't pace the file at real time\n");
+    fprintf(stderr, "      --no-incremental-mel  whisper computes the spectrogram of every window\n");
+    fprintf(stderr, "      --label TEXT    free-form label copied to the results\n");
+    fprintf(stderr, "  -o, --output FILE   write the JSON results to FILE instead of stdout\n");
+}
+
+static bool parse_args(int argc, char *argv[], bench_params &params) {
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const bool has_value = i + 1 < argc;
+        if ((arg == "-m" || arg == "--model") && has_value) {
+            params.model = argv[++i];
+        } else if ((arg == "-f" || arg == "--file") && has_value) {
+            params.file = argv[++i];
+        } else if ((arg == "-t" || arg == "--threads") && has_value) {
+            params.n_threads = atoi(argv[++i]);
+        } else if (arg == "--step-ms" && has_value) {
+            params.step_ms = atoi(argv[++i]);
+        } else if (arg == "--length-ms" && has_value) {
+            params.length_ms = atoi(argv[++i]);
+        } else if (arg == "--keep-ms" && has_value) {
+            params.keep_ms = atoi(argv[++i]);
+        } else if (arg == "--fast") {
+            params.fast = true;
+        } else if (arg == "--no-incremental-mel") {
+            params.incremental_mel = false;
+        } else if (arg == "--label" && has_value) {
+            params.label = argv[++i];
+        } else if ((arg == "-o" || arg == "--output") && has_value) {
+            params.output = argv[++i];
+        } else {
+            fprintf(stderr, "Unknown argument: %s\n", arg.c_str());
+            return false;
+        }
+    }
+    if (params.file.empty() || params.step_ms <= 0 || params.length_ms < params.step_ms + params.keep_ms) {
+        return false;
+    }
+    return true;
+}
+
+static double percentile(std::vector<double> values, double p) {
+    if (values.empty()) {
+        return 0.0;
+    }
+    std::sort(values.begin(), values.end());
+    const size_t rank = (size_t) (p / 100.0 * (values.size() - 1) + 0.5);
+    return values[std::min(rank, values.size() - 1)];
+}
+
+static double max_rss_mb() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return counters.PeakWorkingSetSize / (1024.0 * 1024.0);
+    }
+    return 0.0;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0.0;
+    }
+#ifdef __APPLE__
+    // bytes on macOS
+    return usage.ru_maxrss / (1024.0 * 1024.0);
+#else
+    // kilobytes on Linux
+    return usage.ru_maxrss / 1024.0;
+#endif
+#endif
+}
+
+static double now_ms() {
+    return SDL_GetTicksNS() / 1e6;
+}
+
+int main(int argc, char *argv[]) {
+    bench_params params;
+    if (!parse_args(argc, argv, params)) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    struct whisper_context_params cparams = whisper_context_default_params();
+    // decode on the default state, whisper_get_timings() only reports that one
+    whisper_context *ctx = whisper_init_from_file_with_params(params.model.c_str(), cparams);
+    if (!ctx) {
+        fprintf(stderr, "Couldn't load model %s\n", params.model.c_str());
+        return 1;
+    }
+
+    // the file is released all at once, the loop below paces it
+    file_audio_source source(false);
+    if (!source.open(params.file)) {
+        whisper_free(ctx);
+        return 1;
+    }
+    source.start([] {});
+
+    speech_stream_params stream_params;
+    stream_params.n_samples_step = params.step_ms * WHISPER_SAMPLE_RATE / 1000;
+    stream_params.n_samples_keep = params.keep_ms * WHISPER_SAMPLE_RATE / 1000;
+    stream_params.n_samples_max = params.length_ms * WHISPER_SAMPLE_RATE / 1000;
+    stream_params.incremental_mel = params.incremental_mel;
+    speech_stream stream(params.file, stream_params);
+    stream.init(ctx, false);
+
+    whisper_full_params wparams = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
+    wparams.n_threads = params.n_threads;
+    wparams.print_progress = false;
+
+    // when each sample position was handed to the recognizer, to measure latency
+    std::vector<std::pair<uint64_t, double> > push_times;
+    std::vector<float> scratch(WHISPER_SAMPLE_RATE);
+    std::vector<bench_step> steps;
+    std::vector<double> latencies;
+    std::vector<transcript_segment> segments;
+    uint64_t pushed = 0;
+    double compute_ms = 0.0;
+
+    const double start = now_ms();
+    while (!stream.drained()) {
+        const uint64_t due = params.fast ? UINT64_MAX : (uint64_t) ((now_ms() - start) * WHISPER_SAMPLE_RATE / 1000.0);
+        while (pushed < due) {
+            size_t max_samples = std::min(scratch.size(), stream.writable());
+            max_samples = (size_t) std::min<uint64_t>(max_samples, due - pushed);
+            const float *data = NULL;
+            const size_t n = max_samples ? source.read(&data, max_samples, scratch.data()) : 0;
+            if (n == 0) {
+                break;
+            }
+            stream.push(data, n);
+            source.consume(n);
+            pushed += n;
+            push_times.push_back(std::make_pair(pushed, now_ms()));
+        }
+        if (source.finished()) {
+            stream.end_of_stream();
+        }
+
+        if (!stream.ready()) {
+            // wait for the next chunk of paced audio
+            SDL_Delay(10);
+            continue;
+        }
+
+        segments.clear();
+        whisper_reset_timings(ctx);
+        const size_t backlog = stream.backlog();
+        const double step_start = now_ms();
+        if (!stream.recognize(ctx, wparams, segments)) {
+            continue;
+        }
+        const double step_end = now_ms();
+        compute_ms += step_end - step_start;
+
+        bench_step step;
+        SDL_zero(step);
+        step.wall_ms = step_end - step_start;
+        step.audio_ms = backlog * 1000.0 / WHISPER_SAMPLE_RATE;
+        // a copy which whisper allocates with new and leaves to the caller
+        whisper_timings *timings = whisper_get_timings(ctx);
+        if (timings) {
+            step.encode_ms = timings->encode_ms;
+            step.decode_ms = timings->decode_ms;
+            step.batchd_ms = timings->batchd_ms;
+            step.prompt_ms = timings->prompt_ms;
+            delete timings;
+        }
+        steps.push_back(step);
+
+        // latency from the last sample of a segment arriving to its text being emitted
+        for (size_t i = 0; i < segments.size(); ++i) {
+            const uint64_t last_sample = (uint64_t) segments[i].t1_ms * WHISPER_SAMPLE_RATE / 1000;
+            std::vector<std::pair<uint64_t, double> >::const_iterator pushed_at = std::upper_bound(
+                push_times.begin(), push_times.end(), std::make_pair(last_sample, 1e300));
+            if (pushed_at == push_times.end()) {
+                --pushed_at;
+            }
+            latencies.push_back(step_end - pushed_at->second);
+        }
+    }
+    const double wall_ms = now_ms() - start;
+    const double audio_ms = pushed * 1000.0 / WHISPER_SAMPLE_RATE;
+
+    std::vector<double> encode_ms;
+    std::vector<double> decode_ms;
+    std::vector<double> step_ms;
+    for (size_t i = 0; i < steps.size(); ++i) {
+        encode_ms.push_back(steps[i].encode_ms);
+        decode_ms.push_back(steps[i].decode_ms);
+        step_ms.push_back(steps[i].wall_ms);
+    }
+
+    FILE *out = params.output.empty() ? stdout : fopen(params.output.c_str(), "w");
+    if (!out) {
+        fprintf(stderr, "Couldn't open %s\n", params.output.c_str());
+        whisper_free(ctx);
+        return 1;
+    }
+    fprintf(out, "{\n");
+    fprintf(out, "  \"label\": \"%s\",\n", json_escape(params.label).c_str());
+    fprintf(out, "  \"model\": \"%s\",\n", json_escape(params.model).c_str());
+    fprintf(out, "  \"file\": \"%s\",\n", json_escape(params.file).c_str());
+    fprintf(out, "  \"system_info\": \"%s\",\n", json_escape(whisper_print_system_info()).c_str());
+    fprintf(out, "  \"threads\": %d,\n", params.n_threads);
+    fprintf(out, "  \"step_ms\": %d,\n", params.step_ms);
+    fprintf(out, "  \"length_ms\": %d,\n", params.length_ms);
+    fprintf(out, "  \"keep_ms\": %d,\n", params.keep_ms);
+    fprintf(out, "  \"paced\": %s,\n", params.fast ? "false" : "true");
+    fprintf(out, "  \"incremental_mel\": %s,\n", params.incremental_mel ? "true" : "false");
+    fprintf(out, "  \"audio_s\": %.3f,\n", audio_ms / 1000.0);
+    fprintf(out, "  \"wall_s\": %.3f,\n", wall_ms / 1000.0);
+    fprintf(out, "  \"compute_s\": %.3f,\n", compute_ms / 1000.0);
+    // below 1 keeps up with real time
+    fprintf(out, "  \"real_time_factor\": %.4f,\n", audio_ms > 0.0 ? compute_ms / audio_ms : 0.0);
+    fprintf(out, "  \"whisper_full_calls\": %zu,\n", steps.size());
+    fprintf(out, "  \"vad_skipped_windows\": %llu,\n", (unsigned long long) stream.vad().skipped_windows());
+    // spectrogram frames the decodes reused from capture and computed at decode time
+    fprintf(out, "  \"mel_frames\": {\"reused\": %llu, \"computed\": %llu},\n",
+            (unsigned long long) stream.mel_frames_reused(), (unsigned long long) stream.mel_frames_computed());
+    fprintf(out, "  \"segments\": %zu,\n", latencies.size());
+    fprintf(out, "  \"latency_ms\": {\"p50\": %.1f, \"p95\": %.1f, \"p99\": %.1f},\n",
+            percentile(latencies, 50), percentile(latencies, 95), percentile(latencies, 99));
+    fprintf(out, "  \"step_wall_ms\": {\"p50\": %.1f, \"p95\": %.1f, \"p99\": %.1f},\n",
+            percentile(step_ms, 50), percentile(step_ms, 95), percentile(step_ms, 99));
+    // whisper reports encode time per encoder pass and decode time per decoder call
+    fprintf(out, "  \"encode_ms\": {\"p50\": %.1f, \"p95\": %.1f},\n", percentile(encode_ms, 50), percentile(encode_ms, 95));
+    fprintf(out, "  \"decode_ms_per_call\": {\"p50\": %.2f, \"p95\": %.2f},\n", percentile(decode_ms, 50), percentile(decode_ms, 95));
+    fprintf(out, "  \"max_rss_mb\": %.1f,\n", max_rss_mb());
+    fprintf(out, "  \"steps\": [\n");
+    for (size_t i = 0; i < steps.size(); ++i) {
+        fprintf(out, "    {\"wall_ms\": %.1f, \"audio_ms\": %.0f, \"encode_ms\": %.1f, \"decode_ms\": %.2f, \"batchd_ms\": %.2f, \"prompt_ms\": %.2f}%s\n",
+                steps[i].wall_ms, steps[i].audio_ms, steps[i].encode_ms, steps[i].decode_ms,
+                steps[i].batchd_ms, steps[i].prompt_ms, i + 1 < steps.size() ? "," : "");
+    }
+    fprintf(out, "  ]\n");
+    fprintf(out, "}\n");
+    if (out != stdout) {
+        fclose(out);
+    }
+
+    whisper_free(ctx);
+    return 0;
+}
@@ -0,0 +1,179 @@
+// afsha_convert_bench: measures the throughput of the audio conversion front end,
+// downmixing and resampling to 16 kHz mono float, over synthetic input in every
+// supported sample format, and reports it as JSON.
+//
+// usage: afsha_convert_bench [--seconds N] [--block N] [--channels N] [--label TEXT] [-o results.json]
+#include <stdio.h>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <SDL3/SDL.h>
+#include "audio_convert.h"
+#include "transcript_format.h"
+
+struct convert_bench_params {
+    std::string output;
+    std::string label;
+    // of audio per case
+    int seconds = 60;
+    // frames per call, the size of a capture chunk
+    int block = 1024;
+    // the most channels to downmix, every case runs with 1, 2 and this many
+    int max_channels = 6;
+};
+
+struct convert_case {
+    pcm_sample_format format;
+    int sample_rate;
+    int channels;
+};
+
+static void print_usage(const char *program) {
+    fprintf(stderr, "usage: %s [options]\n", program);
+    fprintf(stderr, "      --seconds N     audio per case (default: 60)\n");
+    fprintf(stderr, "      --block N       frames converted per call (default: 1024)\n");
+    fprintf(stderr, "      --channels N    most channels to downmix (default: 6)\n");
+    fprintf(stderr, "      --label TEXT    free-form label copied to the results\n");
+    fprintf(stderr, "  -o, --output FILE   write the JSON results to FILE instead of stdout\n");
+}
+
+static bool parse_args(int argc, char *argv[], convert_bench_params &params) {
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const bool has_value = i + 1 < argc;
+        if (arg == "--seconds" && has_value) {
+            params.seconds = atoi(argv[++i]);
+        } else if (arg == "--block" && has_value) {
+            params.block = atoi(argv[++i]);
+        } else if (arg == "--channels" && has_value) {
+            params.max_channels = atoi(argv[++i]);
+        } else if (arg == "--label" && has_value) {
+            params.label = argv[++i];
+        } else if ((arg == "-o" || arg == "--output") && has_value) {
+            params.output = argv[++i];
+        } else {
+            fprintf(stderr, "Unknown argument: %s\n", arg.c_str());
+            return false;
+        }
+    }
+    return params.seconds > 0 && params.block > 0 && params.max_channels > 0;
+}
+
+static const char * format_name(const pcm_sample_format format) {
+    return format == PCM_S16 ? "s16" : (format == PCM_S24 ? "s24" : "f32");
+}
+
+// A speech band chirp with a little noise, interleaved in the case's format
+static std::vector<uint8_t> make_input(const convert_case &c, const size_t n_frames) {
+    const size_t sample_size = pcm_sample_size(c.format);
+    std::vector<uint8_t> data(n_frames * c.channels * sample_size);
+    uint32_t noise = 1;
+    for (size_t i = 0; i < n_frames; ++i) {
+        const double t = (double) i / c.sample_rate;
+        const double freq = 200.0 + 3000.0 * std::fmod(t, 1.0);
+        for (int ch = 0; ch < c.channels; ++ch) {
+            noise = noise * 1664525u + 1013904223u;
+            const double value = 0.5 * std::sin(2.0 * 3.14159265358979 * freq * t) + 0.01 * ((noise >> 8) / 16777216.0 - 0.5);
+            uint8_t *out = data.data() + (i * c.channels + ch) * sample_size;
+            if (c.format == PCM_S16) {
+                const int16_t s = (int16_t) (value * 32767.0);
+                memcpy(out, &s, sizeof(s));
+            } else if (c.format == PCM_S24) {
+                const int32_t s = (int32_t) (value * 8388607.0);
+                out[0] = (uint8_t) (s & 0xff);
+                out[1] = (uint8_t) ((s >> 8) & 0xff);
+                out[2] = (uint8_t) ((s >> 16) & 0xff);
+            } else {
+                const float s = (float) value;
+                memcpy(out, &s, sizeof(s));
+            }
+        }
+    }
+    return data;
+}
+
+int main(int argc, char *argv[]) {
+    convert_bench_params params;
+    if (!parse_args(argc, argv, params)) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    const pcm_sample_format formats[] = {PCM_S16, PCM_S24, PCM_F32};
+    const int rates[] = {16000, 44100, 48000};
+    std::vector<int> channel_counts;
+    channel_counts.push_back(1);
+    if (params.max_channels >= 2) {
+        channel_counts.push_back(2);
+    }
+    if (params.max_channels > 2) {
+        channel_counts.push_back(params.max_channels);
+    }
+
+    FILE *out = params.output.empty() ? stdout : fopen(params.output.c_str(), "w");
+    if (!out) {
+        fprintf(stderr, "Couldn't open %s\n", params.output.c_str());
+        return 1;
+    }
+    fprintf(out, "{\n");
+    fprintf(out, "  \"label\": \"%s\",\n", json_escape(params.label).c_str());
+#if defined(AUDIO_CONVERT_SSE)
+    fprintf(out, "  \"simd\": \"sse\",\n");
+#elif defined(AUDIO_CONVERT_NEON)
+    fprintf(out, "  \"simd\": \"neon\",\n");
+#else
+    fprintf(out, "  \"simd\": \"none\",\n");
+#endif
+    fprintf(out, "  \"seconds\": %d,\n", params.seconds);
+    fprintf(out, "  \"block\": %d,\n", params.block);
+    fprintf(out, "  \"cases\": [\n");
+    const size_t n_cases = sizeof(formats) / sizeof(formats[0]) * sizeof(rates) / sizeof(rates[0]) * channel_counts.size();
+    size_t case_index = 0;
+    float checksum = 0.0f;
+    for (size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); ++f) {
+        for (size_t r = 0; r < sizeof(rates) / sizeof(rates[0]); ++r) {
+            for (size_t ch = 0; ch < channel_counts.size(); ++ch) {
+                convert_case c;
+                c.format = formats[f];
+                c.sample_rate = rates[r];
+                c.channels = channel_counts[ch];
+                const size_t n_frames = (size_t) params.seconds * c.sample_rate;
+                const std::vector<uint8_t> input = make_input(c, n_frames);
+                const size_t frame_size = pcm_sample_size(c.format) * c.channels;
+
+                polyphase_resampler resampler;
+                resampler.init(c.sample_rate, 16000);
+                // like the capture path: downmix and resample in place in one buffer
+                std::vector<float> buffer(resampler.max_output(params.block) + params.block);
+                size_t n_output = 0;
+                const Uint64 start = SDL_GetPerformanceCounter();
+                for (size_t first = 0; first < n_frames; first += params.block) {
+                    const size_t n = n_frames - first < (size_t) params.block ? n_frames - first : (size_t) params.block;
+                    downmix_to_mono(c.format, input.data() + first * frame_size, c.channels, n, buffer.data());
+                    const size_t produced = resampler.process(buffer.data(), n, buffer.data());
+                    if (produced > 0) {
+                        checksum += buffer[produced - 1];
+                    }
+                    n_output += produced;
+                }
+                const double seconds = (double) (SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+
+                fprintf(out, "    {\"format\": \"%s\", \"sample_rate\": %d, \"channels\": %d, \"output_samples\": %zu, "
+                        "\"seconds\": %.4f, \"input_mb_per_s\": %.1f, \"mframes_per_s\": %.2f, \"x_real_time\": %.0f}%s\n",
+                        format_name(c.format), c.sample_rate, c.channels, n_output, seconds,
+                        seconds > 0.0 ? input.size() / seconds / 1e6 : 0.0,
+                        seconds > 0.0 ? n_frames / seconds / 1e6 : 0.0,
+                        seconds > 0.0 ? params.seconds / seconds : 0.0,
+                        ++case_index < n_cases ? "," : "");
+            }
+        }
+    }
+    fprintf(out, "  ],\n");
+    // keeps the conversion from being optimized away
+    fprintf(out, "  \"checksum\": %.3f\n", checksum);
+    fprintf(out, "}\n");
+    if (out != stdout) {
+        fclose(out);
+    }
+    return 0;
+}
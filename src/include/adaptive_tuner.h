@@ -0,0 +1,143 @@
+#pragma once
+
+#include <mutex>
+#include <SDL3/SDL.h>
+
+struct adaptive_tuner_params {
+    int sample_rate = 16000;
+    // latency to stay under: a step's length, its decode time and the backlog it started with
+    float target_latency_s = 5.0f;
+    int min_step_samples = 16000;
+    int max_step_samples = 10 * 16000;
+    int initial_step_samples = 3 * 16000;
+};
+
+// Adjusts the decode settings at runtime from how long each decode takes.
+//
+// The load of a decode is its wall time over the audio it went through, above 1
+// the recognizer falls behind. When the load is high or the latency target is
+// missed the tuner first adds threads up to the slot's share of the cores, then
+// fits the encoder context to the window, then takes longer steps. When there is
+// headroom it goes back the same way: shorter steps first for latency, then the
+// full encoder context, then giving threads back so the box isn't oversubscribed.
+// After every change it waits a few decodes for the averages to settle.
+class adaptive_tuner {
+private:
+    adaptive_tuner_params params;
+
+    std::mutex mutex;
+    int threads = 1;
+    int min_threads = 1;
+    int max_threads = 1;
+    int step_samples;
+    bool fit_audio_ctx = false;
+
+    // exponentially weighted averages over the recent decodes
+    float load = 0.0f;
+    float decode_s = 0.0f;
+    float lag_s = 0.0f;
+    bool has_samples = false;
+    int decodes_since_change = 0;
+
+    static const int SETTLE_DECODES = 3;
+    // above this the recognizer is about to fall behind
+    static constexpr float LOAD_HIGH = 0.9f;
+    // below this a shorter step still fits
+    static constexpr float LOAD_SHORTER_STEP = 0.5f;
+    // below this the full encoder context or fewer threads still fit
+    static constexpr float LOAD_LOW = 0.2f;
+
+    void changed(const char * what) {
+        SDL_Log("Tuner: %s (load %.2f, decode %.0f ms, lag %.1f s) -> %d threads, %d ms steps, %s audio context",
+                what, load, decode_s * 1000.0f, lag_s, threads, step_samples * 1000 / params.sample_rate,
+                fit_audio_ctx ? "fitted" : "full");
+        decodes_since_change = 0;
+    }
+
+public:
+    explicit adaptive_tuner(const adaptive_tuner_params & params) :
+        params(params),
+        step_samples(params.initial_step_samples) {
+    }
+
+    // Threads per decode, set by the decode scheduler once it knows its slots
+    void set_thread_range(int initial, int maximum) {
+        std::lock_guard<std::mutex> lock(mutex);
+        max_threads = maximum > 1 ? maximum : 1;
+        threads = initial < 1 ? 1 : (initial > max_threads ? max_threads : initial);
+    }
+
+    // Reports a decode: its wall time, the new samples it went through and the samples
+    // that were waiting when it started. Safe to call from several decode slots.
+    void observe(double seconds, size_t samples, size_t backlog) {
+        if (samples == 0) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        const float audio_s = (float) samples / params.sample_rate;
+        const float sample_load = (float) seconds / audio_s;
+        const float sample_lag = (float) backlog / params.sample_rate;
+        const float alpha = 0.3f;
+        if (!has_samples) {
+            load = sample_load;
+            decode_s = (float) seconds;
+            lag_s = sample_lag;
+            has_samples = true;
+        } else {
+            load += alpha * (sample_load - load);
+            decode_s += alpha * ((float) seconds - decode_s);
+            lag_s += alpha * (sample_lag - lag_s);
+        }
+
+        if (++decodes_since_change < SETTLE_DECODES) {
+            return;
+        }
+
+        const float step_s = (float) step_samples / params.sample_rate;
+        const float latency_s = step_s + decode_s + lag_s;
+        if (load > LOAD_HIGH || lag_s > params.target_latency_s) {
+            if (threads < max_threads) {
+                threads++;
+                changed("falling behind, more threads");
+            } else if (!fit_audio_ctx) {
+                fit_audio_ctx = true;
+                changed("falling behind, fitted audio context");
+            } else if (step_samples < params.max_step_samples) {
+                step_samples = step_samples * 5 / 4 < params.max_step_samples ? step_samples * 5 / 4 : params.max_step_samples;
+                changed("falling behind, longer steps");
+            }
+        } else if (latency_s > params.target_latency_s * 0.8f && load < LOAD_SHORTER_STEP &&
+                   step_samples > params.min_step_samples) {
+            step_samples = step_samples * 4 / 5 > params.min_step_samples ? step_samples * 4 / 5 : params.min_step_samples;
+            changed("over the latency target, shorter steps");
+        } else if (load < LOAD_LOW) {
+            if (fit_audio_ctx) {
+                fit_audio_ctx = false;
+                changed("headroom, full audio context");
+            } else if (threads > min_threads) {
+                threads--;
+                changed("headroom, fewer threads");
+            }
+        }
+    }
+
+    int n_threads() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return threads;
+    }
+
+    int step() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return step_samples;
+    }
+
+    bool fitted_audio_ctx() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return fit_audio_ctx;
+    }
+
+    float average_load() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return load;
+    }
+};
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <SDL3/SDL.h>
+
+// Where an input's audio was at a given SDL_GetTicksNS() time, the time base of
+// camera frame timestamps, so frames can be lined up with the audio.
+//
+// The capture thread moves the clock along after every read, with the samples it
+// captured and how many of them the recognizer took. Readers extrapolate from
+// the last update at the sample rate, which is off by whatever the audio device
+// buffers before the capture thread gets the samples, typically some tens of ms.
+// Updates and reads go through a sequence counter, neither side ever waits.
+class audio_clock {
+private:
+    std::atomic<uint32_t> sequence;
+    std::atomic<uint64_t> anchor_ns;
+    std::atomic<uint64_t> captured;
+    std::atomic<uint64_t> recognized;
+    int rate = 16000;
+    // the writer's totals
+    uint64_t n_captured = 0;
+    uint64_t n_recognized = 0;
+
+    audio_clock(const audio_clock &) = delete;
+    audio_clock & operator=(const audio_clock &) = delete;
+
+public:
+    audio_clock() : sequence(0), anchor_ns(0), captured(0), recognized(0) {
+    }
+
+    void set_sample_rate(const int sample_rate) {
+        rate = sample_rate;
+    }
+
+    int sample_rate() const {
+        return rate;
+    }
+
+    // Capture thread, right after reading n_samples
+    void advance(const size_t n_samples, const size_t n_taken) {
+        n_captured += n_samples;
+        n_recognized += n_taken;
+        const uint32_t s = sequence.load(std::memory_order_relaxed);
+        sequence.store(s + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        anchor_ns.store(SDL_GetTicksNS(), std::memory_order_relaxed);
+        captured.store(n_captured, std::memory_order_relaxed);
+        recognized.store(n_recognized, std::memory_order_relaxed);
+        sequence.store(s + 2, std::memory_order_release);
+    }
+
+    // Any thread. The position among all captured samples, as in audio_history,
+    // and the recognizer's, which segment timestamps count in, at ticks_ns. False
+    // before any audio was captured.
+    bool position_at(const Uint64 ticks_ns, int64_t * captured_position, int64_t * recognized_position) const {
+        uint64_t ns, c, r;
+        while (true) {
+            const uint32_t before = sequence.load(std::memory_order_acquire);
+            ns = anchor_ns.load(std::memory_order_relaxed);
+            c = captured.load(std::memory_order_relaxed);
+            r = recognized.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if ((before & 1) == 0 && sequence.load(std::memory_order_relaxed) == before) {
+                break;
+            }
+        }
+        if (ns == 0) {
+            return false;
+        }
+        const int64_t offset = ((int64_t) ticks_ns - (int64_t) ns) * rate / 1000000000;
+        *captured_position = (int64_t) c + offset;
+        *recognized_position = (int64_t) r + offset;
+        return true;
+    }
+};
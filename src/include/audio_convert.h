@@ -0,0 +1,281 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define AUDIO_CONVERT_SSE 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define AUDIO_CONVERT_NEON 1
+#endif
+
+// Sample formats of interleaved PCM input, all little endian
+enum pcm_sample_format {
+    PCM_S16,
+    // packed, three bytes per sample
+    PCM_S24,
+    PCM_F32,
+};
+
+inline size_t pcm_sample_size(const pcm_sample_format format) {
+    return format == PCM_S16 ? 2 : (format == PCM_S24 ? 3 : 4);
+}
+
+// Averages interleaved channels into mono float. For PCM_F32 `out` may be `in`,
+// frame i is written after all of it has been read, so capture buffers are
+// converted in place. The common channel counts have their own loops, which the
+// compiler vectorizes.
+inline void downmix_to_mono(const pcm_sample_format format, const void * in, const int channels, const size_t n_frames, float * out) {
+    const uint8_t *bytes = (const uint8_t *) in;
+    const float scale = 1.0f / channels;
+    if (format == PCM_F32) {
+        // like int16 below, the data may not be float aligned, every load goes through memcpy
+        if (channels == 1) {
+            if (out != in) {
+                memmove(out, in, n_frames * sizeof(float));
+            }
+        } else if (channels == 2) {
+            for (size_t i = 0; i < n_frames; ++i) {
+                float left;
+                float right;
+                memcpy(&left, bytes + i * 8, sizeof(left));
+                memcpy(&right, bytes + i * 8 + 4, sizeof(right));
+                out[i] = (left + right) * 0.5f;
+            }
+        } else {
+            for (size_t i = 0; i < n_frames; ++i) {
+                float sum = 0.0f;
+                for (int c = 0; c < channels; ++c) {
+                    float sample;
+                    memcpy(&sample, bytes + (i * channels + c) * 4, sizeof(sample));
+                    sum += sample;
+                }
+                out[i] = sum * scale;
+            }
+        }
+    } else if (format == PCM_S16) {
+        // the data may come straight from a file mapping without int16 alignment
+        const float s16_scale = scale * (1.0f / 32768.0f);
+        for (size_t i = 0; i < n_frames; ++i) {
+            int32_t sum = 0;
+            for (int c = 0; c < channels; ++c) {
+                int16_t sample;
+                memcpy(&sample, bytes + (i * channels + c) * 2, sizeof(sample));
+                sum += sample;
+            }
+            out[i] = sum * s16_scale;
+        }
+    } else {
+        const float s24_scale = scale * (1.0f / 8388608.0f);
+        for (size_t i = 0; i < n_frames; ++i) {
+            float sum = 0.0f;
+            for (int c = 0; c < channels; ++c) {
+                const uint8_t *p = bytes + (i * channels + c) * 3;
+                // into the top of an int32 and back down, which sign extends
+                const int32_t sample = (int32_t) ((uint32_t) p[0] << 8 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 24) >> 8;
+                sum += (float) sample;
+            }
+            out[i] = sum * s24_scale;
+        }
+    }
+}
+
+// Sum of a[i] * b[i], n is a multiple of 4
+inline float dot_product(const float * a, const float * b, const int n) {
+#if defined(AUDIO_CONVERT_SSE)
+    __m128 sum0 = _mm_setzero_ps();
+    __m128 sum1 = _mm_setzero_ps();
+    int i = 0;
+    // two accumulators hide the latency of the adds
+    for (; i + 8 <= n; i += 8) {
+        sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+    }
+    if (i < n) {
+        sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+    }
+    __m128 sum = _mm_add_ps(sum0, sum1);
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+    return _mm_cvtss_f32(sum);
+#elif defined(AUDIO_CONVERT_NEON)
+    float32x4_t sum = vdupq_n_f32(0.0f);
+    for (int i = 0; i < n; i += 4) {
+        sum = vmlaq_f32(sum, vld1q_f32(a + i), vld1q_f32(b + i));
+    }
+    const float32x2_t half = vadd_f32(vget_low_f32(sum), vget_high_f32(sum));
+    return vget_lane_f32(vpadd_f32(half, half), 0);
+#else
+    float sum[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+    for (int i = 0; i < n; i += 4) {
+        sum[0] += a[i] * b[i];
+        sum[1] += a[i + 1] * b[i + 1];
+        sum[2] += a[i + 2] * b[i + 2];
+        sum[3] += a[i + 3] * b[i + 3];
+    }
+    return (sum[0] + sum[1]) + (sum[2] + sum[3]);
+#endif
+}
+
+// Streaming polyphase resampler for mono float audio, e.g. 48 kHz or 44.1 kHz
+// down to whisper's 16 kHz.
+//
+// The ratio is reduced to up / down (1 / 3 for 48 kHz, 160 / 441 for 44.1 kHz)
+// and a Kaiser windowed sinc low-pass, whose stop band starts at the lower of
+// the two Nyquist frequencies, is split into `up` phases. Every output sample
+// is one dot product of a phase with the newest input, so only the samples
+// which are kept are computed. The filter delays the audio by half its length,
+// 2 ms.
+class polyphase_resampler {
+private:
+    int in_rate = 0;
+    int out_rate = 0;
+    int up = 1;
+    int down = 1;
+    // per phase, a multiple of 4 for dot_product()
+    int taps = 0;
+    // `up` phases of `taps` coefficients each, reversed so the dot product runs forward over the input
+    std::vector<float> coefficients;
+    // the last taps - 1 samples of the previous block followed by the current one
+    std::vector<float> buffer;
+    // index in buffer of the newest input sample of the next output, and its phase
+    size_t base = 0;
+    int phase = 0;
+
+    static int gcd(int a, int b) {
+        while (b) {
+            const int t = a % b;
+            a = b;
+            b = t;
+        }
+        return a;
+    }
+
+    // zeroth order modified Bessel function of the first kind, for the Kaiser window
+    static double bessel_i0(const double x) {
+        double sum = 1.0;
+        double term = 1.0;
+        for (int k = 1; k < 50; ++k) {
+            term *= (x / (2.0 * k)) * (x / (2.0 * k));
+            sum += term;
+            if (term < sum * 1e-12) {
+                break;
+            }
+        }
+        return sum;
+    }
+
+public:
+    // Returns false for rates it can't convert between
+    bool init(const int input_rate, const int output_rate) {
+        if (input_rate <= 0 || output_rate <= 0) {
+            return false;
+        }
+        in_rate = input_rate;
+        out_rate = output_rate;
+        const int divisor = gcd(input_rate, output_rate);
+        up = output_rate / divisor;
+        down = input_rate / divisor;
+        buffer.clear();
+        coefficients.clear();
+        phase = 0;
+        if (up == down) {
+            taps = 0;
+            base = 0;
+            return true;
+        }
+
+        // about 64 taps per sample of the lower rate, ~80 dB stop band with beta 8
+        const double ratio = (double) input_rate / output_rate;
+        taps = (int) std::ceil(64.0 * (ratio > 1.0 ? ratio : 1.0));
+        taps = (taps + 3) / 4 * 4;
+        const int length = taps * up;
+        // Normalized to the upsampled rate. Kaiser's estimate of the transition
+        // band at this length, for 90 dB to leave some margin over what beta 8
+        // reaches. It ends at the lower Nyquist frequency, so everything above
+        // is at least 80 dB down, and the pass band is flat to about 6 kHz.
+        const double transition = (90.0 - 7.95) / (14.36 * (length - 1));
+        const double cutoff = 0.5 * (input_rate < output_rate ? input_rate : output_rate) / ((double) input_rate * up) - transition / 2;
+        const double beta = 8.0;
+        const double center = (length - 1) / 2.0;
+        const double pi = 3.14159265358979323846;
+        coefficients.assign((size_t) length, 0.0f);
+        for (int n = 0; n < length; ++n) {
+            const double x = n - center;
+            const double sinc = x == 0.0 ? 2.0 * cutoff : std::sin(2.0 * pi * cutoff * x) / (pi * x);
+            const double r = x / center;
+            const double window = bessel_i0(beta * std::sqrt(r * r < 1.0 ? 1.0 - r * r : 0.0)) / bessel_i0(beta);
+            // zero stuffing by `up` takes that much gain out, put it back
+            const float h = (float) (sinc * window * up);
+            const int p = n % up;
+            const int j = n / up;
+            coefficients[(size_t) p * taps + (taps - 1 - j)] = h;
+        }
+        buffer.assign((size_t) taps - 1, 0.0f);
+        base = (size_t) taps - 1;
+        return true;
+    }
+
+    int input_rate() const {
+        return in_rate;
+    }
+
+    int output_rate() const {
+        return out_rate;
+    }
+
+    bool is_passthrough() const {
+        return up == down;
+    }
+
+    // Output samples for n_input samples fed in from the start
+    uint64_t output_length(const uint64_t n_input) const {
+        return (n_input * up + down - 1) / down;
+    }
+
+    // Upper bound of process()'s output for n_input samples
+    size_t max_output(const size_t n_input) const {
+        return (size_t) ((uint64_t) n_input * up / down) + 2;
+    }
+
+    // Resamples the next block and returns the number of samples written to out,
+    // which must hold max_output(n_input). The input is taken in before anything
+    // is written, so `out` may be `in` as long as it is large enough.
+    size_t process(const float * in, const size_t n_input, float * out) {
+        if (up == down) {
+            if (out != in) {
+                memmove(out, in, n_input * sizeof(float));
+            }
+            return n_input;
+        }
+        buffer.insert(buffer.end(), in, in + n_input);
+
+        size_t n_output = 0;
+        while (base < buffer.size()) {
+            const float *window = buffer.data() + base - (taps - 1);
+            out[n_output++] = dot_product(coefficients.data() + (size_t) phase * taps, window, taps);
+            phase += down;
+            base += phase / up;
+            phase %= up;
+        }
+
+        // keep the history the next outputs still reach back to
+        const size_t first_needed = base - (taps - 1);
+        buffer.erase(buffer.begin(), buffer.begin() + first_needed);
+        base -= first_needed;
+        return n_output;
+    }
+
+    // Forgets the history, for a new stream at the same rates
+    void reset() {
+        if (up != down) {
+            buffer.assign((size_t) taps - 1, 0.0f);
+            base = (size_t) taps - 1;
+        }
+        phase = 0;
+    }
+};
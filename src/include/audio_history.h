@@ -0,0 +1,313 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#include <SDL3/SDL.h>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// The last minutes of an input's audio in a memory-mapped file, so a stretch of
+// the session can be listened to or transcribed again after the recognizer is
+// done with it.
+//
+// The file is a fixed size ring of 16-bit samples behind a small header, created
+// and reserved on disk up front. The capture thread only copies into the mapping
+// and publishes the new write position, the kernel writes the pages back in the
+// background. Readers copy a range out and check afterwards, against the position
+// the writer claims before it overwrites anything, that none of it was replaced
+// meanwhile.
+//
+// Without a path the ring is kept in anonymous memory instead, for audio which
+// is only needed for a little while.
+//
+// Positions count every sample captured. The recognizer's timestamps skip the
+// samples its ring dropped, so those gaps are recorded to map a segment back to
+// the audio it was recognized from.
+class audio_history {
+private:
+    // at the start of the file, for tools reading it after the fact
+    struct file_header {
+        char magic[8];
+        uint32_t version;
+        uint32_t sample_rate;
+        uint64_t capacity;
+        // samples written since the start, the newest is at (written - 1) % capacity
+        uint64_t written;
+    };
+    // samples start on a page boundary
+    static const size_t HEADER_SIZE = 4096;
+
+    std::string file_path;
+    uint8_t *mapped = NULL;
+    size_t mapped_size = 0;
+#ifdef _WIN32
+    HANDLE file_handle = INVALID_HANDLE_VALUE;
+    HANDLE mapping_handle = NULL;
+#endif
+    file_header *header = NULL;
+    int16_t *samples = NULL;
+    size_t capacity = 0;
+    int rate = 0;
+
+    std::atomic<uint64_t> write_pos;
+    // where the writer is writing up to, published before the samples are overwritten
+    std::atomic<uint64_t> claim_pos;
+    // the recognizer's position in its own audio, which lags write_pos by the dropped samples
+    uint64_t stream_pos = 0;
+    // (stream position, samples dropped before it) from every drop on, only touched when samples are dropped
+    std::vector<std::pair<uint64_t, uint64_t> > gaps;
+    mutable std::mutex gaps_mutex;
+
+    audio_history(const audio_history &) = delete;
+    audio_history & operator=(const audio_history &) = delete;
+
+    bool map(const std::string & path, const size_t size) {
+#ifdef _WIN32
+        if (path.empty()) {
+            mapping_handle = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, (DWORD) ((uint64_t) size >> 32), (DWORD) size, NULL);
+            mapped = mapping_handle ? (uint8_t *) MapViewOfFile(mapping_handle, FILE_MAP_WRITE, 0, 0, size) : NULL;
+            mapped_size = size;
+            return mapped != NULL;
+        }
+        file_handle = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file_handle == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+        // the mapping grows the file to its full size
+        mapping_handle = CreateFileMappingA(file_handle, NULL, PAGE_READWRITE, (DWORD) ((uint64_t) size >> 32), (DWORD) size, NULL);
+        if (!mapping_handle) {
+            return false;
+        }
+        mapped = (uint8_t *) MapViewOfFile(mapping_handle, FILE_MAP_WRITE, 0, 0, size);
+        if (!mapped) {
+            return false;
+        }
+#else
+        if (path.empty()) {
+            void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (ptr == MAP_FAILED) {
+                return false;
+            }
+            mapped = (uint8_t *) ptr;
+            mapped_size = size;
+            return true;
+        }
+        const int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            return false;
+        }
+        bool ok = ftruncate(fd, (off_t) size) == 0;
+#if defined(__linux__)
+        // a full disk would otherwise surface as SIGBUS in the capture thread
+        ok = ok && posix_fallocate(fd, 0, (off_t) size) == 0;
+#endif
+        int flags = MAP_SHARED;
+#ifdef MAP_POPULATE
+        // no page faults on the capture thread for the first round
+        flags |= MAP_POPULATE;
+#endif
+        void *ptr = ok ? mmap(NULL, size, PROT_READ | PROT_WRITE, flags, fd, 0) : MAP_FAILED;
+        // the mapping keeps the file alive
+        ::close(fd);
+        if (ptr == MAP_FAILED) {
+            return false;
+        }
+        mapped = (uint8_t *) ptr;
+#endif
+        mapped_size = size;
+        return true;
+    }
+
+    // Clamped float to int16 conversion, written so the compiler can vectorize it
+    static void convert_to_int16(const float * data, int16_t * out, const size_t length) {
+        for (size_t i = 0; i < length; ++i) {
+            float sample = data[i] * 32767.0f;
+            sample = sample > 32767.0f ? 32767.0f : sample;
+            sample = sample < -32768.0f ? -32768.0f : sample;
+            out[i] = (int16_t) sample;
+        }
+    }
+
+public:
+    audio_history() : write_pos(0), claim_pos(0) {
+    }
+
+    ~audio_history() {
+        close();
+    }
+
+    // Creates the file for `seconds` of audio, replacing any previous one, or
+    // keeps the audio in memory if path is empty
+    bool open(const std::string & path, const int sample_rate, const int seconds) {
+        close();
+        if (sample_rate <= 0 || seconds <= 0) {
+            return false;
+        }
+        capacity = (size_t) sample_rate * seconds;
+        if (!map(path, HEADER_SIZE + capacity * sizeof(int16_t))) {
+            SDL_Log("Couldn't create audio history %s", path.empty() ? "in memory" : path.c_str());
+            close();
+            return false;
+        }
+        file_path = path;
+        rate = sample_rate;
+        header = (file_header *) mapped;
+        samples = (int16_t *) (mapped + HEADER_SIZE);
+        memcpy(header->magic, "AFSHAHST", sizeof(header->magic));
+        header->version = 1;
+        header->sample_rate = (uint32_t) sample_rate;
+        header->capacity = capacity;
+        header->written = 0;
+        write_pos.store(0);
+        claim_pos.store(0);
+        stream_pos = 0;
+        gaps.clear();
+        return true;
+    }
+
+    void close() {
+#ifdef _WIN32
+        if (mapped) {
+            UnmapViewOfFile(mapped);
+        }
+        if (mapping_handle) {
+            CloseHandle(mapping_handle);
+        }
+        if (file_handle != INVALID_HANDLE_VALUE) {
+            CloseHandle(file_handle);
+        }
+        mapping_handle = NULL;
+        file_handle = INVALID_HANDLE_VALUE;
+#else
+        if (mapped) {
+            munmap(mapped, mapped_size);
+        }
+#endif
+        mapped = NULL;
+        mapped_size = 0;
+        header = NULL;
+        samples = NULL;
+        capacity = 0;
+    }
+
+    bool is_open() const {
+        return mapped != NULL;
+    }
+
+    // Capture thread. `n_recognized` is how many of the samples the recognizer's
+    // ring took, the first ones, the rest were dropped there.
+    void write(const float * data, const size_t length, const size_t n_recognized) {
+        if (!samples || length == 0) {
+            return;
+        }
+        const uint64_t w = write_pos.load(std::memory_order_relaxed);
+        claim_pos.store(w + length, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        // only the newest `capacity` samples of a huge block would survive anyway
+        const size_t skip = length > capacity ? length - capacity : 0;
+        size_t n = length - skip;
+        size_t start = (size_t) ((w + skip) % capacity);
+        data += skip;
+        while (n > 0) {
+            const size_t run = n < capacity - start ? n : capacity - start;
+            convert_to_int16(data, samples + start, run);
+            data += run;
+            n -= run;
+            start = 0;
+        }
+        write_pos.store(w + length, std::memory_order_release);
+        header->written = w + length;
+
+        stream_pos += n_recognized;
+        if (n_recognized < length) {
+            std::lock_guard<std::mutex> lock(gaps_mutex);
+            const uint64_t dropped = (gaps.empty() ? 0 : gaps.back().second) + (length - n_recognized);
+            gaps.push_back(std::make_pair(stream_pos, dropped));
+            // gaps older than the history only matter for the total they add up to
+            const uint64_t oldest_stream = stream_pos > capacity ? stream_pos - capacity : 0;
+            size_t n_old = 0;
+            while (n_old + 1 < gaps.size() && gaps[n_old + 1].first <= oldest_stream) {
+                n_old++;
+            }
+            gaps.erase(gaps.begin(), gaps.begin() + n_old);
+        }
+    }
+
+    int sample_rate() const {
+        return rate;
+    }
+
+    // Samples captured since the start
+    uint64_t written() const {
+        return write_pos.load(std::memory_order_acquire);
+    }
+
+    // Position of the oldest sample still in the file
+    uint64_t oldest() const {
+        const uint64_t w = written();
+        return w > capacity ? w - capacity : 0;
+    }
+
+    size_t size() const {
+        return capacity;
+    }
+
+    const std::string & path() const {
+        return file_path;
+    }
+
+    // Position of the sample the recognizer's timestamp t_ms (e.g. a segment's t0_ms) refers to
+    uint64_t position_of(const int64_t t_ms) const {
+        const uint64_t position = t_ms > 0 ? (uint64_t) t_ms * rate / 1000 : 0;
+        std::lock_guard<std::mutex> lock(gaps_mutex);
+        // the last gap at or before the position
+        size_t lo = 0;
+        size_t hi = gaps.size();
+        while (lo < hi) {
+            const size_t mid = (lo + hi) / 2;
+            if (gaps[mid].first <= position) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        return position + (lo > 0 ? gaps[lo - 1].second : 0);
+    }
+
+    // Any thread. Copies [first, first + length) out as float samples, false if
+    // any of it isn't in the file (anymore).
+    bool read(const uint64_t first, const size_t length, float * out) const {
+        if (!samples || first < oldest() || first + length > written()) {
+            return false;
+        }
+        size_t start = (size_t) (first % capacity);
+        size_t n = length;
+        while (n > 0) {
+            const size_t run = n < capacity - start ? n : capacity - start;
+            const int16_t *in = samples + start;
+            for (size_t i = 0; i < run; ++i) {
+                out[i] = in[i] * (1.0f / 32768.0f);
+            }
+            out += run;
+            n -= run;
+            start = 0;
+        }
+        // the writer may have come round while copying
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return first + capacity >= claim_pos.load(std::memory_order_relaxed);
+    }
+};
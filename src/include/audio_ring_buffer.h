@@ -0,0 +1,120 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Bounded lock-free single-producer/single-consumer ring buffer for audio samples.
+//
+// The capture thread is the only writer and the speech recognition thread is the
+// only reader. The writer never blocks: if the reader falls behind and the ring is
+// full, incoming samples are dropped and counted in dropped_samples().
+//
+// Every sample is stored twice (at pos and pos + capacity), so any range of up to
+// `capacity` samples is contiguous in memory. This lets the reader hand the keep
+// overlap plus the new samples straight to whisper_full without copying them.
+class audio_ring_buffer {
+private:
+    std::vector<float> samples;
+    size_t capacity;
+    // number of already consumed samples that are kept readable for the overlap
+    size_t keep;
+
+    // Both positions only ever grow, the ring index is position % capacity
+    std::atomic<uint64_t> write_pos;
+    std::atomic<uint64_t> read_pos;
+    std::atomic<uint64_t> dropped;
+
+    audio_ring_buffer(const audio_ring_buffer &) = delete;
+    audio_ring_buffer & operator=(const audio_ring_buffer &) = delete;
+
+public:
+    audio_ring_buffer(const size_t capacity, const size_t keep) :
+        samples(capacity * 2, 0.0f),
+        capacity(capacity),
+        keep(keep < capacity ? keep : 0),
+        write_pos(0),
+        read_pos(0),
+        dropped(0) {
+    }
+
+    // Producer side. Number of samples which can be written without dropping any.
+    size_t free_space() const {
+        const uint64_t w = write_pos.load(std::memory_order_relaxed);
+        const uint64_t r = read_pos.load(std::memory_order_acquire);
+
+        // the keep tail behind the read position is still referenced by the reader
+        const uint64_t retained = r < keep ? r : keep;
+        return capacity - (size_t) (w - r) - (size_t) retained;
+    }
+
+    // Producer side. Returns the number of samples actually written, the rest is dropped.
+    size_t write(const float * data, size_t length) {
+        const uint64_t w = write_pos.load(std::memory_order_relaxed);
+        const size_t writable = free_space();
+        const size_t n = length < writable ? length : writable;
+        if (n < length) {
+            dropped.fetch_add(length - n, std::memory_order_relaxed);
+        }
+        if (n == 0) {
+            return 0;
+        }
+
+        const size_t start = (size_t) (w % capacity);
+        const size_t first = n < capacity - start ? n : capacity - start;
+        // primary copy
+        memcpy(samples.data() + start, data, sizeof(float) * first);
+        memcpy(samples.data(), data + first, sizeof(float) * (n - first));
+        // mirrored copy
+        memcpy(samples.data() + capacity + start, data, sizeof(float) * first);
+        if (n > first) {
+            memcpy(samples.data() + capacity, data + first, sizeof(float) * (n - first));
+        }
+
+        write_pos.store(w + n, std::memory_order_release);
+        return n;
+    }
+
+    // Consumer side. Number of samples written but not consumed yet.
+    size_t available() const {
+        return (size_t) (write_pos.load(std::memory_order_acquire) - read_pos.load(std::memory_order_relaxed));
+    }
+
+    // Consumer side. Returns a contiguous view over the keep overlap followed by
+    // all unconsumed samples. The view stays valid until the next consume().
+    const float * peek(size_t * n_keep, size_t * n_new) const {
+        const uint64_t r = read_pos.load(std::memory_order_relaxed);
+        const uint64_t w = write_pos.load(std::memory_order_acquire);
+        const uint64_t k = r < keep ? r : keep;
+
+        *n_keep = (size_t) k;
+        *n_new = (size_t) (w - r);
+        return samples.data() + (size_t) ((r - k) % capacity);
+    }
+
+    // Consumer side. Releases `length` samples back to the producer; the last
+    // `keep` of them stay readable as the overlap for the next peek().
+    void consume(size_t length) {
+        const uint64_t r = read_pos.load(std::memory_order_relaxed);
+        const uint64_t w = write_pos.load(std::memory_order_acquire);
+        const uint64_t n = length < w - r ? length : w - r;
+        read_pos.store(r + n, std::memory_order_release);
+    }
+
+    size_t size() const {
+        return capacity;
+    }
+
+    uint64_t total_written() const {
+        return write_pos.load(std::memory_order_relaxed);
+    }
+
+    uint64_t total_consumed() const {
+        return read_pos.load(std::memory_order_relaxed);
+    }
+
+    uint64_t dropped_samples() const {
+        return dropped.load(std::memory_order_relaxed);
+    }
+};
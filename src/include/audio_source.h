@@ -0,0 +1,312 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <vector>
+#include <SDL3/SDL.h>
+#include "whisper.h"
+#include "audio_convert.h"
+#include "thread_topology.h"
+#include "wav_reader.h"
+
+// Where the audio for a speech stream comes from: a live recording device or a
+// recorded file. Sources hand out 16 kHz mono float samples.
+class audio_source {
+public:
+    virtual ~audio_source() {}
+
+    virtual const std::string & name() const = 0;
+
+    // Live sources can't wait for the recognizer, their samples are dropped when it's
+    // behind. Other sources are only read as fast as the recognizer keeps up.
+    virtual bool is_live() const = 0;
+
+    // Starts delivering audio, on_available is called from any thread whenever new samples can be read
+    virtual bool start(std::function<void()> on_available) = 0;
+
+    virtual void stop() = 0;
+
+    // Returns how many samples (at most max_samples) can be read and points *data at them.
+    // Sources which can't hand out their own memory fill `scratch`, which holds max_samples.
+    virtual size_t read(const float ** data, size_t max_samples, float * scratch) = 0;
+
+    // Marks the samples returned by the last read() as used
+    virtual void consume(size_t length) = 0;
+
+    // No more samples will ever become available
+    virtual bool finished() const = 0;
+};
+
+// A recording device opened through SDL at its own sample rate and channel count.
+// SDL only converts the sample format to float; the samples are downmixed and
+// resampled to 16 kHz in place in the capture buffer.
+class sdl_audio_source : public audio_source {
+private:
+    std::string source_name;
+    SDL_AudioStream *stream = NULL;
+    // SDL_GetAudioStreamAvailable() bytes to wait for before waking the reader
+    int chunk_bytes;
+    int channels = 1;
+    polyphase_resampler resampler;
+    std::function<void()> on_available;
+
+    static void SDLCALL on_audio_stream_put(void *userdata, SDL_AudioStream *audio_stream, int additional_amount, int total_amount) {
+        sdl_audio_source *self = (sdl_audio_source *) userdata;
+        if (total_amount >= self->chunk_bytes) {
+            self->on_available();
+        }
+    }
+
+public:
+    explicit sdl_audio_source(const int chunk_bytes) : chunk_bytes(chunk_bytes) {
+    }
+
+    ~sdl_audio_source() {
+        stop();
+        if (stream) {
+            SDL_DestroyAudioStream(stream);
+        }
+    }
+
+    bool open(SDL_AudioDeviceID device_id) {
+        SDL_AudioSpec audio_spec;
+        SDL_zero(audio_spec);
+
+        // NOTE: Do not change the spec format to anything other than F32LE
+        audio_spec.freq = WHISPER_SAMPLE_RATE;
+        audio_spec.format = SDL_AUDIO_F32LE;
+        audio_spec.channels = 1;
+        // Devices below 16 kHz are left to SDL, its resampler is fine for upsampling
+        SDL_AudioSpec device_spec;
+        int device_frames = 0;
+        if (SDL_GetAudioDeviceFormat(device_id, &device_spec, &device_frames) && device_spec.freq >= WHISPER_SAMPLE_RATE &&
+            device_spec.channels > 0) {
+            audio_spec.freq = device_spec.freq;
+            audio_spec.channels = device_spec.channels;
+        }
+        if (!resampler.init(audio_spec.freq, WHISPER_SAMPLE_RATE)) {
+            SDL_Log("Can't resample %d Hz, letting SDL convert to %d Hz mono", audio_spec.freq, WHISPER_SAMPLE_RATE);
+            audio_spec.freq = WHISPER_SAMPLE_RATE;
+            audio_spec.channels = 1;
+            resampler.init(WHISPER_SAMPLE_RATE, WHISPER_SAMPLE_RATE);
+        }
+        channels = audio_spec.channels;
+        // the same duration of audio as at 16 kHz mono
+        chunk_bytes = (int) ((int64_t) chunk_bytes * audio_spec.freq / WHISPER_SAMPLE_RATE * channels);
+
+        stream = SDL_OpenAudioDeviceStream(device_id, &audio_spec, NULL, NULL);
+        if (!stream) {
+            SDL_Log("Couldn't create audio stream: %s", SDL_GetError());
+            return false;
+        }
+
+        SDL_AudioDeviceID dev_id = SDL_GetAudioStreamDevice(stream);
+        if (!dev_id) {
+            SDL_Log("Couldn't get audio stream device: %s", SDL_GetError());
+            return false;
+        }
+        const char *device_name = SDL_GetAudioDeviceName(dev_id);
+        source_name = device_name ? device_name : "mic";
+        SDL_Log("Got audio stream %s: freq: %d, channels: %d, format: %d", source_name.c_str(), audio_spec.freq, audio_spec.channels, audio_spec.format);
+        return true;
+    }
+
+    const std::string & name() const override {
+        return source_name;
+    }
+
+    bool is_live() const override {
+        return true;
+    }
+
+    bool start(std::function<void()> callback) override {
+        on_available = callback;
+        if (!SDL_SetAudioStreamPutCallback(stream, on_audio_stream_put, this)) {
+            SDL_Log("Couldn't set audio stream put callback: %s", SDL_GetError());
+            return false;
+        }
+        /* SDL_OpenAudioDeviceStream starts the device paused. You have to tell it to start! */
+        return SDL_ResumeAudioStreamDevice(stream);
+    }
+
+    void stop() override {
+        if (stream) {
+            SDL_SetAudioStreamPutCallback(stream, NULL, NULL);
+            SDL_PauseAudioStreamDevice(stream);
+        }
+    }
+
+    size_t read(const float ** data, size_t max_samples, float * scratch) override {
+        if (SDL_GetAudioStreamAvailable(stream) < chunk_bytes) {
+            return 0;
+        }
+        // resampling down never produces more samples than frames go in
+        const size_t max_frames = max_samples / channels;
+        const int data_available = SDL_GetAudioStreamData(stream, (void *) scratch, (int) (sizeof(float) * channels * max_frames));
+        if (data_available == -1) {
+            SDL_Log("Couldn't get audio stream data: %s", SDL_GetError());
+            return 0;
+        }
+        const size_t n_frames = data_available / (sizeof(float) * channels);
+        downmix_to_mono(PCM_F32, scratch, channels, n_frames, scratch);
+        *data = scratch;
+        return resampler.process(scratch, n_frames, scratch);
+    }
+
+    void consume(size_t length) override {
+        // SDL_GetAudioStreamData already took the samples out of the stream
+    }
+
+    bool finished() const override {
+        return false;
+    }
+};
+
+// Replays a WAV or raw PCM file from a memory mapping, either at real-time pace
+// like a microphone would deliver it or as fast as the recognizer consumes it.
+// 16 kHz mono float files are handed out without any copy, other 16 kHz files
+// are downmixed into the reader's scratch buffer, and other rates go through a
+// resampler into a buffer of the source's own.
+class file_audio_source : public audio_source {
+private:
+    std::string source_name;
+    wav_reader reader;
+    bool realtime;
+    // at 16 kHz
+    uint64_t total_frames = 0;
+
+    // frames the pacing thread has made available, and frames consumed so far
+    std::atomic<uint64_t> released;
+    uint64_t position = 0;
+
+    // files which aren't at 16 kHz: the next file frame to convert, and converted
+    // samples which haven't been consumed yet
+    polyphase_resampler resampler;
+    uint64_t file_position = 0;
+    std::vector<float> converted;
+    size_t converted_position = 0;
+
+    // Converts about n 16 kHz samples worth of the file
+    void convert(const size_t n) {
+        const uint64_t remaining = reader.frames() - file_position;
+        const uint64_t wanted = (uint64_t) n * reader.sample_rate() / WHISPER_SAMPLE_RATE + 1;
+        const size_t n_frames = (size_t) (wanted < remaining ? wanted : remaining);
+        converted.resize(n_frames > resampler.max_output(n_frames) ? n_frames : resampler.max_output(n_frames));
+        reader.to_mono_float(file_position, n_frames, converted.data());
+        converted.resize(resampler.process(converted.data(), n_frames, converted.data()));
+        converted_position = 0;
+        file_position += n_frames;
+    }
+
+    std::function<void()> on_available;
+    SDL_Thread *pacing_thread = NULL;
+    std::atomic<bool> stopping;
+
+    // Releases the file a chunk at a time at the pace it was recorded
+    static int SDLCALL run_pacing(void *ptr) {
+        file_audio_source *self = (file_audio_source *) ptr;
+        thread_role_scope scope(THREAD_ROLE_CAPTURE, "file_audio_source");
+        const Uint32 chunk_ms = 100;
+        const Uint64 start = SDL_GetTicks();
+        while (!self->stopping.load() && self->released.load() < self->total_frames) {
+            SDL_Delay(chunk_ms);
+            const uint64_t elapsed_frames = (SDL_GetTicks() - start) * WHISPER_SAMPLE_RATE / 1000;
+            self->released.store(elapsed_frames < self->total_frames ? elapsed_frames : self->total_frames);
+            self->on_available();
+        }
+        return 0;
+    }
+
+public:
+    explicit file_audio_source(const bool realtime) : realtime(realtime), released(0), stopping(false) {
+    }
+
+    ~file_audio_source() {
+        stop();
+    }
+
+    bool open(const std::string & filename) {
+        if (!reader.open(filename, WHISPER_SAMPLE_RATE)) {
+            SDL_Log("Couldn't open %s as WAV or raw PCM", filename.c_str());
+            return false;
+        }
+        if (!resampler.init((int) reader.sample_rate(), WHISPER_SAMPLE_RATE)) {
+            SDL_Log("%s: sample rate %u Hz is not supported", filename.c_str(), reader.sample_rate());
+            return false;
+        }
+        source_name = filename;
+        total_frames = resampler.output_length(reader.frames());
+        SDL_Log("Replaying %s: %.1f s, %d channels at %u Hz, %s", filename.c_str(),
+                (float) total_frames / WHISPER_SAMPLE_RATE, reader.channels(), reader.sample_rate(),
+                realtime ? "real-time" : "as fast as possible");
+        return true;
+    }
+
+    const std::string & name() const override {
+        return source_name;
+    }
+
+    bool is_live() const override {
+        return false;
+    }
+
+    bool start(std::function<void()> callback) override {
+        on_available = callback;
+        if (!realtime) {
+            released.store(total_frames);
+            on_available();
+            return true;
+        }
+        stopping.store(false);
+        pacing_thread = SDL_CreateThread(run_pacing, "file_audio_source", this);
+        if (!pacing_thread) {
+            SDL_Log("Couldn't create file pacing thread: %s", SDL_GetError());
+            return false;
+        }
+        return true;
+    }
+
+    void stop() override {
+        stopping.store(true);
+        if (pacing_thread) {
+            SDL_WaitThread(pacing_thread, NULL);
+            pacing_thread = NULL;
+        }
+    }
+
+    size_t read(const float ** data, size_t max_samples, float * scratch) override {
+        const uint64_t available = released.load() - position;
+        const size_t n = (size_t) (available < max_samples ? available : max_samples);
+        if (n == 0) {
+            return 0;
+        }
+        if (!resampler.is_passthrough()) {
+            if (converted_position >= converted.size()) {
+                convert(n);
+            }
+            const size_t n_converted = converted.size() - converted_position;
+            *data = converted.data() + converted_position;
+            return n < n_converted ? n : n_converted;
+        }
+        if (reader.is_float_mono(WHISPER_SAMPLE_RATE)) {
+            *data = (const float *) reader.samples() + position;
+        } else {
+            reader.to_mono_float(position, n, scratch);
+            *data = scratch;
+        }
+        return n;
+    }
+
+    void consume(size_t length) override {
+        position += length;
+        converted_position += length;
+    }
+
+    bool finished() const override {
+        if (!resampler.is_passthrough()) {
+            return file_position >= reader.frames() && converted_position >= converted.size();
+        }
+        return position >= total_frames;
+    }
+};
@@ -0,0 +1,228 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <SDL3/SDL.h>
+#include "whisper.h"
+#include "transcript_format.h"
+#include "wav_reader.h"
+
+struct batch_params {
+    std::vector<std::string> files;
+    std::string output_dir;
+    transcript_format format = TRANSCRIPT_FORMAT_TXT;
+    // 0 picks a default based on the number of cores
+    int n_workers = 0;
+    int n_threads = 0;
+    // decoding settings, the threads are set by the transcriber
+    whisper_full_params wparams = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
+};
+
+// Points *data at the 16 kHz mono float samples of an audio file. Files which already
+// have that format are used straight from the memory mapping in `reader`, anything
+// else is converted into `samples`.
+inline bool load_audio_file(const std::string & filename, wav_reader & reader, std::vector<float> & samples,
+                            const float ** data, size_t * length) {
+    polyphase_resampler resampler;
+    if (reader.open(filename, WHISPER_SAMPLE_RATE) && resampler.init((int) reader.sample_rate(), WHISPER_SAMPLE_RATE)) {
+        if (reader.is_float_mono(WHISPER_SAMPLE_RATE)) {
+            *data = (const float *) reader.samples();
+            *length = (size_t) reader.frames();
+            return true;
+        }
+        // downmixed and resampled a block at a time, in place in `samples`
+        const size_t block = 1 << 16;
+        const uint64_t n_frames = reader.frames();
+        samples.resize((size_t) resampler.output_length(n_frames) + resampler.max_output(block) + block);
+        size_t n_samples = 0;
+        for (uint64_t first = 0; first < n_frames; first += block) {
+            const size_t n = (size_t) (n_frames - first < block ? n_frames - first : block);
+            float *out = samples.data() + n_samples;
+            reader.to_mono_float(first, n, out);
+            n_samples += resampler.process(out, n, out);
+        }
+        samples.resize(n_samples);
+        *data = samples.data();
+        *length = samples.size();
+        return true;
+    }
+
+    // Formats the reader doesn't parse, like 8-bit or compressed WAV, go through SDL's converter
+    SDL_AudioSpec file_spec;
+    Uint8 *file_data = NULL;
+    Uint32 file_length = 0;
+    if (!SDL_LoadWAV(filename.c_str(), &file_spec, &file_data, &file_length)) {
+        SDL_Log("Couldn't load %s: %s", filename.c_str(), SDL_GetError());
+        return false;
+    }
+
+    SDL_AudioSpec whisper_spec;
+    SDL_zero(whisper_spec);
+    whisper_spec.freq = WHISPER_SAMPLE_RATE;
+    whisper_spec.format = SDL_AUDIO_F32;
+    whisper_spec.channels = 1;
+
+    Uint8 *converted_data = NULL;
+    int converted_length = 0;
+    const bool converted = SDL_ConvertAudioSamples(&file_spec, file_data, file_length, &whisper_spec, &converted_data, &converted_length);
+    SDL_free(file_data);
+    if (!converted) {
+        SDL_Log("Couldn't convert %s: %s", filename.c_str(), SDL_GetError());
+        return false;
+    }
+
+    samples.assign((const float *) converted_data, (const float *) converted_data + converted_length / sizeof(float));
+    SDL_free(converted_data);
+    *data = samples.data();
+    *length = samples.size();
+    return true;
+}
+
+// Transcribes a list of audio files with a pool of workers sharing one model.
+// Every worker owns a whisper_state, so only the per-inference buffers are
+// duplicated and the weights in the whisper_context are loaded once.
+class batch_transcriber {
+private:
+    whisper_context *ctx;
+    batch_params params;
+
+    std::atomic<size_t> next_file;
+    std::atomic<int> failed_files;
+    std::mutex totals_mutex;
+    double total_audio_seconds = 0.0;
+
+    struct worker_arg {
+        batch_transcriber *self;
+        int index;
+    };
+
+    std::string output_filename(const std::string & input) const {
+        std::string name = input;
+        if (!params.output_dir.empty()) {
+            const size_t slash = input.find_last_of("/\\");
+            name = params.output_dir + "/" + (slash == std::string::npos ? input : input.substr(slash + 1));
+        }
+        return name + transcript_format_extension(params.format);
+    }
+
+    bool transcribe_file(whisper_state *state, const std::string & filename) {
+        wav_reader reader;
+        std::vector<float> converted;
+        const float *samples = NULL;
+        size_t n_samples = 0;
+        if (!load_audio_file(filename, reader, converted, &samples, &n_samples)) {
+            return false;
+        }
+
+        whisper_full_params wparams = params.wparams;
+        wparams.n_threads = params.n_threads;
+
+        const Uint64 start = SDL_GetTicks();
+        if (whisper_full_with_state(ctx, state, wparams, samples, n_samples) != 0) {
+            SDL_Log("Failed to process %s", filename.c_str());
+            return false;
+        }
+        const Uint64 elapsed = SDL_GetTicks() - start;
+
+        std::vector<transcript_segment> segments;
+        const int n_segments = whisper_full_n_segments_from_state(state);
+        for (int i = 0; i < n_segments; ++i) {
+            transcript_segment segment;
+            // whisper timestamps are in units of 10 ms
+            segment.t0_ms = whisper_full_get_segment_t0_from_state(state, i) * 10;
+            segment.t1_ms = whisper_full_get_segment_t1_from_state(state, i) * 10;
+            segment.text = whisper_full_get_segment_text_from_state(state, i);
+            segments.push_back(segment);
+        }
+
+        const std::string output = output_filename(filename);
+        if (!write_transcript(output, segments, params.format, filename)) {
+            SDL_Log("Couldn't write %s", output.c_str());
+            return false;
+        }
+
+        const double audio_seconds = (double) n_samples / WHISPER_SAMPLE_RATE;
+        SDL_Log("Transcribed %s: %.1f s of audio in %.1f s -> %s",
+                filename.c_str(), audio_seconds, elapsed / 1000.0, output.c_str());
+        {
+            std::lock_guard<std::mutex> lock(totals_mutex);
+            total_audio_seconds += audio_seconds;
+        }
+        return true;
+    }
+
+    static int SDLCALL run_worker(void *ptr) {
+        worker_arg *arg = (worker_arg *) ptr;
+        batch_transcriber *self = arg->self;
+
+        whisper_state *state = whisper_init_state(self->ctx);
+        if (!state) {
+            SDL_Log("Batch worker %d couldn't initialize whisper state", arg->index);
+            return 1;
+        }
+        while (true) {
+            const size_t i = self->next_file.fetch_add(1);
+            if (i >= self->params.files.size()) {
+                break;
+            }
+            if (!self->transcribe_file(state, self->params.files[i])) {
+                self->failed_files.fetch_add(1);
+            }
+        }
+        whisper_free_state(state);
+        return 0;
+    }
+
+public:
+    batch_transcriber(whisper_context *ctx, const batch_params & params) :
+        ctx(ctx),
+        params(params),
+        next_file(0),
+        failed_files(0) {
+        const int n_cores = SDL_GetNumLogicalCPUCores() > 0 ? SDL_GetNumLogicalCPUCores() : 1;
+        const int n_files = (int) this->params.files.size();
+        if (this->params.n_workers <= 0) {
+            // whisper scales well up to ~4 threads per inference, use the rest for more files
+            this->params.n_workers = n_cores / 4 > 1 ? n_cores / 4 : 1;
+        }
+        if (this->params.n_workers > n_files && n_files > 0) {
+            this->params.n_workers = n_files;
+        }
+        if (this->params.n_threads <= 0) {
+            this->params.n_threads = n_cores / this->params.n_workers > 1 ? n_cores / this->params.n_workers : 1;
+        }
+    }
+
+    // Returns false if any file failed
+    bool run() {
+        SDL_Log("Batch: %zu files, %d workers x %d threads",
+                params.files.size(), params.n_workers, params.n_threads);
+        const Uint64 start = SDL_GetTicks();
+
+        std::vector<worker_arg> args(params.n_workers);
+        std::vector<SDL_Thread *> threads;
+        for (int i = 0; i < params.n_workers; ++i) {
+            args[i].self = this;
+            args[i].index = i;
+            SDL_Thread *thread = SDL_CreateThread(run_worker, "batch_worker", &args[i]);
+            if (!thread) {
+                SDL_Log("Couldn't create batch worker: %s", SDL_GetError());
+                continue;
+            }
+            threads.push_back(thread);
+        }
+        for (size_t i = 0; i < threads.size(); ++i) {
+            SDL_WaitThread(threads[i], NULL);
+        }
+
+        const double wall_seconds = (SDL_GetTicks() - start) / 1000.0;
+        SDL_Log("Batch done: %zu files (%d failed), %.1f s of audio in %.1f s, %.2f audio-seconds per second",
+                params.files.size(), failed_files.load(), total_audio_seconds, wall_seconds,
+                wall_seconds > 0.0 ? total_audio_seconds / wall_seconds : 0.0);
+
+        // if every worker failed to start, no file was picked up
+        return failed_files.load() == 0 && next_file.load() >= params.files.size();
+    }
+};
@@ -0,0 +1,191 @@
+#pragma once
+
+#include <atomic>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <SDL3/SDL.h>
+#include "thread_topology.h"
+
+// Acquires camera frames on its own thread, so the render thread never waits
+// on the camera and only sees a frame when there is a new one.
+//
+// The frames are SDL's own camera surfaces, nothing is copied. At most two are
+// held at a time: the newest frame the render thread hasn't taken yet, and the
+// one it is showing. A newer frame replaces an untaken one, which is released
+// right away and counted as dropped, so the camera's buffers never run out.
+class camera_capture {
+public:
+    // the new frame and its timestamp, in SDL_GetTicksNS() time
+    typedef std::function<void(const SDL_Surface *, Uint64)> frame_callback;
+
+private:
+    SDL_Camera *camera = NULL;
+    SDL_Thread *thread = NULL;
+    std::atomic<bool> stopping;
+    Uint32 poll_ms = 5;
+    frame_callback on_frame;
+
+    // guards latest and shown
+    std::mutex frames_mutex;
+    SDL_Surface *latest = NULL;
+    SDL_Surface *shown = NULL;
+
+    std::atomic<uint64_t> captured;
+    std::atomic<uint64_t> dropped;
+
+    camera_capture(const camera_capture &) = delete;
+    camera_capture & operator=(const camera_capture &) = delete;
+
+    static int SDLCALL run(void *ptr) {
+        camera_capture *self = (camera_capture *) ptr;
+        thread_role_scope scope(THREAD_ROLE_CAPTURE, "camera_capture");
+        while (!self->stopping.load()) {
+            // SDL has no event for new frames, poll a few times per frame interval
+            Uint64 timestamp_ns = 0;
+            SDL_Surface *frame = SDL_AcquireCameraFrame(self->camera, &timestamp_ns);
+            if (!frame) {
+                SDL_Delay(self->poll_ms);
+                continue;
+            }
+            self->captured.fetch_add(1);
+
+            SDL_Surface *replaced = NULL;
+            {
+                std::lock_guard<std::mutex> lock(self->frames_mutex);
+                replaced = self->latest;
+                self->latest = frame;
+            }
+            if (replaced) {
+                SDL_ReleaseCameraFrame(self->camera, replaced);
+                self->dropped.fetch_add(1);
+            }
+            // the render thread only releases a frame once it takes a newer one,
+            // so this one stays valid while the callback runs
+            if (self->on_frame) {
+                self->on_frame(frame, timestamp_ns);
+            }
+        }
+        return 0;
+    }
+
+public:
+    camera_capture() : stopping(false), captured(0), dropped(0) {
+    }
+
+    ~camera_capture() {
+        stop();
+    }
+
+    // callback, if any, is called from the capture thread for every new frame,
+    // which stays valid until it returns
+    bool start(SDL_Camera *opened_camera, const float fps, frame_callback callback = frame_callback()) {
+        camera = opened_camera;
+        on_frame = callback;
+        if (fps > 0.0f) {
+            poll_ms = (Uint32) (1000.0f / fps / 4.0f) > 1 ? (Uint32) (1000.0f / fps / 4.0f) : 1;
+        }
+        stopping.store(false);
+        thread = SDL_CreateThread(run, "camera_capture", this);
+        if (!thread) {
+            SDL_Log("Couldn't create camera capture thread: %s", SDL_GetError());
+            return false;
+        }
+        return true;
+    }
+
+    // Render thread. Returns a frame which hasn't been returned before, or NULL if
+    // there is none; it stays valid until the next call that returns a new frame.
+    SDL_Surface * next_frame() {
+        SDL_Surface *previous = NULL;
+        {
+            std::lock_guard<std::mutex> lock(frames_mutex);
+            if (!latest) {
+                return NULL;
+            }
+            previous = shown;
+            shown = latest;
+            latest = NULL;
+        }
+        if (previous) {
+            SDL_ReleaseCameraFrame(camera, previous);
+        }
+        return shown;
+    }
+
+    // Render thread. The frame last returned by next_frame(), if any
+    SDL_Surface * current_frame() const {
+        return shown;
+    }
+
+    uint64_t frames_captured() const {
+        return captured.load();
+    }
+
+    // Frames replaced by a newer one before the render thread took them
+    uint64_t frames_dropped() const {
+        return dropped.load();
+    }
+
+    // Joins the thread and hands every held frame back to the camera
+    void stop() {
+        stopping.store(true);
+        if (thread) {
+            SDL_WaitThread(thread, NULL);
+            thread = NULL;
+        }
+        if (latest) {
+            SDL_ReleaseCameraFrame(camera, latest);
+            latest = NULL;
+        }
+        if (shown) {
+            SDL_ReleaseCameraFrame(camera, shown);
+            shown = NULL;
+        }
+    }
+};
+
+// Copies a camera frame into a streaming texture created with the frame's own
+// pixel format, so the GPU does the YUV conversion and the CPU only copies.
+// Planar YUV goes through SDL's plane aware updates, packed formats like YUY2
+// and RGB are written straight into the locked texture.
+inline bool upload_camera_frame(SDL_Texture *texture, const SDL_Surface *frame) {
+    const Uint8 *pixels = (const Uint8 *) frame->pixels;
+    const int pitch = frame->pitch;
+    const int h = frame->h;
+    switch (frame->format) {
+        case SDL_PIXELFORMAT_NV12:
+        case SDL_PIXELFORMAT_NV21:
+            // interleaved chroma at half the height, with the same pitch as luma
+            return SDL_UpdateNVTexture(texture, NULL, pixels, pitch, pixels + pitch * h, pitch);
+        case SDL_PIXELFORMAT_IYUV:
+        case SDL_PIXELFORMAT_YV12: {
+            const int chroma_pitch = (pitch + 1) / 2;
+            const Uint8 *first = pixels + pitch * h;
+            const Uint8 *second = first + chroma_pitch * ((h + 1) / 2);
+            // IYUV is Y U V, YV12 is Y V U
+            return frame->format == SDL_PIXELFORMAT_IYUV ?
+                SDL_UpdateYUVTexture(texture, NULL, pixels, pitch, first, chroma_pitch, second, chroma_pitch) :
+                SDL_UpdateYUVTexture(texture, NULL, pixels, pitch, second, chroma_pitch, first, chroma_pitch);
+        }
+        default:
+            break;
+    }
+
+    void *texture_pixels = NULL;
+    int texture_pitch = 0;
+    if (!SDL_LockTexture(texture, NULL, &texture_pixels, &texture_pitch)) {
+        return false;
+    }
+    Uint8 *dst = (Uint8 *) texture_pixels;
+    if (texture_pitch == pitch) {
+        memcpy(dst, pixels, (size_t) pitch * h);
+    } else {
+        const int row_bytes = pitch < texture_pitch ? pitch : texture_pitch;
+        for (int y = 0; y < h; ++y) {
+            memcpy(dst + (size_t) texture_pitch * y, pixels + (size_t) pitch * y, row_bytes);
+        }
+    }
+    SDL_UnlockTexture(texture);
+    return true;
+}
@@ -0,0 +1,304 @@
+#pragma once
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+#include <SDL3/SDL.h>
+#include "audio_clock.h"
+#include "worker.h"
+
+enum camera_recording_format {
+    // planar 4:2:0 in a YUV4MPEG2 stream, which ffmpeg and most players read
+    CAMERA_RECORDING_Y4M,
+    // the camera's own pixels, rows and planes as SDL hands them over
+    CAMERA_RECORDING_RAW,
+};
+
+struct camera_recorder_params {
+    // the video goes here, the frame times to path + ".timestamps.csv"
+    std::string path;
+    camera_recording_format format = CAMERA_RECORDING_Y4M;
+    // frames which can wait for the disk before new ones are dropped
+    int pool_frames = 8;
+    int framerate_numerator = 30;
+    int framerate_denominator = 1;
+    // lines the frames up with an input's audio, if any
+    const audio_clock *clock = NULL;
+};
+
+// Bytes of a camera frame's pixels, planes included, as laid out by SDL (see
+// upload_camera_frame()), 0 for formats which aren't known
+inline size_t camera_frame_bytes(const SDL_PixelFormat format, const int pitch, const int h) {
+    switch (format) {
+        case SDL_PIXELFORMAT_NV12:
+        case SDL_PIXELFORMAT_NV21:
+            return (size_t) pitch * h + (size_t) pitch * ((h + 1) / 2);
+        case SDL_PIXELFORMAT_IYUV:
+        case SDL_PIXELFORMAT_YV12:
+            return (size_t) pitch * h + 2 * (size_t) ((pitch + 1) / 2) * ((h + 1) / 2);
+        case SDL_PIXELFORMAT_UNKNOWN:
+            return 0;
+        default:
+            // packed, including YUY2 and friends
+            return (size_t) pitch * h;
+    }
+}
+
+// Records the camera next to the transcript, without ever holding up the camera
+// or the render thread.
+//
+// The pool is a ring of frames allocated up front. The camera thread copies each
+// frame into the next free one, the recorder's I/O thread converts and writes
+// them in order and frees them again. When the disk falls behind and the ring is
+// full, the frame is dropped and counted. Nothing is allocated and no file is touched on the
+// camera thread.
+//
+// Every frame written gets a line in the timestamps file: the camera's timestamp
+// (SDL_GetTicksNS() time) and, with a clock, the audio at that moment as sample
+// positions and the transcript time in ms. Y4M assumes a constant frame rate,
+// the timestamps tell the true times and where frames were dropped.
+class camera_recorder {
+private:
+    struct frame {
+        std::vector<uint8_t> data;
+        size_t size = 0;
+        SDL_PixelFormat format = SDL_PIXELFORMAT_UNKNOWN;
+        int w = 0;
+        int h = 0;
+        int pitch = 0;
+        Uint64 timestamp_ns = 0;
+        // frames the camera delivered before this one, dropped ones included
+        uint64_t index = 0;
+    };
+
+    camera_recorder_params params;
+    std::vector<frame> pool;
+    // frames filled by the camera thread and written by the writer, pool[n % pool.size()] is frame n
+    std::atomic<uint64_t> n_filled;
+    std::atomic<uint64_t> n_written;
+    std::atomic<bool> running;
+    worker writer;
+
+    FILE *video = NULL;
+    FILE *timestamps = NULL;
+    // Y4M frames, converted to planar 4:2:0
+    std::vector<uint8_t> converted;
+    bool header_written = false;
+    int width = 0;
+    int height = 0;
+    bool failed = false;
+    bool warned_resize = false;
+
+    // camera thread only
+    uint64_t n_delivered = 0;
+    bool warned_size = false;
+
+    std::atomic<uint64_t> n_recorded;
+    std::atomic<uint64_t> n_dropped;
+    std::atomic<uint64_t> n_bytes;
+
+    camera_recorder(const camera_recorder &) = delete;
+    camera_recorder & operator=(const camera_recorder &) = delete;
+
+    enum write_result {
+        FRAME_WRITTEN,
+        // the frame doesn't match the recording's size, it's dropped
+        FRAME_SKIPPED,
+        FRAME_FAILED,
+    };
+
+    write_result write_frame(const frame & f) {
+        if (params.format == CAMERA_RECORDING_Y4M) {
+            if (!header_written) {
+                // the size is fixed by the first frame
+                width = f.w;
+                height = f.h;
+                fprintf(video, "YUV4MPEG2 W%d H%d F%d:%d Ip A1:1 C420jpeg\n", width, height,
+                        params.framerate_numerator, params.framerate_denominator);
+                header_written = true;
+            }
+            if (f.w != width || f.h != height) {
+                if (!warned_resize) {
+                    warned_resize = true;
+                    SDL_Log("Camera frames changed to %dx%d, the %dx%d recording drops them", f.w, f.h, width, height);
+                }
+                return FRAME_SKIPPED;
+            }
+            const int chroma_w = (f.w + 1) / 2;
+            converted.resize((size_t) f.w * f.h + 2 * (size_t) chroma_w * ((f.h + 1) / 2));
+            if (!SDL_ConvertPixels(f.w, f.h, f.format, f.data.data(), f.pitch, SDL_PIXELFORMAT_IYUV, converted.data(), f.w)) {
+                SDL_Log("Couldn't convert %s camera frames for recording: %s", SDL_GetPixelFormatName(f.format), SDL_GetError());
+                return FRAME_FAILED;
+            }
+            fputs("FRAME\n", video);
+            fwrite(converted.data(), 1, converted.size(), video);
+            n_bytes.fetch_add(6 + converted.size(), std::memory_order_relaxed);
+        } else {
+            if (!header_written) {
+                SDL_Log("Recording raw %s frames, %dx%d with %d bytes per row, %zu bytes each",
+                        SDL_GetPixelFormatName(f.format), f.w, f.h, f.pitch, f.size);
+                header_written = true;
+            }
+            fwrite(f.data.data(), 1, f.size, video);
+            n_bytes.fetch_add(f.size, std::memory_order_relaxed);
+        }
+        if (ferror(video)) {
+            SDL_Log("Couldn't write camera recording %s", params.path.c_str());
+            return FRAME_FAILED;
+        }
+
+        int64_t captured = -1;
+        int64_t recognized = -1;
+        if (params.clock && params.clock->position_at(f.timestamp_ns, &captured, &recognized)) {
+            fprintf(timestamps, "%llu,%llu,%lld,%lld,%lld\n", (unsigned long long) f.index, (unsigned long long) f.timestamp_ns,
+                    (long long) captured, (long long) recognized, (long long) (recognized * 1000 / params.clock->sample_rate()));
+        } else {
+            fprintf(timestamps, "%llu,%llu,,,\n", (unsigned long long) f.index, (unsigned long long) f.timestamp_ns);
+        }
+        return FRAME_WRITTEN;
+    }
+
+    // I/O thread, woken for every frame
+    void write() {
+        const uint64_t filled = n_filled.load(std::memory_order_acquire);
+        for (uint64_t i = n_written.load(std::memory_order_relaxed); i < filled; ++i) {
+            if (!failed) {
+                switch (write_frame(pool[i % pool.size()])) {
+                    case FRAME_WRITTEN:
+                        n_recorded.fetch_add(1, std::memory_order_relaxed);
+                        break;
+                    case FRAME_SKIPPED:
+                        n_dropped.fetch_add(1, std::memory_order_relaxed);
+                        break;
+                    case FRAME_FAILED:
+                        // the camera carries on without recording
+                        failed = true;
+                        running.store(false);
+                        break;
+                }
+            }
+            n_written.store(i + 1, std::memory_order_release);
+        }
+        fflush(video);
+        fflush(timestamps);
+    }
+
+public:
+    camera_recorder() : n_filled(0), n_written(0), running(false), n_recorded(0), n_dropped(0), n_bytes(0) {
+    }
+
+    ~camera_recorder() {
+        stop();
+    }
+
+    // With the size and format the camera delivers, before or while its thread runs
+    bool start(const camera_recorder_params & recorder_params, const int w, const int h, const SDL_PixelFormat format) {
+        params = recorder_params;
+        // a little room for the rows' padding
+        const int pitch = ((w * SDL_BYTESPERPIXEL(format)) + 63) / 64 * 64;
+        const size_t slot_bytes = camera_frame_bytes(format, pitch, h);
+        if (slot_bytes == 0 || params.pool_frames < 1) {
+            SDL_Log("Can't record %s camera frames", SDL_GetPixelFormatName(format));
+            return false;
+        }
+        video = fopen(params.path.c_str(), "wb");
+        timestamps = fopen((params.path + ".timestamps.csv").c_str(), "w");
+        if (!video || !timestamps) {
+            SDL_Log("Couldn't create camera recording %s", params.path.c_str());
+            stop();
+            return false;
+        }
+        fputs("frame,camera_ns,audio_sample,stream_sample,stream_ms\n", timestamps);
+
+        pool.assign((size_t) params.pool_frames, frame());
+        for (size_t i = 0; i < pool.size(); ++i) {
+            pool[i].data.resize(slot_bytes);
+        }
+        n_filled.store(0);
+        n_written.store(0);
+        failed = false;
+        header_written = false;
+        warned_resize = false;
+        if (!writer.start("camera_recorder", std::bind(&camera_recorder::write, this), THREAD_ROLE_IO)) {
+            stop();
+            return false;
+        }
+        running.store(true);
+        SDL_Log("Recording the camera to %s, %d frames of %.1f MB can wait for the disk", params.path.c_str(),
+                params.pool_frames, slot_bytes / 1e6);
+        return true;
+    }
+
+    bool is_recording() const {
+        return running.load();
+    }
+
+    // Camera thread, for every frame it acquired. Never blocks.
+    void add(const SDL_Surface * surface, const Uint64 timestamp_ns) {
+        const uint64_t index = n_delivered++;
+        // the pool is set up before the recorder runs
+        if (!running.load(std::memory_order_acquire)) {
+            return;
+        }
+        const size_t size = camera_frame_bytes(surface->format, surface->pitch, surface->h);
+        if (size == 0 || size > pool[0].data.size()) {
+            if (!warned_size) {
+                warned_size = true;
+                SDL_Log("Camera frames of %zu bytes don't fit the recording pool, they are dropped", size);
+            }
+            n_dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        const uint64_t filled = n_filled.load(std::memory_order_relaxed);
+        if (filled - n_written.load(std::memory_order_acquire) >= pool.size()) {
+            // the disk is behind
+            n_dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        frame &f = pool[filled % pool.size()];
+        memcpy(f.data.data(), surface->pixels, size);
+        f.size = size;
+        f.format = surface->format;
+        f.w = surface->w;
+        f.h = surface->h;
+        f.pitch = surface->pitch;
+        f.timestamp_ns = timestamp_ns;
+        f.index = index;
+        n_filled.store(filled + 1, std::memory_order_release);
+        writer.notify();
+    }
+
+    uint64_t recorded() const {
+        return n_recorded.load(std::memory_order_relaxed);
+    }
+
+    // Frames not recorded because the disk was behind or, in Y4M, their size
+    // differs from the first frame's
+    uint64_t dropped() const {
+        return n_dropped.load(std::memory_order_relaxed);
+    }
+
+    uint64_t bytes_written() const {
+        return n_bytes.load(std::memory_order_relaxed);
+    }
+
+    // After the camera thread stopped, writes out the frames still waiting
+    void stop() {
+        running.store(false);
+        writer.stop();
+        if (video) {
+            write();
+        }
+        if (video) {
+            fclose(video);
+            video = NULL;
+        }
+        if (timestamps) {
+            fclose(timestamps);
+            timestamps = NULL;
+        }
+    }
+};
@@ -0,0 +1,209 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <SDL3/SDL.h>
+#include "whisper.h"
+#include "worker.h"
+#include "speech_stream.h"
+#include "adaptive_tuner.h"
+
+// What a decode slot did with a stream, reported after every step
+struct decode_step {
+    // whisper ran, as opposed to the VAD gate waiting or skipping the audio
+    bool decoded = false;
+    // wall time of the step
+    double seconds = 0.0;
+    // samples the stream had buffered when the step started, how far it was behind
+    size_t backlog = 0;
+    // new samples the step went through, decoded or skipped
+    size_t samples = 0;
+};
+
+// Spreads the decode jobs of several speech_streams over a fixed core budget.
+//
+// The budget is split into a number of decode slots, each a worker running one
+// whisper_full at a time with n_threads / n_slots threads. When a slot is free it
+// takes the ready stream with the largest backlog, so no stream falls further
+// behind than the others and every stream's latency stays bounded.
+class decode_scheduler {
+public:
+    typedef std::function<void(const speech_stream &, const transcript_segment &)> segment_callback;
+    typedef std::function<void(const speech_stream &, const decode_step &)> step_callback;
+
+private:
+    whisper_context *ctx = NULL;
+    std::vector<speech_stream *> streams;
+    std::vector<std::unique_ptr<worker> > slots;
+    // slots whose worker runs, published after each starts. notify() comes from
+    // the capture thread, which may run before start() and while it adds slots.
+    std::atomic<size_t> n_running;
+    int n_threads_per_slot = 1;
+    whisper_full_params base_params;
+    adaptive_tuner *tuner = NULL;
+    segment_callback on_segment;
+    step_callback on_step;
+
+    // guards which streams are being decoded
+    std::mutex streams_mutex;
+    std::vector<bool> busy;
+    std::atomic<bool> stopping;
+
+    decode_scheduler(const decode_scheduler &) = delete;
+    decode_scheduler & operator=(const decode_scheduler &) = delete;
+
+    static bool abort_on_stop(void *user_data) {
+        return ((decode_scheduler *) user_data)->stopping.load();
+    }
+
+    int acquire() {
+        std::lock_guard<std::mutex> lock(streams_mutex);
+        int best = -1;
+        for (size_t i = 0; i < streams.size(); ++i) {
+            if (busy[i] || !streams[i]->ready()) {
+                continue;
+            }
+            if (best < 0 || streams[i]->backlog() > streams[best]->backlog()) {
+                best = (int) i;
+            }
+        }
+        if (best >= 0) {
+            busy[best] = true;
+        }
+        return best;
+    }
+
+    void release(int index) {
+        std::lock_guard<std::mutex> lock(streams_mutex);
+        busy[index] = false;
+    }
+
+    void run_slot() {
+        std::vector<transcript_segment> segments;
+        int index;
+        while (!stopping.load() && (index = acquire()) >= 0) {
+            speech_stream *stream = streams[index];
+
+            whisper_full_params wparams = base_params;
+            wparams.n_threads = n_threads_per_slot;
+            wparams.abort_callback = abort_on_stop;
+            wparams.abort_callback_user_data = this;
+            if (tuner) {
+                wparams.n_threads = tuner->n_threads();
+                stream->set_step(tuner->step());
+                stream->set_fit_audio_ctx(tuner->fitted_audio_ctx());
+            }
+
+            decode_step step;
+            step.backlog = stream->backlog();
+            const Uint64 start = SDL_GetPerformanceCounter();
+            segments.clear();
+            step.decoded = stream->recognize(ctx, wparams, segments);
+            step.seconds = (double) (SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+            step.samples = stream->step_samples();
+            if (tuner && step.decoded) {
+                tuner->observe(step.seconds, step.samples, step.backlog);
+            }
+            // the callbacks read the stream's totals, and the segments go out in
+            // order, so no other slot may take the stream before they are done
+            if (on_step) {
+                on_step(*stream, step);
+            }
+            for (size_t i = 0; i < segments.size(); ++i) {
+                on_segment(*stream, segments[i]);
+            }
+            release(index);
+        }
+    }
+
+public:
+    decode_scheduler() :
+        n_running(0),
+        base_params(whisper_full_default_params(WHISPER_SAMPLING_GREEDY)),
+        stopping(false) {
+        base_params.print_progress = false;
+    }
+
+    ~decode_scheduler() {
+        stop();
+    }
+
+    // Streams must be added before start(), on the thread which calls it
+    void add_stream(speech_stream *stream) {
+        std::lock_guard<std::mutex> lock(streams_mutex);
+        streams.push_back(stream);
+        busy.push_back(false);
+    }
+
+    // Called from the decode slot after every step, when a stream may have room for
+    // more audio again. Must be set before start()
+    void set_step_callback(step_callback callback) {
+        on_step = callback;
+    }
+
+    // Decoding parameters for every step, the threads are set by the scheduler.
+    // Strings they point to must outlive the scheduler. Must be set before start()
+    void set_full_params(const whisper_full_params & params) {
+        base_params = params;
+    }
+
+    // Lets the tuner pick the threads per slot, the step length and the audio context
+    // from the given range. Must be set before start()
+    void set_tuner(adaptive_tuner *adaptive) {
+        tuner = adaptive;
+    }
+
+    // n_threads is the total core budget for inference, n_slots how many
+    // whisper_full calls may run at the same time (0 = one per stream)
+    bool start(whisper_context *whisper_ctx, int n_threads, int n_slots, segment_callback callback) {
+        ctx = whisper_ctx;
+        on_segment = callback;
+        if (n_slots <= 0 || n_slots > (int) streams.size()) {
+            n_slots = streams.size() > 0 ? (int) streams.size() : 1;
+        }
+        if (n_slots > n_threads) {
+            n_slots = n_threads > 0 ? n_threads : 1;
+        }
+        n_threads_per_slot = n_threads / n_slots > 1 ? n_threads / n_slots : 1;
+        if (tuner) {
+            // whisper's default of 4 to start with, up to the slot's share of the budget
+            tuner->set_thread_range(n_threads_per_slot < 4 ? n_threads_per_slot : 4, n_threads_per_slot);
+        }
+
+        SDL_Log("Decode scheduler: %zu streams, %d slots x %d threads", streams.size(), n_slots, n_threads_per_slot);
+        stopping.store(false);
+        // never reallocated while notify() may read it
+        slots.reserve(n_slots);
+        for (int i = 0; i < n_slots; ++i) {
+            slots.push_back(std::unique_ptr<worker>(new worker()));
+            const std::string name = "decode_slot_" + std::to_string(i);
+            if (!slots.back()->start(name.c_str(), std::bind(&decode_scheduler::run_slot, this), THREAD_ROLE_DECODE)) {
+                return false;
+            }
+            n_running.store(slots.size(), std::memory_order_release);
+        }
+        return true;
+    }
+
+    // Any thread, whenever a stream got new audio. Does nothing before start()
+    void notify() {
+        const size_t n = n_running.load(std::memory_order_acquire);
+        for (size_t i = 0; i < n; ++i) {
+            slots[i]->notify();
+        }
+    }
+
+    // Once nothing calls notify() any more
+    void stop() {
+        stopping.store(true);
+        n_running.store(0);
+        for (size_t i = 0; i < slots.size(); ++i) {
+            slots[i]->stop();
+        }
+        slots.clear();
+    }
+};
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <atomic>
+#include <cstring>
+#include <SDL3/SDL.h>
+
+enum frame_pacing_mode {
+    // a frame every iteration, as fast as vsync and the FPS cap allow
+    FRAME_PACING_CONTINUOUS,
+    // a frame only when something changed, the main thread sleeps otherwise
+    FRAME_PACING_ON_DEMAND,
+};
+
+// Decides, once per SDL_AppIterate, whether the UI draws a frame.
+//
+// On demand, a frame is drawn when an input event arrived, another thread asked
+// for one (a camera frame or transcript segment was published), or something on
+// screen is animating, e.g. a progress bar. Otherwise the main thread blocks in
+// SDL_WaitEventTimeout until an event arrives, without taking it out of the
+// queue: SDL hands it to SDL_AppEvent before the next iteration. Other threads
+// wake it by pushing an event of their own, once until the next frame however
+// often they ask. A frame is still drawn every idle_ms, for the clock and
+// counters on screen.
+//
+// A few frames follow every input event, as ImGui needs them to settle hover
+// and layout changes. The FPS cap applies in both modes.
+class frame_pacer {
+private:
+    // frames drawn after an input event
+    static const int SETTLE_FRAMES = 3;
+
+    frame_pacing_mode mode = FRAME_PACING_CONTINUOUS;
+    Uint64 min_frame_ns = 0;
+    Uint64 idle_ns = 1000000000;
+    Uint32 wake_event = 0;
+
+    std::atomic<bool> dirty;
+    int settle_frames = SETTLE_FRAMES;
+    bool animating = false;
+    Uint64 last_frame_ns = 0;
+
+    std::atomic<uint64_t> n_drawn;
+    std::atomic<uint64_t> n_skipped;
+
+    frame_pacer(const frame_pacer &) = delete;
+    frame_pacer & operator=(const frame_pacer &) = delete;
+
+public:
+    frame_pacer() : dirty(true), n_drawn(0), n_skipped(0) {
+    }
+
+    // Main thread, before any thread may ask for a redraw. max_fps 0 leaves the
+    // pace to vsync.
+    void init(const frame_pacing_mode pacing_mode, const int max_fps, const int idle_ms) {
+        mode = pacing_mode;
+        min_frame_ns = max_fps > 0 ? 1000000000ull / (Uint64) max_fps : 0;
+        idle_ns = (Uint64) (idle_ms > 0 ? idle_ms : 1000) * 1000000ull;
+        if (mode == FRAME_PACING_ON_DEMAND) {
+            wake_event = SDL_RegisterEvents(1);
+            if (wake_event == 0) {
+                SDL_Log("Couldn't register the redraw event, drawing every frame");
+                mode = FRAME_PACING_CONTINUOUS;
+            }
+        }
+    }
+
+    frame_pacing_mode get_mode() const {
+        return mode;
+    }
+
+    // Any thread, never blocks
+    void request_redraw() {
+        if (dirty.exchange(true) || wake_event == 0) {
+            return;
+        }
+        SDL_Event event;
+        memset(&event, 0, sizeof(event));
+        event.type = wake_event;
+        SDL_PushEvent(&event);
+    }
+
+    // Main thread, from SDL_AppEvent
+    void on_event(const SDL_Event * event) {
+        if (event->type == wake_event && wake_event != 0) {
+            return;
+        }
+        settle_frames = SETTLE_FRAMES;
+    }
+
+    // Main thread, while something on screen changes by itself, e.g. a progress
+    // bar. Set again every frame.
+    void set_animating(const bool is_animating) {
+        animating = is_animating;
+    }
+
+    // Main thread, at the start of an iteration. False if there is nothing to
+    // draw, after waiting a while for something to happen.
+    bool begin_frame() {
+        Uint64 now = SDL_GetTicksNS();
+        if (mode == FRAME_PACING_ON_DEMAND && !animating && settle_frames == 0 && !dirty.load()) {
+            const Uint64 due = last_frame_ns + idle_ns;
+            if (now < due) {
+                // rounded up, so it doesn't wake up just before the frame is due
+                const Uint64 wait_ms = (due - now + 999999) / 1000000;
+                SDL_WaitEventTimeout(NULL, (Sint32) (wait_ms < 1000 ? wait_ms : 1000));
+                n_skipped.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+        }
+        if (min_frame_ns > 0 && last_frame_ns > 0 && now - last_frame_ns < min_frame_ns) {
+            SDL_DelayPrecise(min_frame_ns - (now - last_frame_ns));
+            now = SDL_GetTicksNS();
+        }
+        last_frame_ns = now;
+        // asked for from here on, it makes it into this frame or the next
+        dirty.store(false);
+        if (settle_frames > 0) {
+            settle_frames--;
+        }
+        n_drawn.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    uint64_t drawn() const {
+        return n_drawn.load(std::memory_order_relaxed);
+    }
+
+    // Iterations which didn't draw because nothing changed
+    uint64_t skipped() const {
+        return n_skipped.load(std::memory_order_relaxed);
+    }
+};
@@ -0,0 +1,250 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <SDL3/SDL.h>
+#include "whisper.h"
+#include "thread_topology.h"
+#include "transcript_format.h"
+#include "whisper_params.h"
+
+enum history_job_status {
+    HISTORY_JOB_IDLE,
+    HISTORY_JOB_LOADING,
+    HISTORY_JOB_RUNNING,
+    HISTORY_JOB_DONE,
+    HISTORY_JOB_FAILED,
+};
+
+// A stretch of recorded audio to transcribe again and how
+struct history_job {
+    std::string stream;
+    // 16 kHz mono, copied out of the audio history
+    std::vector<float> samples;
+    // where the samples start, added to the segment times
+    int64_t start_ms = 0;
+    // the model and decoding settings, a model other than the live one is loaded for the job
+    whisper_params params;
+    // beam search with this many beams, greedy below 2
+    int beam_size = 0;
+    int n_threads = 0;
+};
+
+// Transcribes recorded audio again on a background thread, e.g. with a larger
+// model or beam search, while the live streams carry on.
+//
+// The job gets its own whisper_state, on the live context when it uses the same
+// model, so the weights aren't loaded twice. Another model is loaded for the job
+// and kept for the next one. The thread runs in the background role, at low
+// priority unless configured otherwise, the live decoders get the cores first and
+// it only uses what they leave.
+class history_transcriber {
+private:
+    SDL_Thread *thread = NULL;
+    history_job job;
+    whisper_context *live_ctx = NULL;
+    std::string live_model;
+
+    // a model other than the live one, kept between jobs
+    whisper_context *own_ctx = NULL;
+    std::string own_model;
+
+    std::atomic<int> status;
+    std::atomic<int> progress_percent;
+    std::atomic<bool> cancelled;
+    std::mutex result_mutex;
+    std::vector<transcript_segment> result;
+    double elapsed_seconds = 0.0;
+
+    history_transcriber(const history_transcriber &) = delete;
+    history_transcriber & operator=(const history_transcriber &) = delete;
+
+    static void on_progress(whisper_context *ctx, whisper_state *state, int progress, void *user_data) {
+        ((history_transcriber *) user_data)->progress_percent.store(progress);
+    }
+
+    static bool on_abort(void *user_data) {
+        return ((history_transcriber *) user_data)->cancelled.load();
+    }
+
+    whisper_context * context_for(const std::string & model) {
+        if (live_ctx && model == live_model) {
+            return live_ctx;
+        }
+        if (own_ctx && model == own_model) {
+            return own_ctx;
+        }
+        if (own_ctx) {
+            whisper_free(own_ctx);
+            own_ctx = NULL;
+        }
+        status.store(HISTORY_JOB_LOADING);
+        own_ctx = whisper_init_from_file_with_params_no_state(model.c_str(), whisper_params_context(job.params));
+        if (!own_ctx) {
+            SDL_Log("Couldn't load whisper model %s", model.c_str());
+            return NULL;
+        }
+        own_model = model;
+        // the load itself can't be interrupted, the job can
+        return cancelled.load() ? NULL : own_ctx;
+    }
+
+    static int SDLCALL run(void *ptr) {
+        history_transcriber *self = (history_transcriber *) ptr;
+        // the live streams come first
+        thread_role_scope scope(THREAD_ROLE_BACKGROUND, "history_transcriber");
+        const Uint64 start = SDL_GetPerformanceCounter();
+        const bool ok = self->transcribe();
+        const double elapsed = (double) (SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+        {
+            std::lock_guard<std::mutex> lock(self->result_mutex);
+            self->elapsed_seconds = elapsed;
+        }
+        if (ok) {
+            SDL_Log("%s: transcribed %.1f s of history again in %.1f s", self->job.stream.c_str(),
+                    (double) self->job.samples.size() / WHISPER_SAMPLE_RATE, elapsed);
+        }
+        self->status.store(ok ? HISTORY_JOB_DONE : HISTORY_JOB_FAILED);
+        return 0;
+    }
+
+    bool transcribe() {
+        whisper_context *ctx = context_for(job.params.model);
+        if (!ctx) {
+            return false;
+        }
+        whisper_state *state = whisper_init_state(ctx);
+        if (!state) {
+            SDL_Log("Couldn't initialize whisper state for the history");
+            return false;
+        }
+        status.store(HISTORY_JOB_RUNNING);
+
+        whisper_full_params wparams = whisper_params_full(job.params);
+        if (job.beam_size > 1) {
+            wparams.strategy = WHISPER_SAMPLING_BEAM_SEARCH;
+            wparams.beam_search.beam_size = job.beam_size;
+        }
+        wparams.n_threads = job.n_threads;
+        wparams.print_timestamps = false;
+        // the whole range is one piece of audio, not a step of a stream
+        wparams.no_context = false;
+        wparams.max_tokens = 0;
+        wparams.audio_ctx = 0;
+        wparams.progress_callback = on_progress;
+        wparams.progress_callback_user_data = this;
+        wparams.abort_callback = on_abort;
+        wparams.abort_callback_user_data = this;
+
+        const int ret = whisper_full_with_state(ctx, state, wparams, job.samples.data(), (int) job.samples.size());
+        if (ret != 0) {
+            SDL_Log(cancelled.load() ? "Transcribing the history was cancelled" : "Failed to transcribe the history");
+            whisper_free_state(state);
+            return false;
+        }
+
+        std::vector<transcript_segment> segments;
+        const int n_segments = whisper_full_n_segments_from_state(state);
+        for (int i = 0; i < n_segments; ++i) {
+            transcript_segment segment;
+            // whisper timestamps are in units of 10 ms
+            segment.t0_ms = job.start_ms + whisper_full_get_segment_t0_from_state(state, i) * 10;
+            segment.t1_ms = job.start_ms + whisper_full_get_segment_t1_from_state(state, i) * 10;
+            segment.text = whisper_full_get_segment_text_from_state(state, i);
+            segments.push_back(segment);
+        }
+        whisper_free_state(state);
+
+        std::lock_guard<std::mutex> lock(result_mutex);
+        result.swap(segments);
+        return true;
+    }
+
+public:
+    history_transcriber() : status(HISTORY_JOB_IDLE), progress_percent(0), cancelled(false) {
+    }
+
+    ~history_transcriber() {
+        stop();
+    }
+
+    // ctx, loaded from model, is used for jobs with that model, it may be NULL until it is loaded
+    void set_live_context(whisper_context *ctx, const std::string & model) {
+        live_ctx = ctx;
+        live_model = model;
+    }
+
+    // Starts a job unless one is running. The live context must outlive the job, see stop()
+    bool submit(const history_job & next) {
+        if (busy()) {
+            return false;
+        }
+        if (thread) {
+            SDL_WaitThread(thread, NULL);
+            thread = NULL;
+        }
+        job = next;
+        cancelled.store(false);
+        progress_percent.store(0);
+        {
+            std::lock_guard<std::mutex> lock(result_mutex);
+            result.clear();
+            elapsed_seconds = 0.0;
+        }
+        status.store(HISTORY_JOB_RUNNING);
+        thread = SDL_CreateThread(run, "history_transcriber", this);
+        if (!thread) {
+            SDL_Log("Couldn't create history transcriber thread: %s", SDL_GetError());
+            status.store(HISTORY_JOB_FAILED);
+            return false;
+        }
+        return true;
+    }
+
+    bool busy() const {
+        const int s = status.load();
+        return s == HISTORY_JOB_LOADING || s == HISTORY_JOB_RUNNING;
+    }
+
+    history_job_status get_status() const {
+        return (history_job_status) status.load();
+    }
+
+    // 0 to 1 while running
+    float progress() const {
+        return progress_percent.load() / 100.0f;
+    }
+
+    // The job's audio and settings, stable while the status is done or failed
+    const history_job & current_job() const {
+        return job;
+    }
+
+    // Copies the segments of the last job which finished
+    void get_result(std::vector<transcript_segment> & segments, double * seconds) {
+        std::lock_guard<std::mutex> lock(result_mutex);
+        segments = result;
+        *seconds = elapsed_seconds;
+    }
+
+    // Asks a running job to stop at the next chance whisper gives, without waiting
+    // for it. A model being loaded for the job is loaded to the end first.
+    void cancel() {
+        cancelled.store(true);
+    }
+
+    // Cancels and joins the job, before the live context is freed
+    void stop() {
+        cancel();
+        if (thread) {
+            SDL_WaitThread(thread, NULL);
+            thread = NULL;
+        }
+        if (own_ctx) {
+            whisper_free(own_ctx);
+            own_ctx = NULL;
+        }
+    }
+};
@@ -0,0 +1,412 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "whisper.h"
+#include "audio_convert.h"
+
+// whisper's log mel front end: a Hann window of WHISPER_N_FFT samples every
+// WHISPER_HOP_LENGTH samples, the power spectrum, a Slaney mel filterbank (the
+// one librosa builds, which is what the models were trained on) and log10.
+//
+// N = 400 isn't a power of two, so the spectrum is a real DFT. The input is
+// folded into its even and odd halves around N / 2, which halves the work, and
+// the DFT is a product with cos and sin tables, 201 bins wide, which the SIMD
+// loops run through 8 bins at a time.
+class log_mel_frontend {
+public:
+    static const int N_FFT = WHISPER_N_FFT;
+    static const int HOP = WHISPER_HOP_LENGTH;
+    // frequency bins from 0 to Nyquist
+    static const int N_BINS = N_FFT / 2 + 1;
+
+private:
+    static const int HALF = N_FFT / 2;
+    // a multiple of 8 for the SIMD loops, the bins past N_BINS are zero
+    static const int N_BINS_PADDED = (N_BINS + 7) / 8 * 8;
+
+    int n_mel = 0;
+    std::vector<float> window;
+    // row n holds cos(2 pi k n / N) and sin(2 pi k n / N) for every bin k, n = 0 .. N / 2
+    std::vector<float> cos_table;
+    std::vector<float> sin_table;
+    // the non-zero bins of each filter, padded to multiples of 4 for dot_product()
+    std::vector<int> filter_start;
+    std::vector<int> filter_size;
+    std::vector<size_t> filter_offset;
+    std::vector<float> filter_weights;
+
+    static double hz_to_mel(const double hz) {
+        // linear below 1 kHz, logarithmic above
+        const double f_sp = 200.0 / 3.0;
+        const double min_log_mel = 1000.0 / f_sp;
+        const double log_step = log(6.4) / 27.0;
+        return hz < 1000.0 ? hz / f_sp : min_log_mel + log(hz / 1000.0) / log_step;
+    }
+
+    static double mel_to_hz(const double mel) {
+        const double f_sp = 200.0 / 3.0;
+        const double min_log_mel = 1000.0 / f_sp;
+        const double log_step = log(6.4) / 27.0;
+        return mel < min_log_mel ? mel * f_sp : 1000.0 * exp(log_step * (mel - min_log_mel));
+    }
+
+    // power[k] = re[k]^2 + im[k]^2 of the folded frame
+    void dft_power(const float * even, const float * odd, float * power) const {
+#if defined(AUDIO_CONVERT_SSE)
+        for (int k = 0; k < N_BINS_PADDED; k += 8) {
+            __m128 re0 = _mm_setzero_ps();
+            __m128 re1 = _mm_setzero_ps();
+            __m128 im0 = _mm_setzero_ps();
+            __m128 im1 = _mm_setzero_ps();
+            for (int n = 0; n <= HALF; ++n) {
+                const float *c = cos_table.data() + (size_t) n * N_BINS_PADDED + k;
+                const float *s = sin_table.data() + (size_t) n * N_BINS_PADDED + k;
+                const __m128 e = _mm_set1_ps(even[n]);
+                const __m128 o = _mm_set1_ps(odd[n]);
+                re0 = _mm_add_ps(re0, _mm_mul_ps(_mm_loadu_ps(c), e));
+                re1 = _mm_add_ps(re1, _mm_mul_ps(_mm_loadu_ps(c + 4), e));
+                im0 = _mm_add_ps(im0, _mm_mul_ps(_mm_loadu_ps(s), o));
+                im1 = _mm_add_ps(im1, _mm_mul_ps(_mm_loadu_ps(s + 4), o));
+            }
+            _mm_storeu_ps(power + k, _mm_add_ps(_mm_mul_ps(re0, re0), _mm_mul_ps(im0, im0)));
+            _mm_storeu_ps(power + k + 4, _mm_add_ps(_mm_mul_ps(re1, re1), _mm_mul_ps(im1, im1)));
+        }
+#elif defined(AUDIO_CONVERT_NEON)
+        for (int k = 0; k < N_BINS_PADDED; k += 8) {
+            float32x4_t re0 = vdupq_n_f32(0.0f);
+            float32x4_t re1 = vdupq_n_f32(0.0f);
+            float32x4_t im0 = vdupq_n_f32(0.0f);
+            float32x4_t im1 = vdupq_n_f32(0.0f);
+            for (int n = 0; n <= HALF; ++n) {
+                const float *c = cos_table.data() + (size_t) n * N_BINS_PADDED + k;
+                const float *s = sin_table.data() + (size_t) n * N_BINS_PADDED + k;
+                const float32x4_t e = vdupq_n_f32(even[n]);
+                const float32x4_t o = vdupq_n_f32(odd[n]);
+                re0 = vmlaq_f32(re0, vld1q_f32(c), e);
+                re1 = vmlaq_f32(re1, vld1q_f32(c + 4), e);
+                im0 = vmlaq_f32(im0, vld1q_f32(s), o);
+                im1 = vmlaq_f32(im1, vld1q_f32(s + 4), o);
+            }
+            vst1q_f32(power + k, vmlaq_f32(vmulq_f32(re0, re0), im0, im0));
+            vst1q_f32(power + k + 4, vmlaq_f32(vmulq_f32(re1, re1), im1, im1));
+        }
+#else
+        float re[N_BINS_PADDED];
+        float im[N_BINS_PADDED];
+        memset(re, 0, sizeof(re));
+        memset(im, 0, sizeof(im));
+        // one row at a time, the inner loop has no reduction and the compiler vectorizes it
+        for (int n = 0; n <= HALF; ++n) {
+            const float *c = cos_table.data() + (size_t) n * N_BINS_PADDED;
+            const float *s = sin_table.data() + (size_t) n * N_BINS_PADDED;
+            const float e = even[n];
+            const float o = odd[n];
+            for (int k = 0; k < N_BINS_PADDED; ++k) {
+                re[k] += c[k] * e;
+                im[k] += s[k] * o;
+            }
+        }
+        for (int k = 0; k < N_BINS_PADDED; ++k) {
+            power[k] = re[k] * re[k] + im[k] * im[k];
+        }
+#endif
+    }
+
+public:
+    // log10 of whisper's floor on the mel energies, what a frame of silence comes out as
+    static float silence() {
+        return -10.0f;
+    }
+
+    // Builds the tables for a model with n_mels mel bands, 80 or 128
+    void init(const int n_mels) {
+        n_mel = n_mels;
+        const double pi = 3.14159265358979323846;
+        window.resize(N_FFT);
+        for (int i = 0; i < N_FFT; ++i) {
+            // periodic, as whisper's
+            window[i] = (float) (0.5 * (1.0 - cos(2.0 * pi * i / N_FFT)));
+        }
+        cos_table.assign((size_t) (HALF + 1) * N_BINS_PADDED, 0.0f);
+        sin_table.assign((size_t) (HALF + 1) * N_BINS_PADDED, 0.0f);
+        for (int n = 0; n <= HALF; ++n) {
+            for (int k = 0; k < N_BINS; ++k) {
+                // k * n reduced mod N first keeps the angle, and so the table, exact
+                const double angle = 2.0 * pi * (double) ((k * n) % N_FFT) / N_FFT;
+                cos_table[(size_t) n * N_BINS_PADDED + k] = (float) cos(angle);
+                sin_table[(size_t) n * N_BINS_PADDED + k] = (float) sin(angle);
+            }
+        }
+
+        // band edges evenly spaced on the mel scale up to Nyquist
+        const double sample_rate = WHISPER_SAMPLE_RATE;
+        std::vector<double> edges(n_mel + 2);
+        const double max_mel = hz_to_mel(sample_rate / 2);
+        for (int i = 0; i < n_mel + 2; ++i) {
+            edges[i] = mel_to_hz(max_mel * i / (n_mel + 1));
+        }
+        filter_start.assign(n_mel, 0);
+        filter_size.assign(n_mel, 0);
+        filter_offset.assign(n_mel, 0);
+        filter_weights.clear();
+        std::vector<float> weights(N_BINS_PADDED);
+        for (int j = 0; j < n_mel; ++j) {
+            // triangles normalized to the same area
+            const double norm = 2.0 / (edges[j + 2] - edges[j]);
+            int first = N_BINS;
+            int last = 0;
+            for (int k = 0; k < N_BINS; ++k) {
+                const double hz = k * sample_rate / N_FFT;
+                const double lower = (hz - edges[j]) / (edges[j + 1] - edges[j]);
+                const double upper = (edges[j + 2] - hz) / (edges[j + 2] - edges[j + 1]);
+                const double w = std::max(0.0, std::min(lower, upper)) * norm;
+                weights[k] = (float) w;
+                if (w > 0.0) {
+                    first = std::min(first, k);
+                    last = k + 1;
+                }
+            }
+            if (first >= last) {
+                // a band narrower than a bin, with many mels on a short FFT
+                first = last = 0;
+            }
+            first = first / 4 * 4;
+            last = std::min((last + 3) / 4 * 4, N_BINS_PADDED);
+            filter_start[j] = first;
+            filter_size[j] = last - first;
+            filter_offset[j] = filter_weights.size();
+            for (int k = first; k < last; ++k) {
+                filter_weights.push_back(k < N_BINS ? weights[k] : 0.0f);
+            }
+        }
+    }
+
+    int mels() const {
+        return n_mel;
+    }
+
+    // Any thread. The log10 mel energies of the N_FFT samples at frame, before
+    // whisper's normalization, see mel_stream::build()
+    void compute(const float * frame, float * out) const {
+        float even[HALF + 1];
+        float odd[HALF + 1];
+        float power[N_BINS_PADDED];
+        even[0] = frame[0] * window[0];
+        odd[0] = 0.0f;
+        even[HALF] = frame[HALF] * window[HALF];
+        odd[HALF] = 0.0f;
+        for (int n = 1; n < HALF; ++n) {
+            const float a = frame[n] * window[n];
+            const float b = frame[N_FFT - n] * window[N_FFT - n];
+            even[n] = a + b;
+            odd[n] = a - b;
+        }
+        dft_power(even, odd, power);
+        for (int j = 0; j < n_mel; ++j) {
+            const float sum = filter_size[j] > 0 ?
+                dot_product(power + filter_start[j], filter_weights.data() + filter_offset[j], filter_size[j]) : 0.0f;
+            out[j] = log10f(std::max(sum, 1e-10f));
+        }
+    }
+};
+
+// The log mel spectrogram of a speech_stream's audio, computed as the samples
+// arrive so a decode step only pays for the audio which is new since the last
+// one, instead of whisper computing the whole window again, overlap included.
+//
+// Frames lie on a fixed grid, frame t is centered on sample t * HOP of the
+// stream, and are kept in a ring of raw log10 energies. The capture thread
+// computes a frame once all of its samples are in, the decoder puts a window's
+// spectrogram together from the ring. The window starts on the grid frame at or
+// before its first sample, so its timestamps count from there, see build().
+// Only the frames which reach past the end of the window, where whisper pads
+// with zeros, are computed at decode time, and the normalization, which depends
+// on the loudest frame of the window, is a cheap pass over the result.
+//
+// One thread pushes, one decoder at a time builds, like the audio ring. The
+// frame ring holds a few more frames than the audio ring holds samples, so the
+// frames of any window the decoder can peek aren't overwritten while it reads.
+class mel_stream {
+private:
+    static const int N_FFT = log_mel_frontend::N_FFT;
+    static const int HOP = log_mel_frontend::HOP;
+    static const int HALF = N_FFT / 2;
+
+    log_mel_frontend frontend;
+    size_t capacity_frames;
+    // capacity_frames frames of frontend.mels() energies each
+    std::vector<float> frames;
+    // set once the frontend and the ring are ready, the capture thread starts then
+    std::atomic<bool> active;
+    // frames [first_frame, n_frames) are in the ring
+    std::atomic<uint64_t> first_frame;
+    std::atomic<uint64_t> n_frames;
+
+    // capture thread only
+    float buffer[N_FFT];
+    int n_buffered = 0;
+    uint64_t n_pushed = 0;
+    uint64_t next_frame = 0;
+    // samples before the first frame's, pushed after the stream became active
+    uint64_t n_skip = 0;
+    bool started = false;
+
+    // decoder only, the raw frames of the window
+    std::vector<float> window_frames;
+    std::vector<float> scratch;
+    std::atomic<uint64_t> n_reused;
+    std::atomic<uint64_t> n_computed;
+
+    mel_stream(const mel_stream &) = delete;
+    mel_stream & operator=(const mel_stream &) = delete;
+
+public:
+    // capacity is the audio ring's, in samples
+    explicit mel_stream(const size_t capacity) :
+        capacity_frames(capacity / HOP + 4),
+        active(false),
+        first_frame(0),
+        n_frames(0),
+        n_reused(0),
+        n_computed(0) {
+    }
+
+    // Decoder side, once the model is known. The capture thread starts with the
+    // first whole frame after this.
+    void enable(const int n_mels) {
+        if (active.load()) {
+            return;
+        }
+        frontend.init(n_mels);
+        frames.assign(capacity_frames * n_mels, 0.0f);
+        scratch.resize(N_FFT);
+        active.store(true, std::memory_order_release);
+    }
+
+    bool is_enabled() const {
+        return active.load(std::memory_order_relaxed);
+    }
+
+    int mels() const {
+        return frontend.mels();
+    }
+
+    // Capture side, with exactly the samples the audio ring took
+    void push(const float * data, size_t length) {
+        if (!started) {
+            if (!active.load(std::memory_order_acquire)) {
+                n_pushed += length;
+                return;
+            }
+            // the first frame whose samples all arrive from now on
+            const uint64_t first = (n_pushed + HALF + HOP - 1) / HOP;
+            n_skip = first * HOP - HALF - n_pushed;
+            next_frame = first;
+            first_frame.store(first, std::memory_order_relaxed);
+            started = true;
+        }
+        n_pushed += length;
+        const int n_mel = frontend.mels();
+        while (length > 0) {
+            if (n_skip > 0) {
+                const size_t n = (size_t) std::min<uint64_t>(n_skip, length);
+                n_skip -= n;
+                data += n;
+                length -= n;
+                continue;
+            }
+            const size_t n = std::min(length, (size_t) (N_FFT - n_buffered));
+            memcpy(buffer + n_buffered, data, n * sizeof(float));
+            n_buffered += (int) n;
+            data += n;
+            length -= n;
+            if (n_buffered == N_FFT) {
+                frontend.compute(buffer, frames.data() + (size_t) (next_frame % capacity_frames) * n_mel);
+                n_frames.store(++next_frame, std::memory_order_release);
+                memmove(buffer, buffer + HOP, (N_FFT - HOP) * sizeof(float));
+                n_buffered = N_FFT - HOP;
+            }
+        }
+    }
+
+    // Decoder side. Puts together whisper's input for the n_samples samples at
+    // stream position window_start, as whisper_set_mel() takes it: mels() rows
+    // of *n_len frames, the audio followed by 30 s of silence, normalized the
+    // way whisper does. *n_len_org is the number of frames of audio, and
+    // *mel_start the stream position whisper's timestamps count from, up to a
+    // hop before window_start. Returns false if the ring doesn't have the start
+    // of the window, right after the model loaded, and the decoder should hand
+    // whisper the samples instead.
+    bool build(const float * samples, const uint64_t window_start, const size_t n_samples,
+               std::vector<float> & mel, int * n_len, int * n_len_org, uint64_t * mel_start) {
+        if (!active.load(std::memory_order_acquire) || n_samples == 0) {
+            return false;
+        }
+        const uint64_t t_begin = window_start / HOP;
+        const uint64_t produced = n_frames.load(std::memory_order_acquire);
+        const uint64_t first = first_frame.load(std::memory_order_relaxed);
+        if (produced == 0 || t_begin < first || t_begin >= produced || produced - t_begin > capacity_frames) {
+            return false;
+        }
+        const int n_mel = frontend.mels();
+        const uint64_t start = t_begin * HOP;
+        const uint64_t end = window_start + n_samples;
+        const int n_audio = (int) (end - start);
+        // as whisper_pcm_to_mel() counts them
+        *n_len_org = 1 + (n_audio + HALF - N_FFT) / HOP;
+        *n_len = (n_audio + WHISPER_CHUNK_SIZE * WHISPER_SAMPLE_RATE) / HOP;
+        *mel_start = start;
+
+        // the frames which overlap the audio, the rest are silence
+        const int n_real = std::min(*n_len, (int) ((end + HALF - start + HOP - 1) / HOP));
+        window_frames.resize((size_t) n_real * n_mel);
+        float max_value = log_mel_frontend::silence();
+        for (int i = 0; i < n_real; ++i) {
+            const uint64_t t = t_begin + i;
+            float *out = window_frames.data() + (size_t) i * n_mel;
+            if (t * HOP + HALF <= end && t < produced) {
+                memcpy(out, frames.data() + (size_t) (t % capacity_frames) * n_mel, n_mel * sizeof(float));
+                n_reused.fetch_add(1, std::memory_order_relaxed);
+            } else {
+                // whisper pads the end of the audio with zeros, and so does this
+                for (int n = 0; n < N_FFT; ++n) {
+                    const int64_t position = (int64_t) (t * HOP) - HALF + n;
+                    scratch[n] = position >= (int64_t) window_start && position < (int64_t) end ?
+                        samples[position - (int64_t) window_start] : 0.0f;
+                }
+                frontend.compute(scratch.data(), out);
+                n_computed.fetch_add(1, std::memory_order_relaxed);
+            }
+            for (int j = 0; j < n_mel; ++j) {
+                max_value = std::max(max_value, out[j]);
+            }
+        }
+
+        // whisper's normalization: at most 8 below the loudest, then scaled to about [-1, 1]
+        const float floor_value = max_value - 8.0f;
+        const float silent = (std::max(log_mel_frontend::silence(), floor_value) + 4.0f) / 4.0f;
+        mel.resize((size_t) n_mel * *n_len);
+        for (int j = 0; j < n_mel; ++j) {
+            float *row = mel.data() + (size_t) j * *n_len;
+            for (int i = 0; i < n_real; ++i) {
+                row[i] = (std::max(window_frames[(size_t) i * n_mel + j], floor_value) + 4.0f) / 4.0f;
+            }
+            std::fill(row + n_real, row + *n_len, silent);
+        }
+        return true;
+    }
+
+    // Frames build() took from the ring, and those it had to compute
+    uint64_t reused_frames() const {
+        return n_reused.load(std::memory_order_relaxed);
+    }
+
+    uint64_t computed_frames() const {
+        return n_computed.load(std::memory_order_relaxed);
+    }
+};
@@ -0,0 +1,333 @@
+#pragma once
+
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+#include <SDL3/SDL.h>
+#include "worker.h"
+
+// Pipeline metrics. Recording is lock-free so it's safe from the audio, decode
+// and render threads; the metrics themselves are registered once at startup.
+
+class metric_counter {
+private:
+    std::atomic<uint64_t> count;
+
+public:
+    metric_counter() : count(0) {}
+
+    void add(uint64_t n = 1) {
+        count.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    uint64_t value() const {
+        return count.load(std::memory_order_relaxed);
+    }
+};
+
+class metric_gauge {
+private:
+    std::atomic<double> current;
+
+public:
+    metric_gauge() : current(0.0) {}
+
+    void set(double value) {
+        current.store(value, std::memory_order_relaxed);
+    }
+
+    double value() const {
+        return current.load(std::memory_order_relaxed);
+    }
+};
+
+// Fixed bucket histogram, the buckets are upper bounds and there is an implicit +Inf bucket
+class metric_histogram {
+private:
+    std::vector<double> bounds;
+    std::unique_ptr<std::atomic<uint64_t>[]> counts;
+    std::atomic<uint64_t> total_count;
+    // sum in microunits, so it can be accumulated atomically
+    std::atomic<uint64_t> total_sum_micro;
+
+public:
+    explicit metric_histogram(const std::vector<double> & bounds) :
+        bounds(bounds),
+        counts(new std::atomic<uint64_t>[bounds.size() + 1]),
+        total_count(0),
+        total_sum_micro(0) {
+        for (size_t i = 0; i <= bounds.size(); ++i) {
+            counts[i].store(0);
+        }
+    }
+
+    // Exponential buckets: start, start * factor, ...
+    static std::vector<double> exponential_buckets(double start, double factor, int n) {
+        std::vector<double> result;
+        for (int i = 0; i < n; ++i) {
+            result.push_back(start);
+            start *= factor;
+        }
+        return result;
+    }
+
+    void observe(double value) {
+        size_t i = 0;
+        while (i < bounds.size() && value > bounds[i]) {
+            ++i;
+        }
+        counts[i].fetch_add(1, std::memory_order_relaxed);
+        total_count.fetch_add(1, std::memory_order_relaxed);
+        total_sum_micro.fetch_add((uint64_t) (value > 0.0 ? value * 1e6 : 0.0), std::memory_order_relaxed);
+    }
+
+    uint64_t count() const {
+        return total_count.load(std::memory_order_relaxed);
+    }
+
+    double sum() const {
+        return total_sum_micro.load(std::memory_order_relaxed) / 1e6;
+    }
+
+    const std::vector<double> & buckets() const {
+        return bounds;
+    }
+
+    uint64_t bucket_count(size_t i) const {
+        return counts[i].load(std::memory_order_relaxed);
+    }
+
+    // Estimates the q quantile by interpolating inside the bucket it falls in
+    double quantile(double q) const {
+        const uint64_t n = count();
+        if (n == 0) {
+            return 0.0;
+        }
+        const double rank = q * n;
+        uint64_t seen = 0;
+        for (size_t i = 0; i <= bounds.size(); ++i) {
+            const uint64_t in_bucket = bucket_count(i);
+            if (in_bucket > 0 && seen + in_bucket >= rank) {
+                if (i == bounds.size()) {
+                    return bounds.empty() ? 0.0 : bounds.back();
+                }
+                const double lower = i == 0 ? 0.0 : bounds[i - 1];
+                return lower + (bounds[i] - lower) * (rank - seen) / in_bucket;
+            }
+            seen += in_bucket;
+        }
+        return bounds.empty() ? 0.0 : bounds.back();
+    }
+};
+
+enum metric_type {
+    METRIC_COUNTER,
+    METRIC_GAUGE,
+    METRIC_HISTOGRAM,
+};
+
+class metrics_registry {
+public:
+    struct entry {
+        std::string name;
+        std::string help;
+        // Prometheus label pairs without braces, e.g. stream="mic"
+        std::string labels;
+        metric_type type;
+        std::unique_ptr<metric_counter> counter;
+        std::unique_ptr<metric_gauge> gauge;
+        std::unique_ptr<metric_histogram> histogram;
+    };
+
+private:
+    std::vector<std::unique_ptr<entry> > entries;
+
+    entry * add(const std::string & name, const std::string & help, const std::string & labels, metric_type type) {
+        entries.push_back(std::unique_ptr<entry>(new entry()));
+        entry *e = entries.back().get();
+        e->name = name;
+        e->help = help;
+        e->labels = labels;
+        e->type = type;
+        return e;
+    }
+
+    static std::string with_labels(const std::string & name, const std::string & labels, const std::string & extra = "") {
+        std::string all = labels;
+        if (!extra.empty()) {
+            all += (all.empty() ? "" : ",") + extra;
+        }
+        return all.empty() ? name : name + "{" + all + "}";
+    }
+
+    static std::string number(double value) {
+        char buffer[64];
+        snprintf(buffer, sizeof(buffer), "%.9g", value);
+        return buffer;
+    }
+
+public:
+    static std::string label(const std::string & key, const std::string & value) {
+        std::string escaped;
+        for (size_t i = 0; i < value.size(); ++i) {
+            if (value[i] == '\\' || value[i] == '"') {
+                escaped += '\\';
+                escaped += value[i];
+            } else if (value[i] == '\n') {
+                escaped += "\\n";
+            } else {
+                escaped += value[i];
+            }
+        }
+        return key + "=\"" + escaped + "\"";
+    }
+
+    // Registration isn't thread-safe, register everything before the threads start
+    metric_counter * counter(const std::string & name, const std::string & help, const std::string & labels = "") {
+        entry *e = add(name, help, labels, METRIC_COUNTER);
+        e->counter.reset(new metric_counter());
+        return e->counter.get();
+    }
+
+    metric_gauge * gauge(const std::string & name, const std::string & help, const std::string & labels = "") {
+        entry *e = add(name, help, labels, METRIC_GAUGE);
+        e->gauge.reset(new metric_gauge());
+        return e->gauge.get();
+    }
+
+    metric_histogram * histogram(const std::string & name, const std::string & help,
+                                 const std::vector<double> & buckets, const std::string & labels = "") {
+        entry *e = add(name, help, labels, METRIC_HISTOGRAM);
+        e->histogram.reset(new metric_histogram(buckets));
+        return e->histogram.get();
+    }
+
+    const std::vector<std::unique_ptr<entry> > & all() const {
+        return entries;
+    }
+
+    // Prometheus text exposition format
+    std::string to_prometheus() const {
+        std::string out;
+        std::vector<bool> written(entries.size(), false);
+        for (size_t i = 0; i < entries.size(); ++i) {
+            if (written[i]) {
+                continue;
+            }
+            const entry & first = *entries[i];
+            static const char *type_names[] = {"counter", "gauge", "histogram"};
+            out += "# HELP " + first.name + " " + first.help + "\n";
+            out += "# TYPE " + first.name + " " + type_names[first.type] + "\n";
+            // all series of a metric have to be grouped together
+            for (size_t j = i; j < entries.size(); ++j) {
+                const entry & e = *entries[j];
+                if (e.name != first.name) {
+                    continue;
+                }
+                written[j] = true;
+                switch (e.type) {
+                    case METRIC_COUNTER:
+                        out += with_labels(e.name, e.labels) + " " + std::to_string(e.counter->value()) + "\n";
+                        break;
+                    case METRIC_GAUGE:
+                        out += with_labels(e.name, e.labels) + " " + number(e.gauge->value()) + "\n";
+                        break;
+                    case METRIC_HISTOGRAM: {
+                        const metric_histogram & h = *e.histogram;
+                        uint64_t cumulative = 0;
+                        for (size_t b = 0; b < h.buckets().size(); ++b) {
+                            cumulative += h.bucket_count(b);
+                            out += with_labels(e.name + "_bucket", e.labels, "le=\"" + number(h.buckets()[b]) + "\"") +
+                                " " + std::to_string(cumulative) + "\n";
+                        }
+                        cumulative += h.bucket_count(h.buckets().size());
+                        out += with_labels(e.name + "_bucket", e.labels, "le=\"+Inf\"") + " " + std::to_string(cumulative) + "\n";
+                        out += with_labels(e.name + "_sum", e.labels) + " " + number(h.sum()) + "\n";
+                        out += with_labels(e.name + "_count", e.labels) + " " + std::to_string(cumulative) + "\n";
+                        break;
+                    }
+                }
+            }
+        }
+        return out;
+    }
+
+    // Writes through a temporary file and a rename, so the node exporter's
+    // textfile collector never sees a half written file
+    bool write_prometheus_file(const std::string & filename) const {
+        const std::string tmp = filename + ".tmp";
+        FILE *file = fopen(tmp.c_str(), "wb");
+        if (!file) {
+            return false;
+        }
+        const std::string text = to_prometheus();
+        const bool written = fwrite(text.data(), 1, text.size(), file) == text.size();
+        if (fclose(file) != 0 || !written) {
+            remove(tmp.c_str());
+            return false;
+        }
+#ifdef _WIN32
+        remove(filename.c_str());
+#endif
+        return rename(tmp.c_str(), filename.c_str()) == 0;
+    }
+};
+
+// Periodically writes a registry to a Prometheus text file. An SDL timer wakes a
+// worker, so the file is never written from the timer thread itself.
+class metrics_exporter {
+private:
+    const metrics_registry *registry = NULL;
+    std::string filename;
+    worker writer;
+    SDL_TimerID timer = 0;
+    bool failed = false;
+
+    static Uint32 SDLCALL on_timer(void *userdata, SDL_TimerID timer_id, Uint32 interval) {
+        ((metrics_exporter *) userdata)->writer.notify();
+        return interval;
+    }
+
+    void write() {
+        const bool written = registry->write_prometheus_file(filename);
+        // log once when it starts failing and once when it recovers, not every interval
+        if (written == failed) {
+            SDL_Log(written ? "Writing metrics to %s again" : "Couldn't write metrics to %s", filename.c_str());
+            failed = !written;
+        }
+    }
+
+public:
+    ~metrics_exporter() {
+        stop();
+    }
+
+    bool start(const metrics_registry *metrics, const std::string & path, Uint32 interval_ms) {
+        registry = metrics;
+        filename = path;
+        if (!writer.start("metrics_exporter", std::bind(&metrics_exporter::write, this), THREAD_ROLE_IO)) {
+            return false;
+        }
+        timer = SDL_AddTimer(interval_ms, on_timer, this);
+        if (!timer) {
+            SDL_Log("Couldn't create metrics timer: %s", SDL_GetError());
+            writer.stop();
+            return false;
+        }
+        SDL_Log("Writing metrics to %s every %u ms", filename.c_str(), interval_ms);
+        return true;
+    }
+
+    // Writes the final values once more, so the file doesn't go stale on a clean exit
+    void stop() {
+        if (!timer) {
+            return;
+        }
+        SDL_RemoveTimer(timer);
+        timer = 0;
+        writer.stop();
+        write();
+    }
+};
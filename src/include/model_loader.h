@@ -0,0 +1,203 @@
+#pragma once
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <SDL3/SDL.h>
+#include "whisper.h"
+#include "thread_topology.h"
+#include "wav_reader.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#endif
+
+enum model_load_mode {
+    // buffered reads, the kernel is told the file is read front to back
+    MODEL_LOAD_READ,
+    // the weights are copied out of a memory mapping, which shares the page cache
+    // with other processes using the same model
+    MODEL_LOAD_MMAP,
+};
+
+enum model_load_status {
+    MODEL_LOADING,
+    MODEL_READY,
+    MODEL_FAILED,
+};
+
+// Loads a whisper model on a background thread through a whisper_model_loader,
+// so the window, camera and audio can start while the weights are read and the
+// UI can show how far along the load is.
+class model_loader {
+public:
+    typedef std::function<void(whisper_context *)> ready_callback;
+
+private:
+    std::string filename;
+    whisper_context_params cparams;
+    model_load_mode mode;
+    ready_callback on_ready;
+
+    SDL_Thread *thread = NULL;
+    std::atomic<int> status;
+    std::atomic<uint64_t> bytes_read;
+    std::atomic<uint64_t> file_size;
+    std::atomic<bool> cancelled;
+    Uint64 load_ms = 0;
+
+    // the source, one of the two depending on the mode
+    FILE *file = NULL;
+    mapped_file mapping;
+    uint64_t position = 0;
+
+    model_loader(const model_loader &) = delete;
+    model_loader & operator=(const model_loader &) = delete;
+
+    static size_t read(void *ctx, void *output, size_t read_size) {
+        model_loader *self = (model_loader *) ctx;
+        size_t n = 0;
+        if (self->mode == MODEL_LOAD_MMAP) {
+            const uint64_t remaining = self->mapping.size() - self->position;
+            n = read_size < remaining ? read_size : (size_t) remaining;
+            memcpy(output, self->mapping.data() + self->position, n);
+            self->position += n;
+        } else {
+            n = fread(output, 1, read_size, self->file);
+        }
+        self->bytes_read.fetch_add(n, std::memory_order_relaxed);
+        return n;
+    }
+
+    // whisper checks for the end before every tensor, which is where a cancelled load stops
+    static bool eof(void *ctx) {
+        model_loader *self = (model_loader *) ctx;
+        if (self->cancelled.load()) {
+            return true;
+        }
+        if (self->mode == MODEL_LOAD_MMAP) {
+            return self->position >= self->mapping.size();
+        }
+        return feof(self->file) != 0;
+    }
+
+    static void close(void *ctx) {
+        model_loader *self = (model_loader *) ctx;
+        if (self->file) {
+            fclose(self->file);
+            self->file = NULL;
+        }
+        self->mapping.close();
+    }
+
+    bool open_source() {
+        if (mode == MODEL_LOAD_MMAP) {
+            if (!mapping.open(filename)) {
+                return false;
+            }
+            file_size.store(mapping.size());
+            position = 0;
+            return true;
+        }
+        file = fopen(filename.c_str(), "rb");
+        if (!file) {
+            return false;
+        }
+        // whisper reads the tensors in small pieces
+        setvbuf(file, NULL, _IOFBF, 1 << 20);
+        fseek(file, 0, SEEK_END);
+        file_size.store((uint64_t) ftell(file));
+        fseek(file, 0, SEEK_SET);
+#if !defined(_WIN32) && !defined(__APPLE__)
+        posix_fadvise(fileno(file), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+        return true;
+    }
+
+    static int SDLCALL run(void *ptr) {
+        model_loader *self = (model_loader *) ptr;
+        thread_role_scope scope(THREAD_ROLE_IO, "model_loader");
+        const Uint64 start = SDL_GetTicks();
+        if (!self->open_source()) {
+            SDL_Log("Couldn't open whisper model %s", self->filename.c_str());
+            self->status.store(MODEL_FAILED);
+            return 0;
+        }
+
+        whisper_model_loader loader;
+        loader.context = self;
+        loader.read = read;
+        loader.eof = eof;
+        loader.close = close;
+        // closes the source whether it succeeds or not
+        whisper_context *ctx = whisper_init_with_params_no_state(&loader, self->cparams);
+        self->load_ms = SDL_GetTicks() - start;
+        if (!ctx) {
+            SDL_Log(self->cancelled.load() ? "Loading %s was cancelled" : "Couldn't load whisper model %s", self->filename.c_str());
+            self->status.store(MODEL_FAILED);
+            return 0;
+        }
+        SDL_Log("Loaded %s in %llu ms (%.1f MB/s)", self->filename.c_str(), (unsigned long long) self->load_ms,
+                self->load_ms > 0 ? self->file_size.load() / 1e3 / self->load_ms : 0.0);
+        // streams and decoders are set up before anyone is told the model is ready
+        self->on_ready(ctx);
+        self->status.store(MODEL_READY);
+        return 0;
+    }
+
+public:
+    model_loader() : mode(MODEL_LOAD_READ), status(MODEL_LOADING), bytes_read(0), file_size(0), cancelled(false) {
+    }
+
+    ~model_loader() {
+        stop();
+    }
+
+    // on_ready runs on the loading thread and takes ownership of the context
+    bool start(const std::string & path, const whisper_context_params & params, model_load_mode load_mode, ready_callback callback) {
+        filename = path;
+        cparams = params;
+        mode = load_mode;
+        on_ready = callback;
+        status.store(MODEL_LOADING);
+        thread = SDL_CreateThread(run, "model_loader", this);
+        if (!thread) {
+            SDL_Log("Couldn't create model loader thread: %s", SDL_GetError());
+            status.store(MODEL_FAILED);
+            return false;
+        }
+        return true;
+    }
+
+    model_load_status get_status() const {
+        return (model_load_status) status.load();
+    }
+
+    // 0 to 1, by bytes read from the model file
+    float progress() const {
+        if (status.load() == MODEL_READY) {
+            return 1.0f;
+        }
+        return file_size.load() > 0 ? (float) bytes_read.load(std::memory_order_relaxed) / file_size.load() : 0.0f;
+    }
+
+    const std::string & path() const {
+        return filename;
+    }
+
+    // Only meaningful once the load finished
+    Uint64 elapsed_ms() const {
+        return load_ms;
+    }
+
+    // Stops a load in progress at the next tensor and joins the thread
+    void stop() {
+        cancelled.store(true);
+        if (thread) {
+            SDL_WaitThread(thread, NULL);
+            thread = NULL;
+        }
+    }
+};
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+// Bounded lock-free multi-producer single-consumer queue.
+//
+// Every cell carries a sequence number which tells producers and the consumer
+// whose turn it is (Dmitry Vyukov's bounded queue). Producers claim a position
+// with one compare-and-swap and never wait for each other or for the consumer:
+// if the queue is full, try_push() fails and the caller decides what to drop.
+template <typename T>
+class mpsc_queue {
+private:
+    struct cell {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    std::unique_ptr<cell[]> cells;
+    size_t mask;
+    // producers and the consumer on their own cache lines
+    alignas(64) std::atomic<size_t> enqueue_pos;
+    alignas(64) std::atomic<size_t> dequeue_pos;
+
+    mpsc_queue(const mpsc_queue &) = delete;
+    mpsc_queue & operator=(const mpsc_queue &) = delete;
+
+public:
+    // capacity is rounded up to a power of two
+    explicit mpsc_queue(size_t capacity) : enqueue_pos(0), dequeue_pos(0) {
+        size_t size = 2;
+        while (size < capacity) {
+            size *= 2;
+        }
+        cells.reset(new cell[size]);
+        mask = size - 1;
+        for (size_t i = 0; i < size; ++i) {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    // Any thread. Returns false without blocking if the queue is full
+    bool try_push(T && value) {
+        size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+        cell *c;
+        while (true) {
+            c = &cells[pos & mask];
+            const size_t sequence = c->sequence.load(std::memory_order_acquire);
+            const intptr_t diff = (intptr_t) sequence - (intptr_t) pos;
+            if (diff == 0) {
+                if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                // the consumer hasn't freed this cell yet
+                return false;
+            } else {
+                pos = enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+        c->value = std::move(value);
+        c->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer thread only. Returns false if there is nothing to take
+    bool try_pop(T & value) {
+        const size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+        cell *c = &cells[pos & mask];
+        const size_t sequence = c->sequence.load(std::memory_order_acquire);
+        if ((intptr_t) sequence - (intptr_t) (pos + 1) < 0) {
+            return false;
+        }
+        value = std::move(c->value);
+        dequeue_pos.store(pos + 1, std::memory_order_relaxed);
+        c->sequence.store(pos + mask + 1, std::memory_order_release);
+        return true;
+    }
+};
@@ -0,0 +1,338 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+#include <SDL3/SDL.h>
+#include "whisper.h"
+#include "audio_history.h"
+#include "mpsc_queue.h"
+#include "transcript_store.h"
+#include "worker.h"
+
+struct segment_refiner_params {
+    std::string model;
+    whisper_context_params cparams;
+    // decoding settings, the threads and callbacks are set by the refiner
+    whisper_full_params wparams;
+    int n_threads = 1;
+    // a stream's segments are refined together once they span this much audio,
+    // or once the stream has had no new segment for idle_ms
+    int window_ms = 20000;
+    int idle_ms = 2000;
+    // audio taken in on both sides, so words at the edges aren't cut
+    int margin_ms = 300;
+};
+
+// Transcribes the live captions again with a larger model and revises them in
+// the transcript store as the results come in.
+//
+// The decode slots hand over every final segment without blocking. The refiner
+// collects a stream's consecutive segments into a window and decodes the
+// window's audio, from a ring the capture thread fills with the audio the live
+// recognizer got, in one whisper_full on its own thread. The new segments are
+// given to the live ones they overlap most.
+//
+// The live path always comes first: the thread runs at low priority on its own
+// core budget, a window only starts while no live stream is behind, and a
+// decode is aborted as soon as one falls behind, to be retried later. Windows
+// whose audio was overwritten in the meantime are skipped.
+class segment_refiner {
+public:
+    typedef std::function<bool()> behind_callback;
+
+private:
+    struct request {
+        std::string stream;
+        const audio_history *audio = NULL;
+        uint32_t id = 0;
+        int64_t t0_ms = 0;
+        int64_t t1_ms = 0;
+    };
+
+    struct window {
+        const audio_history *audio = NULL;
+        std::vector<request> segments;
+        Uint64 last_ticks = 0;
+    };
+
+    static const size_t QUEUE_CAPACITY = 1024;
+
+    segment_refiner_params params;
+    transcript_store *store = NULL;
+    behind_callback live_is_behind;
+    mpsc_queue<request> queue;
+    std::atomic<bool> running;
+    worker refiner;
+    SDL_TimerID timer = 0;
+    whisper_context *ctx = NULL;
+    whisper_state *state = NULL;
+    bool load_failed = false;
+
+    // windows being collected, per stream
+    std::map<std::string, window> open_windows;
+    // closed windows in the order they closed, retried from the front
+    std::vector<window> ready;
+
+    std::atomic<uint64_t> n_refined;
+    std::atomic<uint64_t> n_windows;
+    std::atomic<uint64_t> n_aborted;
+    std::atomic<uint64_t> n_skipped;
+    std::atomic<uint64_t> n_dropped;
+
+    segment_refiner(const segment_refiner &) = delete;
+    segment_refiner & operator=(const segment_refiner &) = delete;
+
+    static Uint32 SDLCALL on_timer(void *userdata, SDL_TimerID timer_id, Uint32 interval) {
+        ((segment_refiner *) userdata)->refiner.notify();
+        return interval;
+    }
+
+    static bool should_abort(void *user_data) {
+        segment_refiner *self = (segment_refiner *) user_data;
+        return self->refiner.is_stopping() || self->live_is_behind();
+    }
+
+    bool load() {
+        if (ctx || load_failed) {
+            return ctx != NULL;
+        }
+        const Uint64 start = SDL_GetTicks();
+        ctx = whisper_init_from_file_with_params_no_state(params.model.c_str(), params.cparams);
+        state = ctx ? whisper_init_state(ctx) : NULL;
+        if (!state) {
+            SDL_Log("Couldn't load the refinement model %s, the live captions stay as they are", params.model.c_str());
+            load_failed = true;
+            return false;
+        }
+        SDL_Log("Loaded the refinement model %s in %llu ms", params.model.c_str(),
+                (unsigned long long) (SDL_GetTicks() - start));
+        return true;
+    }
+
+    void close_window(const std::string & stream) {
+        std::map<std::string, window>::iterator it = open_windows.find(stream);
+        if (it != open_windows.end()) {
+            ready.push_back(it->second);
+            open_windows.erase(it);
+        }
+    }
+
+    void collect() {
+        request r;
+        const Uint64 now = SDL_GetTicks();
+        while (queue.try_pop(r)) {
+            std::map<std::string, window>::iterator it = open_windows.find(r.stream);
+            if (it != open_windows.end() && r.t1_ms - it->second.segments.front().t0_ms > params.window_ms) {
+                close_window(r.stream);
+                it = open_windows.end();
+            }
+            if (it == open_windows.end()) {
+                it = open_windows.insert(std::make_pair(r.stream, window())).first;
+                it->second.audio = r.audio;
+            }
+            it->second.segments.push_back(r);
+            it->second.last_ticks = now;
+        }
+        std::vector<std::string> idle;
+        for (std::map<std::string, window>::iterator it = open_windows.begin(); it != open_windows.end(); ++it) {
+            if (now - it->second.last_ticks >= (Uint64) params.idle_ms) {
+                idle.push_back(it->first);
+            }
+        }
+        for (size_t i = 0; i < idle.size(); ++i) {
+            close_window(idle[i]);
+        }
+    }
+
+    enum result {
+        REFINED,
+        ABORTED,
+        SKIPPED,
+    };
+
+    result refine(const window & w) {
+        const audio_history &audio = *w.audio;
+        const int64_t t0_ms = std::max<int64_t>(w.segments.front().t0_ms - params.margin_ms, 0);
+        const int64_t t1_ms = w.segments.back().t1_ms + params.margin_ms;
+        const uint64_t first = std::max((uint64_t) t0_ms * audio.sample_rate() / 1000, audio.oldest());
+        const uint64_t last = std::min((uint64_t) t1_ms * audio.sample_rate() / 1000, audio.written());
+        if (last <= first) {
+            return SKIPPED;
+        }
+        std::vector<float> samples((size_t) (last - first));
+        if (!audio.read(first, samples.size(), samples.data())) {
+            return SKIPPED;
+        }
+        const int64_t start_ms = (int64_t) (first * 1000 / audio.sample_rate());
+
+        whisper_full_params wparams = params.wparams;
+        wparams.n_threads = params.n_threads;
+        wparams.abort_callback = should_abort;
+        wparams.abort_callback_user_data = this;
+        if (whisper_full_with_state(ctx, state, wparams, samples.data(), (int) samples.size()) != 0) {
+            return ABORTED;
+        }
+
+        // every new segment goes to the live segment it overlaps most, by its middle
+        std::vector<std::string> texts(w.segments.size());
+        const int n_segments = whisper_full_n_segments_from_state(state);
+        for (int i = 0; i < n_segments; ++i) {
+            // whisper timestamps are in units of 10 ms
+            const int64_t mid_ms = start_ms + (whisper_full_get_segment_t0_from_state(state, i) +
+                                               whisper_full_get_segment_t1_from_state(state, i)) * 5;
+            size_t best = 0;
+            int64_t best_distance = -1;
+            for (size_t j = 0; j < w.segments.size(); ++j) {
+                const request &s = w.segments[j];
+                const int64_t distance = mid_ms < s.t0_ms ? s.t0_ms - mid_ms : (mid_ms > s.t1_ms ? mid_ms - s.t1_ms : 0);
+                if (best_distance < 0 || distance < best_distance) {
+                    best = j;
+                    best_distance = distance;
+                }
+            }
+            texts[best] += whisper_full_get_segment_text_from_state(state, i);
+        }
+        size_t n_revised = 0;
+        for (size_t j = 0; j < w.segments.size(); ++j) {
+            // nothing of the new decode landed on it, the live text stays
+            if (texts[j].find_first_not_of(" \t\r\n") == std::string::npos) {
+                continue;
+            }
+            transcript_segment segment = store->segment(w.segments[j].id);
+            segment.text = texts[j];
+            store->revise(w.segments[j].id, segment);
+            n_revised++;
+        }
+        n_refined.fetch_add(n_revised, std::memory_order_relaxed);
+        return REFINED;
+    }
+
+    // Refiner thread, woken by new segments and the timer
+    void run() {
+        collect();
+        if (!load()) {
+            ready.clear();
+            return;
+        }
+        while (!ready.empty() && !refiner.is_stopping()) {
+            if (live_is_behind()) {
+                // the timer tries again
+                return;
+            }
+            result r = refine(ready.front());
+            if (r == ABORTED) {
+                if (refiner.is_stopping()) {
+                    return;
+                }
+                if (live_is_behind()) {
+                    n_aborted.fetch_add(1, std::memory_order_relaxed);
+                    return;
+                }
+                // it failed by itself, trying again won't help
+                SDL_Log("Failed to refine %zu segments", ready.front().segments.size());
+                r = SKIPPED;
+            }
+            (r == REFINED ? n_windows : n_skipped).fetch_add(1, std::memory_order_relaxed);
+            ready.erase(ready.begin());
+            // segments which came in meanwhile
+            collect();
+        }
+    }
+
+public:
+    segment_refiner() : queue(QUEUE_CAPACITY), running(false), n_refined(0), n_windows(0), n_aborted(0), n_skipped(0), n_dropped(0) {
+    }
+
+    ~segment_refiner() {
+        stop();
+    }
+
+    // The model is loaded on the refiner's thread, behind_callback is called from
+    // it to ask whether any live stream is behind
+    bool start(const segment_refiner_params & refiner_params, transcript_store *transcript, behind_callback behind) {
+        params = refiner_params;
+        store = transcript;
+        live_is_behind = behind;
+        if (!refiner.start("segment_refiner", std::bind(&segment_refiner::run, this), THREAD_ROLE_BACKGROUND)) {
+            return false;
+        }
+        timer = SDL_AddTimer((Uint32) std::min(params.idle_ms, 500), on_timer, this);
+        if (!timer) {
+            SDL_Log("Couldn't create segment refiner timer: %s", SDL_GetError());
+            stop();
+            return false;
+        }
+        running.store(true);
+        SDL_Log("Refining the live captions with %s, %d threads", params.model.c_str(), params.n_threads);
+        // loads the model now instead of with the first window
+        refiner.notify();
+        return true;
+    }
+
+    bool is_running() const {
+        return running.load();
+    }
+
+    // Any thread, never blocks. The entry's segment times are the stream's, the
+    // audio the live recognizer got, by the same positions
+    void add(const std::string & stream, const audio_history *audio, const size_t id, const transcript_segment & segment) {
+        if (!running.load(std::memory_order_relaxed) || !audio) {
+            return;
+        }
+        request r;
+        r.stream = stream;
+        r.audio = audio;
+        r.id = (uint32_t) id;
+        r.t0_ms = segment.t0_ms;
+        r.t1_ms = segment.t1_ms;
+        if (!queue.try_push(std::move(r))) {
+            n_dropped.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    // Live segments revised so far
+    uint64_t refined() const {
+        return n_refined.load(std::memory_order_relaxed);
+    }
+
+    uint64_t windows() const {
+        return n_windows.load(std::memory_order_relaxed);
+    }
+
+    // Decodes given up because a live stream fell behind, their windows are retried
+    uint64_t aborted() const {
+        return n_aborted.load(std::memory_order_relaxed);
+    }
+
+    // Windows whose audio was gone by the time the refiner got to them, or which failed
+    uint64_t skipped() const {
+        return n_skipped.load(std::memory_order_relaxed);
+    }
+
+    // Segments which didn't fit in the queue and stay as they are
+    uint64_t dropped() const {
+        return n_dropped.load(std::memory_order_relaxed);
+    }
+
+    // Before the transcript store and the audio rings go
+    void stop() {
+        running.store(false);
+        if (timer) {
+            SDL_RemoveTimer(timer);
+            timer = 0;
+        }
+        refiner.stop();
+        if (state) {
+            whisper_free_state(state);
+            state = NULL;
+        }
+        if (ctx) {
+            whisper_free(ctx);
+            ctx = NULL;
+        }
+    }
+};
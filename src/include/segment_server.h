@@ -0,0 +1,418 @@
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+#include <SDL3/SDL.h>
+#include "mpsc_queue.h"
+#include "thread_topology.h"
+#include "transcript_format.h"
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+struct segment_server_params {
+    // path of the Unix domain socket, replaced if a stale one is left over
+    std::string socket_path;
+    // output a client may have waiting before it's disconnected as too slow
+    size_t max_client_buffer = 1 << 20;
+    int max_clients = 256;
+};
+
+// Streams the recognized segments to local clients as newline-delimited JSON,
+// e.g. `socat - UNIX-CONNECT:afsha.sock`, one object per line:
+//
+//   {"type":"final","source":"mic","start":1.200,"end":3.400,"time":1700000000.123,"text":" Hello"}
+//
+// "interim" lines carry a stream's text so far, each replacing the one before,
+// until the "final" one. Clients only read, anything they send is discarded.
+//
+// The decode slots only move a segment into a lock-free queue and, once until
+// the server has caught up, write an eventfd. The server's thread formats every
+// segment once and appends it to each client's buffer, then writes with
+// non-blocking sends and epoll tells it when a full socket has room again. A
+// client whose buffer grows past max_client_buffer is disconnected, so a slow
+// client costs memory up to that bound and never makes the recognizer wait. If
+// the queue itself fills up, segments are dropped and counted.
+//
+// Linux only, elsewhere start() fails.
+class segment_server {
+private:
+    struct message {
+        transcript_segment segment;
+        std::string stream;
+        int64_t wall_ms = 0;
+    };
+
+    struct client {
+        std::string pending;
+        // bytes of pending already sent
+        size_t sent = 0;
+        bool waiting_for_room = false;
+        // until the client shuts down its side, which only ends the reading
+        bool reading = true;
+    };
+
+    static const size_t QUEUE_CAPACITY = 4096;
+
+    segment_server_params params;
+    mpsc_queue<message> queue;
+    std::atomic<bool> wake_pending;
+    std::atomic<bool> running;
+    std::atomic<bool> stopping;
+    SDL_Thread *thread = NULL;
+    int listen_fd = -1;
+    bool bound = false;
+    int epoll_fd = -1;
+    int wake_fd = -1;
+    // by socket, only touched by the server's thread
+    std::map<int, client> clients;
+
+    std::atomic<uint64_t> n_published;
+    std::atomic<uint64_t> n_dropped;
+    std::atomic<uint64_t> n_slow_clients;
+    std::atomic<uint64_t> n_bytes_sent;
+    std::atomic<int> n_clients;
+
+    segment_server(const segment_server &) = delete;
+    segment_server & operator=(const segment_server &) = delete;
+
+#if defined(__linux__)
+    void close_client(const int fd) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+        ::close(fd);
+        clients.erase(fd);
+        n_clients.store((int) clients.size());
+    }
+
+    void watch(const int fd, const client & c) {
+        struct epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = (c.reading ? (uint32_t) EPOLLIN : 0u) | (c.waiting_for_room ? (uint32_t) EPOLLOUT : 0u);
+        event.data.fd = fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &event);
+    }
+
+    // Sends what the socket takes, false if the client is gone
+    bool flush(const int fd, client & c) {
+        while (c.sent < c.pending.size()) {
+            const ssize_t n = send(fd, c.pending.data() + c.sent, c.pending.size() - c.sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+            if (n > 0) {
+                c.sent += (size_t) n;
+                n_bytes_sent.fetch_add((uint64_t) n, std::memory_order_relaxed);
+            } else if (n < 0 && errno == EINTR) {
+                continue;
+            } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                break;
+            } else {
+                return false;
+            }
+        }
+        if (c.sent == c.pending.size()) {
+            c.pending.clear();
+            c.sent = 0;
+        } else if (c.sent > c.pending.size() / 2) {
+            c.pending.erase(0, c.sent);
+            c.sent = 0;
+        }
+        // epoll only reports room while something is waiting for it
+        const bool waiting = !c.pending.empty();
+        if (waiting != c.waiting_for_room) {
+            c.waiting_for_room = waiting;
+            watch(fd, c);
+        }
+        return true;
+    }
+
+    void accept_clients() {
+        while (true) {
+            const int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return;
+            }
+            if ((int) clients.size() >= params.max_clients) {
+                ::close(fd);
+                continue;
+            }
+            struct epoll_event event;
+            memset(&event, 0, sizeof(event));
+            event.events = EPOLLIN;
+            event.data.fd = fd;
+            if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+                ::close(fd);
+                continue;
+            }
+            clients[fd] = client();
+            n_clients.store((int) clients.size());
+        }
+    }
+
+    // Whatever the client sends is read and thrown away, false if the connection broke
+    bool discard_input(const int fd, client & c) {
+        char buffer[1024];
+        while (true) {
+            const ssize_t n = recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+            if (n > 0 || (n < 0 && errno == EINTR)) {
+                continue;
+            }
+            if (n == 0) {
+                // e.g. `nc -U` with its input at EOF, it still reads
+                c.reading = false;
+                watch(fd, c);
+                return true;
+            }
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+    }
+
+    void broadcast() {
+        message m;
+        std::string lines;
+        while (queue.try_pop(m)) {
+            const std::string json = format_transcript_segment(m.segment, TRANSCRIPT_FORMAT_JSONL, 0, m.stream, m.wall_ms);
+            lines += m.segment.final ? "{\"type\":\"final\"," : "{\"type\":\"interim\",";
+            lines.append(json, 1, std::string::npos);
+        }
+        if (lines.empty()) {
+            return;
+        }
+        std::vector<int> gone;
+        for (std::map<int, client>::iterator it = clients.begin(); it != clients.end(); ++it) {
+            client &c = it->second;
+            if (c.pending.size() - c.sent + lines.size() > params.max_client_buffer) {
+                n_slow_clients.fetch_add(1, std::memory_order_relaxed);
+                gone.push_back(it->first);
+                continue;
+            }
+            c.pending += lines;
+            // a client already waiting for room gets it written when epoll says so
+            if (!c.waiting_for_room && !flush(it->first, c)) {
+                gone.push_back(it->first);
+            }
+        }
+        for (size_t i = 0; i < gone.size(); ++i) {
+            close_client(gone[i]);
+        }
+    }
+
+    static int SDLCALL run(void *ptr) {
+        segment_server *self = (segment_server *) ptr;
+        thread_role_scope scope(THREAD_ROLE_IO, "segment_server");
+        struct epoll_event events[64];
+        while (!self->stopping.load()) {
+            const int n = epoll_wait(self->epoll_fd, events, 64, -1);
+            if (n < 0 && errno != EINTR) {
+                SDL_Log("Segment server: epoll_wait failed: %s", strerror(errno));
+                break;
+            }
+            for (int i = 0; i < n; ++i) {
+                const int fd = events[i].data.fd;
+                if (fd == self->wake_fd) {
+                    uint64_t count;
+                    ssize_t ignored = read(self->wake_fd, &count, sizeof(count));
+                    (void) ignored;
+                    // before draining, so a segment queued meanwhile writes it again
+                    self->wake_pending.store(false);
+                    self->broadcast();
+                } else if (fd == self->listen_fd) {
+                    self->accept_clients();
+                } else {
+                    std::map<int, client>::iterator it = self->clients.find(fd);
+                    if (it == self->clients.end()) {
+                        continue;
+                    }
+                    // both directions closed, or broken
+                    bool alive = !(events[i].events & (EPOLLERR | EPOLLHUP));
+                    if (alive && (events[i].events & EPOLLIN)) {
+                        alive = self->discard_input(fd, it->second);
+                    }
+                    if (alive && (events[i].events & EPOLLOUT)) {
+                        alive = self->flush(fd, it->second);
+                    }
+                    if (!alive) {
+                        self->close_client(fd);
+                    }
+                }
+            }
+        }
+        return 0;
+    }
+
+    bool listen_on(const std::string & path) {
+        struct sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if (path.empty() || path.size() >= sizeof(address.sun_path)) {
+            SDL_Log("Bad socket path: %s", path.c_str());
+            return false;
+        }
+        memcpy(address.sun_path, path.c_str(), path.size());
+        // a socket left over from a previous run is replaced, one somebody still
+        // listens on, or any other file, stays
+        struct stat st;
+        if (lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+            const int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            const bool live = probe >= 0 && connect(probe, (struct sockaddr *) &address, sizeof(address)) == 0;
+            if (probe >= 0) {
+                ::close(probe);
+            }
+            if (live) {
+                SDL_Log("Another server is listening on %s", path.c_str());
+                return false;
+            }
+            unlink(path.c_str());
+        }
+        listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        bound = listen_fd >= 0 && bind(listen_fd, (struct sockaddr *) &address, sizeof(address)) == 0;
+        if (!bound || listen(listen_fd, 64) != 0) {
+            SDL_Log("Couldn't listen on %s: %s", path.c_str(), strerror(errno));
+            return false;
+        }
+        return true;
+    }
+#endif
+
+public:
+    segment_server() : queue(QUEUE_CAPACITY), wake_pending(false), running(false), stopping(false), n_published(0), n_dropped(0),
+                       n_slow_clients(0), n_bytes_sent(0), n_clients(0) {
+    }
+
+    ~segment_server() {
+        stop();
+    }
+
+    bool start(const segment_server_params & server_params) {
+        params = server_params;
+#if defined(__linux__)
+        if (!listen_on(params.socket_path)) {
+            stop();
+            return false;
+        }
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        struct epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.fd = listen_fd;
+        bool ok = epoll_fd >= 0 && wake_fd >= 0 && epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &event) == 0;
+        event.data.fd = wake_fd;
+        ok = ok && epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &event) == 0;
+        if (!ok) {
+            SDL_Log("Couldn't set up the segment server: %s", strerror(errno));
+            stop();
+            return false;
+        }
+        stopping.store(false);
+        thread = SDL_CreateThread(run, "segment_server", this);
+        if (!thread) {
+            SDL_Log("Couldn't create segment server thread: %s", SDL_GetError());
+            stop();
+            return false;
+        }
+        running.store(true);
+        SDL_Log("Streaming segments to clients of %s", params.socket_path.c_str());
+        return true;
+#else
+        SDL_Log("The segment server needs Linux");
+        return false;
+#endif
+    }
+
+    bool is_running() const {
+        return running.load();
+    }
+
+    // Any thread, never blocks
+    void publish(const transcript_segment & segment, const std::string & stream) {
+        if (!running.load(std::memory_order_relaxed)) {
+            return;
+        }
+        message m;
+        m.segment = segment;
+        m.stream = stream;
+        SDL_Time now;
+        m.wall_ms = SDL_GetCurrentTime(&now) ? now / 1000000 : -1;
+        if (!queue.try_push(std::move(m))) {
+            n_dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        n_published.fetch_add(1, std::memory_order_relaxed);
+#if defined(__linux__)
+        if (!wake_pending.exchange(true)) {
+            const uint64_t one = 1;
+            ssize_t ignored = write(wake_fd, &one, sizeof(one));
+            (void) ignored;
+        }
+#endif
+    }
+
+    uint64_t published() const {
+        return n_published.load(std::memory_order_relaxed);
+    }
+
+    // Segments which didn't fit in the queue
+    uint64_t dropped() const {
+        return n_dropped.load(std::memory_order_relaxed);
+    }
+
+    // Clients disconnected because they didn't keep up
+    uint64_t slow_clients() const {
+        return n_slow_clients.load(std::memory_order_relaxed);
+    }
+
+    uint64_t bytes_sent() const {
+        return n_bytes_sent.load(std::memory_order_relaxed);
+    }
+
+    int client_count() const {
+        return n_clients.load();
+    }
+
+    void stop() {
+        running.store(false);
+#if defined(__linux__)
+        if (thread) {
+            stopping.store(true);
+            const uint64_t one = 1;
+            ssize_t ignored = write(wake_fd, &one, sizeof(one));
+            (void) ignored;
+            SDL_WaitThread(thread, NULL);
+            thread = NULL;
+        }
+        for (std::map<int, client>::iterator it = clients.begin(); it != clients.end(); ++it) {
+            ::close(it->first);
+        }
+        clients.clear();
+        n_clients.store(0);
+        if (listen_fd >= 0) {
+            ::close(listen_fd);
+            listen_fd = -1;
+        }
+        if (bound) {
+            unlink(params.socket_path.c_str());
+            bound = false;
+        }
+        if (epoll_fd >= 0) {
+            ::close(epoll_fd);
+            epoll_fd = -1;
+        }
+        if (wake_fd >= 0) {
+            ::close(wake_fd);
+            wake_fd = -1;
+        }
+#endif
+    }
+};
@@ -0,0 +1,597 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <SDL3/SDL.h>
+#include "whisper.h"
+#include "audio_ring_buffer.h"
+#include "mel_spectrogram.h"
+#include "vad.h"
+#include "transcript_format.h"
+
+// What a stream does once the recognizer can't keep up with its input
+enum overload_policy {
+    // skip the oldest audio, the transcript gets a gap but stays close to real time
+    OVERLOAD_DROP_OLDEST,
+    // decode the whole backlog as one window, up to the model's 30 s, and commit it in one pass
+    OVERLOAD_COALESCE,
+    // keep decoding the backlog but with cheaper settings until the stream has caught up
+    OVERLOAD_DEGRADE,
+};
+
+struct speech_stream_params {
+    int sample_rate = WHISPER_SAMPLE_RATE;
+    // run whisper once this many new samples are buffered
+    int n_samples_step = 3 * WHISPER_SAMPLE_RATE;
+    // samples of the previous step which are decoded again as overlap
+    int n_samples_keep = WHISPER_SAMPLE_RATE / 10;
+    // whisper can't look at more than 30 s at once
+    int n_samples_max = 30 * WHISPER_SAMPLE_RATE;
+    // an utterance has ended when the last n_samples_vad_last samples are quiet
+    int n_samples_vad_last = WHISPER_SAMPLE_RATE;
+    float vad_thold = 0.6f;
+    float freq_thold = 100.0f;
+    // commit text only once two consecutive decodes agree on it, see recognize_agreement()
+    bool local_agreement = false;
+    // Inputs which can't wait for the recognizer, like capture devices, get an upper
+    // bound on their latency. Others, like file replays, decode everything.
+    bool bounded_latency = false;
+    overload_policy overload = OVERLOAD_DROP_OLDEST;
+    // whatever the policy, audio waiting for recognition plus the expected decode
+    // time never goes over this; older audio is dropped
+    int n_samples_max_latency = 10 * WHISPER_SAMPLE_RATE;
+    // compute the log mel spectrogram as the audio arrives and hand whisper that,
+    // instead of whisper computing it for the whole window every step. Only
+    // without local agreement, whose token timestamps need the samples.
+    bool incremental_mel = true;
+};
+
+// Everything one live audio input needs for speech recognition: its audio ring,
+// its VAD gate, the prompt tokens carried from step to step and its own
+// whisper_state. The model weights in the whisper_context are shared by all streams.
+//
+// One thread pushes samples, and one decoder at a time calls recognize(); the
+// decode_scheduler makes sure of the latter.
+class speech_stream {
+private:
+    std::string stream_name;
+    speech_stream_params params;
+
+    audio_ring_buffer audio;
+    mel_stream mel;
+    // whisper's input for the step, see run_whisper()
+    std::vector<float> mel_data;
+    // stream position the timestamps of the last decode count from
+    uint64_t timestamp_start = 0;
+    energy_vad detector;
+    vad_gate gate;
+
+    // They are used to store the tokens from the last full length segment as the prompt
+    std::vector<whisper_token> prompt_tokens;
+    whisper_state *state = NULL;
+
+    uint64_t dropped_reported = 0;
+    // write position at which the VAD gate last asked for more audio
+    uint64_t waiting_at = UINT64_MAX;
+    // the input has ended, the rest of the audio is flushed regardless of the step size
+    std::atomic<bool> ended;
+    // size the encoder context to the window instead of the model's full 30 s
+    bool fit_audio_ctx = false;
+    // new samples the last step went through
+    size_t n_step_samples = 0;
+
+    // Local agreement state. A token of a decode, timestamps in ms from the stream start
+    struct hypothesis_token {
+        whisper_token id;
+        std::string text;
+        int64_t t0_ms;
+        int64_t t1_ms;
+    };
+    // tokens of the last decode which aren't committed yet
+    std::vector<hypothesis_token> pending;
+    // samples after the overlap which the last decode already went through
+    size_t n_samples_decoded = 0;
+    // the prompt never holds more than this many committed tokens
+    static const size_t MAX_PROMPT_TOKENS = 128;
+
+    // Overload handling, see bound_latency(). Wall time of the last whisper_full
+    double decode_seconds = 0.0;
+    // more than a step of unseen audio was waiting when this step started
+    bool overloaded = false;
+    // the latency ceiling was reached, local agreement commits everything this step
+    bool force_commit = false;
+    uint64_t n_shed_samples = 0;
+    uint64_t n_coalesced_samples = 0;
+    uint64_t n_degraded_samples = 0;
+
+    speech_stream(const speech_stream &) = delete;
+    speech_stream & operator=(const speech_stream &) = delete;
+
+    // Results are read from our own state, or from the context's default state
+    int n_segments(whisper_context *ctx) const {
+        return state ? whisper_full_n_segments_from_state(state) : whisper_full_n_segments(ctx);
+    }
+
+    int64_t segment_t0(whisper_context *ctx, int i) const {
+        return state ? whisper_full_get_segment_t0_from_state(state, i) : whisper_full_get_segment_t0(ctx, i);
+    }
+
+    int64_t segment_t1(whisper_context *ctx, int i) const {
+        return state ? whisper_full_get_segment_t1_from_state(state, i) : whisper_full_get_segment_t1(ctx, i);
+    }
+
+    const char * segment_text(whisper_context *ctx, int i) const {
+        return state ? whisper_full_get_segment_text_from_state(state, i) : whisper_full_get_segment_text(ctx, i);
+    }
+
+    int n_tokens(whisper_context *ctx, int i) const {
+        return state ? whisper_full_n_tokens_from_state(state, i) : whisper_full_n_tokens(ctx, i);
+    }
+
+    whisper_token token_id(whisper_context *ctx, int i, int j) const {
+        return state ? whisper_full_get_token_id_from_state(state, i, j) : whisper_full_get_token_id(ctx, i, j);
+    }
+
+    const char * token_text(whisper_context *ctx, int i, int j) const {
+        return state ? whisper_full_get_token_text_from_state(ctx, state, i, j) : whisper_full_get_token_text(ctx, i, j);
+    }
+
+    whisper_token_data token_data(whisper_context *ctx, int i, int j) const {
+        return state ? whisper_full_get_token_data_from_state(state, i, j) : whisper_full_get_token_data(ctx, i, j);
+    }
+
+    void log_skipped() const {
+        if (gate.skipped_windows() % 20 == 0) {
+            SDL_Log("%s: VAD skipped %llu of %llu windows, %.1f%% of the audio",
+                    stream_name.c_str(),
+                    (unsigned long long) gate.skipped_windows(),
+                    (unsigned long long) (gate.skipped_windows() + gate.decoded_windows()),
+                    gate.skipped_ratio() * 100.0f);
+        }
+    }
+
+    // Counts the step against the overload policy, n_step_samples must be set.
+    // The samples are at stream position window_start.
+    int run_whisper(whisper_context *ctx, whisper_full_params wparams, const float * samples, int n_samples,
+                    const uint64_t window_start) {
+        if (fit_audio_ctx || (overloaded && params.overload == OVERLOAD_DEGRADE)) {
+            // the encoder sees 1500 frames for 30 s, one every 20 ms, plus some headroom
+            const int audio_ctx = n_samples * 50 / params.sample_rate + 32;
+            wparams.audio_ctx = audio_ctx < 1500 ? audio_ctx : 1500;
+        }
+        if (overloaded && params.overload == OVERLOAD_DEGRADE) {
+            // one greedy pass, no retries at higher temperatures
+            wparams.strategy = WHISPER_SAMPLING_GREEDY;
+            wparams.greedy.best_of = 1;
+            wparams.temperature_inc = 0.0f;
+        }
+        if (overloaded && params.overload == OVERLOAD_COALESCE) {
+            n_coalesced_samples += n_step_samples > (size_t) params.n_samples_step ? n_step_samples - params.n_samples_step : 0;
+        } else if (overloaded && params.overload == OVERLOAD_DEGRADE) {
+            n_degraded_samples += n_step_samples;
+        }
+        const Uint64 start = SDL_GetPerformanceCounter();
+        timestamp_start = window_start;
+        int n_len = 0;
+        int n_len_org = 0;
+        uint64_t mel_start = 0;
+        int result;
+        // whisper only measures the signal energy token timestamps are placed with
+        // from samples, those decodes get the samples
+        if (!wparams.token_timestamps && mel.build(samples, window_start, n_samples, mel_data, &n_len, &n_len_org, &mel_start)) {
+            // whisper takes every frame it is handed for audio, the 30 s of padding included
+            wparams.offset_ms = 0;
+            wparams.duration_ms = n_len_org * 10;
+            result = state ?
+                whisper_set_mel_with_state(ctx, state, mel_data.data(), n_len, mel.mels()) :
+                whisper_set_mel(ctx, mel_data.data(), n_len, mel.mels());
+            if (result == 0) {
+                result = state ?
+                    whisper_full_with_state(ctx, state, wparams, NULL, 0) :
+                    whisper_full(ctx, wparams, NULL, 0);
+            }
+            timestamp_start = mel_start;
+        } else {
+            result = state ?
+                whisper_full_with_state(ctx, state, wparams, samples, n_samples) :
+                whisper_full(ctx, wparams, samples, n_samples);
+        }
+        decode_seconds = (double) (SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+        return result;
+    }
+
+    // Applies the overload policy before a step. A step is overloaded when two
+    // steps or more of audio the recognizer hasn't seen yet are waiting: drop
+    // oldest skips straight to the newest step, coalesce and degrade decode it
+    // all at once. On top of that the latency ceiling holds for every policy,
+    // counting the audio not committed yet and the time the next decode is
+    // expected to take. Audio is only ever released from the front of the ring,
+    // so pending text in front of dropped audio is committed first.
+    // Returns true if audio was dropped.
+    bool bound_latency(size_t n_samples_new, std::vector<transcript_segment> & segments) {
+        const size_t n_step = params.n_samples_step;
+        const size_t n_unseen = n_samples_new > n_samples_decoded ? n_samples_new - n_samples_decoded : 0;
+        overloaded = n_unseen >= 2 * n_step;
+
+        const size_t n_decode = (size_t) (decode_seconds * params.sample_rate);
+        const size_t n_max_latency = params.n_samples_max_latency;
+        const size_t n_max_new = n_max_latency > n_decode + n_step ? n_max_latency - n_decode : n_step;
+        size_t n_drop = 0;
+        if (n_unseen > n_max_new) {
+            n_drop = n_samples_new - n_max_new;
+        } else if (n_samples_new > n_max_new) {
+            // only the text which isn't confirmed yet is that old, commit it instead
+            force_commit = true;
+        }
+        if (overloaded && params.overload == OVERLOAD_DROP_OLDEST) {
+            n_drop = n_samples_new - n_step;
+        }
+        if (overloaded && params.overload == OVERLOAD_COALESCE) {
+            force_commit = true;
+        }
+        if (n_drop == 0) {
+            return false;
+        }
+
+        if (!pending.empty()) {
+            emit(pending, 0, pending.size(), true, segments);
+            emit(pending, 0, 0, false, segments);
+            pending.clear();
+        }
+        audio.consume(n_drop);
+        n_samples_decoded = 0;
+        n_shed_samples += n_drop;
+        SDL_Log("%s: speech recognition is %.1f s behind, skipped the oldest %.1f s (%.1f s total)",
+                stream_name.c_str(), (float) n_samples_new / params.sample_rate, (float) n_drop / params.sample_rate,
+                (float) n_shed_samples / params.sample_rate);
+        return true;
+    }
+
+    // Appends tokens[first, last) as one segment, committed tokens also become the prompt
+    void emit(const std::vector<hypothesis_token> & tokens, size_t first, size_t last, bool final,
+              std::vector<transcript_segment> & segments) {
+        transcript_segment segment;
+        segment.final = final;
+        if (first < last) {
+            segment.t0_ms = tokens[first].t0_ms;
+            segment.t1_ms = tokens[last - 1].t1_ms;
+        }
+        for (size_t i = first; i < last; ++i) {
+            segment.text += tokens[i].text;
+            if (final) {
+                prompt_tokens.push_back(tokens[i].id);
+            }
+        }
+        if (prompt_tokens.size() > MAX_PROMPT_TOKENS) {
+            prompt_tokens.erase(prompt_tokens.begin(), prompt_tokens.end() - MAX_PROMPT_TOKENS);
+        }
+        // interim segments are emitted even when empty, to clear the previous interim text
+        if (final && segment.text.empty()) {
+            return;
+        }
+        segments.push_back(segment);
+    }
+
+    // Everything pending becomes final and the audio behind it is released
+    void commit_pending(size_t n_samples_new, std::vector<transcript_segment> & segments) {
+        emit(pending, 0, pending.size(), true, segments);
+        emit(pending, 0, 0, false, segments);
+        pending.clear();
+        audio.consume(n_samples_new);
+        n_samples_decoded = 0;
+    }
+
+    // LocalAgreement-2: the window starts where the committed text ends and grows
+    // with every step, and a token is committed once two consecutive decodes of
+    // the growing window agree on it. Only the committed tokens are final and go
+    // into the prompt, the rest is reported as interim text. The audio behind the
+    // committed tokens is released, so the next decode only covers the tail which
+    // isn't confirmed yet. An utterance end, the end of the input or a window
+    // which can't grow any more commits everything.
+    bool recognize_agreement(whisper_context *ctx, whisper_full_params wparams, std::vector<transcript_segment> & segments,
+                             const float * samples, size_t n_samples_to_keep, size_t n_samples_new,
+                             uint64_t window_start, bool flush) {
+        const size_t n_unseen = n_samples_new > n_samples_decoded ? n_samples_new - n_samples_decoded : 0;
+        if (flush && n_unseen == 0) {
+            n_step_samples = 0;
+            commit_pending(n_samples_new, segments);
+            return false;
+        }
+
+        // the gate only looks at the audio which arrived since the last decode
+        switch (gate.decide(samples + n_samples_to_keep + n_samples_decoded, n_unseen, flush)) {
+            case VAD_WAIT:
+                waiting_at = audio.total_written();
+                return false;
+            case VAD_SKIP:
+                // silence since the last decode, the utterance is over
+                n_step_samples = n_unseen;
+                commit_pending(n_samples_new, segments);
+                log_skipped();
+                return false;
+            case VAD_DECODE:
+                break;
+        }
+        n_step_samples = n_unseen;
+
+        const int n_samples = n_samples_to_keep + n_samples_new;
+        const bool window_full = n_samples + params.n_samples_step > params.n_samples_max;
+        const bool commit_all = flush || !gate.in_speech() || window_full || force_commit;
+
+        wparams.token_timestamps = true;
+        // whisper takes an explicit prompt even with no_context, which is only
+        // about its own state
+        if (!wparams.no_context) {
+            wparams.prompt_tokens = prompt_tokens.data();
+            wparams.prompt_n_tokens = (int) prompt_tokens.size();
+        }
+        const int result = run_whisper(ctx, wparams, samples, n_samples, window_start);
+        if (result != 0) {
+            SDL_Log("%s: failed to process audio", stream_name.c_str());
+            // don't decode the same audio again
+            pending.clear();
+            audio.consume(n_samples_new);
+            n_samples_decoded = 0;
+            return false;
+        }
+
+        const int64_t window_start_ms = window_start * 1000 / params.sample_rate;
+        const whisper_token eot = whisper_token_eot(ctx);
+        std::vector<hypothesis_token> current;
+        const int segment_count = n_segments(ctx);
+        for (int i = 0; i < segment_count; ++i) {
+            const int token_count = n_tokens(ctx, i);
+            for (int j = 0; j < token_count; ++j) {
+                const whisper_token_data data = token_data(ctx, i, j);
+                // timestamps and other special tokens
+                if (data.id >= eot) {
+                    continue;
+                }
+                hypothesis_token token;
+                token.id = data.id;
+                token.text = token_text(ctx, i, j);
+                // whisper timestamps are in units of 10 ms
+                token.t0_ms = window_start_ms + data.t0 * 10;
+                token.t1_ms = window_start_ms + data.t1 * 10;
+                current.push_back(token);
+            }
+        }
+
+        if (commit_all) {
+            pending.swap(current);
+            commit_pending(n_samples_new, segments);
+            return true;
+        }
+
+        size_t n_agreed = 0;
+        while (n_agreed < pending.size() && n_agreed < current.size() && pending[n_agreed].id == current[n_agreed].id) {
+            n_agreed++;
+        }
+        emit(current, 0, n_agreed, true, segments);
+        emit(current, n_agreed, current.size(), false, segments);
+
+        // release the audio up to the end of the last committed token, the next
+        // window starts there
+        size_t n_release = 0;
+        if (n_agreed > 0) {
+            const int64_t commit_end = (current[n_agreed - 1].t1_ms - window_start_ms) * params.sample_rate / 1000;
+            n_release = commit_end <= 0 ? 0 : ((size_t) commit_end < n_samples_new ? (size_t) commit_end : n_samples_new);
+        }
+        audio.consume(n_release);
+        n_samples_decoded = n_samples_new - n_release;
+        pending.assign(current.begin() + n_agreed, current.end());
+        return true;
+    }
+
+public:
+    speech_stream(const std::string & name, const speech_stream_params & params) :
+        stream_name(name),
+        params(params),
+        audio(params.n_samples_max, params.n_samples_keep),
+        mel(params.n_samples_max),
+        detector(params.sample_rate, params.vad_thold, params.freq_thold),
+        gate(&detector, params.n_samples_step, params.n_samples_vad_last),
+        ended(false) {
+    }
+
+    ~speech_stream() {
+        if (state) {
+            whisper_free_state(state);
+        }
+    }
+
+    // With own_state unset the stream decodes on the context's default state instead,
+    // which is what whisper_get_timings() reports on. Only one stream may do that.
+    bool init(whisper_context *ctx, bool own_state = true) {
+        if (own_state) {
+            state = whisper_init_state(ctx);
+            if (!state) {
+                SDL_Log("%s: couldn't initialize whisper state", stream_name.c_str());
+                return false;
+            }
+        }
+        // Local agreement decodes with token timestamps, which always take the
+        // samples, see run_whisper(). The capture thread only computes frames
+        // for streams which use them.
+        if (params.incremental_mel && !params.local_agreement) {
+            mel.enable(whisper_model_n_mels(ctx));
+        }
+        return true;
+    }
+
+    const std::string & name() const {
+        return stream_name;
+    }
+
+    // Capture side, never blocks. Returns how many of the samples were taken, the rest are dropped
+    size_t push(const float * data, size_t length) {
+        const size_t n = audio.write(data, length);
+        mel.push(data, n);
+        return n;
+    }
+
+    // Capture side. How many samples can be pushed without dropping any, for inputs which can wait
+    size_t writable() const {
+        return audio.free_space();
+    }
+
+    // Capture side. No more samples will be pushed
+    void end_of_stream() {
+        ended.store(true);
+    }
+
+    // Decoder side. Is there new audio the VAD gate hasn't looked at yet?
+    bool ready() const {
+        if (ended.load()) {
+            return audio.available() > 0;
+        }
+        return audio.available() >= (size_t) params.n_samples_vad_last && audio.total_written() != waiting_at;
+    }
+
+    // Decoder side. The input has ended and all of its audio went through the recognizer
+    bool drained() const {
+        return ended.load() && audio.available() == 0;
+    }
+
+    // Decoder side. Samples waiting for recognition, used to serve the stream which is furthest behind first
+    size_t backlog() const {
+        return audio.available();
+    }
+
+    // Samples the ring holds, backlog() / capacity() is how full it is
+    size_t capacity() const {
+        return audio.size();
+    }
+
+    // Samples pushed while the ring was full, since the stream started
+    uint64_t dropped_samples() const {
+        return audio.dropped_samples();
+    }
+
+    // Samples the overload policy and the latency ceiling skipped without decoding them
+    uint64_t shed_samples() const {
+        return n_shed_samples;
+    }
+
+    // Samples decoded in a window longer than a step because the stream was behind
+    uint64_t coalesced_samples() const {
+        return n_coalesced_samples;
+    }
+
+    // Samples decoded with cheaper settings because the stream was behind
+    uint64_t degraded_samples() const {
+        return n_degraded_samples;
+    }
+
+    // Decoder side. New samples the last recognize() went through, decoded or skipped
+    size_t step_samples() const {
+        return n_step_samples;
+    }
+
+    // Decoder side. Changes how much new audio a step waits for
+    void set_step(const int n_samples) {
+        params.n_samples_step = n_samples;
+        gate.set_step(n_samples);
+    }
+
+    // Decoder side. Encoding only as much context as the window needs is much
+    // cheaper for short windows, at some cost in accuracy
+    void set_fit_audio_ctx(const bool fit) {
+        fit_audio_ctx = fit;
+    }
+
+    // Spectrogram frames the decodes took as computed on capture, and those they computed themselves
+    uint64_t mel_frames_reused() const {
+        return mel.reused_frames();
+    }
+
+    uint64_t mel_frames_computed() const {
+        return mel.computed_frames();
+    }
+
+    const vad_gate & vad() const {
+        return gate;
+    }
+
+    // Decoder side. Runs whisper on the buffered audio if the VAD gate lets it through.
+    // Returns true if whisper_full was called and appends the recognized segments,
+    // with timestamps relative to the start of the stream. With local agreement
+    // the segments are one final and one interim segment, otherwise all are final.
+    bool recognize(whisper_context *ctx, whisper_full_params wparams, std::vector<transcript_segment> & segments) {
+        // read before peeking, so no sample pushed after the end is missed
+        const bool flush = ended.load();
+        if (audio.available() < (size_t) params.n_samples_vad_last && !flush) {
+            return false;
+        }
+
+        const uint64_t dropped = audio.dropped_samples();
+        if (dropped != dropped_reported) {
+            SDL_Log("%s: speech recognition is behind, dropped %llu samples (%.1f s total)",
+                    stream_name.c_str(), (unsigned long long) (dropped - dropped_reported),
+                    (float) dropped / params.sample_rate);
+            dropped_reported = dropped;
+        }
+
+        // n_samples_keep samples from the previous step followed by the new samples, no copy
+        size_t n_samples_to_keep = 0;
+        size_t n_samples_new = 0;
+        const float *samples = audio.peek(&n_samples_to_keep, &n_samples_new);
+        overloaded = false;
+        force_commit = false;
+        if (params.bounded_latency && !flush && bound_latency(n_samples_new, segments)) {
+            samples = audio.peek(&n_samples_to_keep, &n_samples_new);
+        }
+        const uint64_t window_start = audio.total_consumed() - n_samples_to_keep;
+
+        n_step_samples = 0;
+        if (params.local_agreement) {
+            return recognize_agreement(ctx, wparams, segments, samples, n_samples_to_keep, n_samples_new, window_start, flush);
+        }
+
+        switch (gate.decide(samples + n_samples_to_keep, n_samples_new, flush)) {
+            case VAD_WAIT:
+                waiting_at = audio.total_written();
+                return false;
+            case VAD_SKIP:
+                n_step_samples = n_samples_new;
+                audio.consume(n_samples_new);
+                log_skipped();
+                return false;
+            case VAD_DECODE:
+                break;
+        }
+        n_step_samples = n_samples_new;
+
+        wparams.prompt_tokens = prompt_tokens.data();
+
+        const int n_samples = n_samples_to_keep + n_samples_new;
+        const int result = run_whisper(ctx, wparams, samples, n_samples, window_start);
+        // hand the samples back to the capture thread, the last n_samples_keep stay readable
+        audio.consume(n_samples_new);
+        if (result != 0) {
+            SDL_Log("%s: failed to process audio", stream_name.c_str());
+            return false;
+        }
+
+        prompt_tokens.clear();
+
+        const int64_t window_start_ms = timestamp_start * 1000 / params.sample_rate;
+        const int segment_count = n_segments(ctx);
+        for (int i = 0; i < segment_count; ++i) {
+            transcript_segment segment;
+            // whisper timestamps are in units of 10 ms
+            segment.t0_ms = window_start_ms + segment_t0(ctx, i) * 10;
+            segment.t1_ms = window_start_ms + segment_t1(ctx, i) * 10;
+            segment.text = segment_text(ctx, i);
+            segments.push_back(segment);
+
+            const int token_count = n_tokens(ctx, i);
+            for (int j = 0; j < token_count; ++j) {
+                prompt_tokens.push_back(token_id(ctx, i, j));
+            }
+        }
+        return true;
+    }
+};
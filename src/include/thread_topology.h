@@ -0,0 +1,380 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <SDL3/SDL.h>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// What a thread does, which decides the cores it may run on and its priority
+enum thread_role {
+    // audio and camera capture, which must never wait for anything else
+    THREAD_ROLE_CAPTURE,
+    // the decode slots, with the compute threads whisper starts from them
+    THREAD_ROLE_DECODE,
+    // refinement and transcribing the history again, after the live streams
+    THREAD_ROLE_BACKGROUND,
+    // the main thread, rendering and events
+    THREAD_ROLE_UI,
+    // model loading, the journal and the metrics exporter
+    THREAD_ROLE_IO,
+    THREAD_ROLE_COUNT,
+};
+
+inline const char * thread_role_name(const thread_role role) {
+    static const char * names[THREAD_ROLE_COUNT] = {"capture", "decode", "background", "ui", "io"};
+    return role < THREAD_ROLE_COUNT ? names[role] : "unknown";
+}
+
+inline bool parse_thread_role(const std::string & text, thread_role * role) {
+    for (int i = 0; i < THREAD_ROLE_COUNT; ++i) {
+        if (text == thread_role_name((thread_role) i)) {
+            *role = (thread_role) i;
+            return true;
+        }
+    }
+    return false;
+}
+
+inline const char * thread_priority_name(const SDL_ThreadPriority priority) {
+    switch (priority) {
+        case SDL_THREAD_PRIORITY_LOW: return "low";
+        case SDL_THREAD_PRIORITY_NORMAL: return "normal";
+        case SDL_THREAD_PRIORITY_HIGH: return "high";
+        case SDL_THREAD_PRIORITY_TIME_CRITICAL: return "time-critical";
+    }
+    return "unknown";
+}
+
+inline bool parse_thread_priority(const std::string & text, SDL_ThreadPriority * priority) {
+    const SDL_ThreadPriority all[] = {SDL_THREAD_PRIORITY_LOW, SDL_THREAD_PRIORITY_NORMAL, SDL_THREAD_PRIORITY_HIGH,
+                                      SDL_THREAD_PRIORITY_TIME_CRITICAL};
+    for (size_t i = 0; i < sizeof(all) / sizeof(all[0]); ++i) {
+        if (text == thread_priority_name(all[i])) {
+            *priority = all[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+// "0-3,8" as the sorted CPU numbers 0, 1, 2, 3, 8
+inline bool parse_cpu_list(const std::string & text, std::vector<int> & cpus) {
+    cpus.clear();
+    size_t pos = 0;
+    while (pos < text.size()) {
+        size_t end = text.find(',', pos);
+        if (end == std::string::npos) {
+            end = text.size();
+        }
+        const std::string range = text.substr(pos, end - pos);
+        const size_t dash = range.find('-');
+        char *rest = NULL;
+        const long first = strtol(range.c_str(), &rest, 10);
+        long last = first;
+        if (rest == range.c_str() || first < 0) {
+            return false;
+        }
+        if (dash != std::string::npos) {
+            const char *second = range.c_str() + dash + 1;
+            last = strtol(second, &rest, 10);
+            if (rest == second || last < first) {
+                return false;
+            }
+        }
+        if (*rest != '\0' || last >= 4096) {
+            return false;
+        }
+        for (long cpu = first; cpu <= last; ++cpu) {
+            cpus.push_back((int) cpu);
+        }
+        pos = end + 1;
+    }
+    std::sort(cpus.begin(), cpus.end());
+    cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+    return !cpus.empty();
+}
+
+// The other way round, with consecutive CPUs as ranges
+inline std::string format_cpu_list(const std::vector<int> & cpus) {
+    std::string text;
+    char buffer[32];
+    for (size_t i = 0; i < cpus.size();) {
+        size_t j = i;
+        while (j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1) {
+            j++;
+        }
+        if (j == i) {
+            snprintf(buffer, sizeof(buffer), "%s%d", text.empty() ? "" : ",", cpus[i]);
+        } else {
+            snprintf(buffer, sizeof(buffer), "%s%d-%d", text.empty() ? "" : ",", cpus[i], cpus[j]);
+        }
+        text += buffer;
+        i = j + 1;
+    }
+    return text;
+}
+
+// Where a thread ended up, for showing in the UI
+struct thread_placement {
+    std::string name;
+    thread_role role = THREAD_ROLE_IO;
+    // the kernel's thread id where there is one
+    long tid = 0;
+    SDL_ThreadPriority priority = SDL_THREAD_PRIORITY_NORMAL;
+    bool priority_set = false;
+    // the CPUs the thread may run on as the kernel reports them, empty if unknown
+    std::vector<int> cpus;
+    bool pinned = false;
+    // the CPU it ran on last, -1 if unknown
+    int last_cpu = -1;
+};
+
+// Places the application's threads on cores and priorities by their role, so big
+// hosts can be partitioned: e.g. capture on a core of its own, the decoders on
+// the rest of a socket, the UI and I/O out of their way.
+//
+// Every thread applies its role itself when it starts, with a thread_role_scope.
+// CPU sets are only applied on Linux. Threads started from a thread inherit its
+// CPUs and priority there, which is how whisper's compute threads follow the
+// decode slot, or refiner, that runs them: they aren't ours to pin one by one.
+// Once any role has CPUs, the roles without get the CPUs the process started
+// with, so they don't inherit another role's set from whichever thread started
+// them. SDL's own threads, e.g. the audio devices', keep the CPUs of the main
+// thread when they were created.
+class thread_topology {
+private:
+    std::mutex mutex;
+    std::vector<int> role_cpus[THREAD_ROLE_COUNT];
+    SDL_ThreadPriority role_priority[THREAD_ROLE_COUNT];
+    // the CPUs the process was allowed when it started
+    std::vector<int> process_cpus;
+    bool any_pinned = false;
+    // living threads, in the order they started
+    std::vector<thread_placement> threads;
+    // failures are logged once per role
+    bool priority_warned[THREAD_ROLE_COUNT];
+    bool pin_warned[THREAD_ROLE_COUNT];
+
+    thread_topology(const thread_topology &) = delete;
+    thread_topology & operator=(const thread_topology &) = delete;
+
+    static long current_tid() {
+#if defined(__linux__)
+        return (long) syscall(SYS_gettid);
+#else
+        return (long) SDL_GetCurrentThreadID();
+#endif
+    }
+
+    static std::vector<int> current_cpus() {
+        std::vector<int> cpus;
+#if defined(__linux__)
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (pthread_getaffinity_np(pthread_self(), sizeof(set), &set) == 0) {
+            for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+                if (CPU_ISSET(cpu, &set)) {
+                    cpus.push_back(cpu);
+                }
+            }
+        }
+#endif
+        return cpus;
+    }
+
+    // The CPU field of /proc/self/task/<tid>/stat, the one the thread last ran on
+    static int last_cpu_of(const long tid) {
+#if defined(__linux__)
+        char path[64];
+        snprintf(path, sizeof(path), "/proc/self/task/%ld/stat", tid);
+        FILE *file = fopen(path, "r");
+        if (!file) {
+            return -1;
+        }
+        char buffer[1024];
+        const size_t n = fread(buffer, 1, sizeof(buffer) - 1, file);
+        fclose(file);
+        buffer[n] = '\0';
+        // the name in parentheses may contain spaces, the fields after it don't
+        const char *p = strrchr(buffer, ')');
+        if (!p) {
+            return -1;
+        }
+        // the state is field 3, the CPU field 39
+        int field = 2;
+        for (; *p && field < 39; ++p) {
+            if (*p == ' ') {
+                field++;
+            }
+        }
+        return field == 39 ? atoi(p) : -1;
+#else
+        return -1;
+#endif
+    }
+
+#if defined(__linux__)
+    static bool pin_current(const std::vector<int> & cpus) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (size_t i = 0; i < cpus.size(); ++i) {
+            if (cpus[i] < CPU_SETSIZE) {
+                CPU_SET(cpus[i], &set);
+            }
+        }
+        return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+    }
+#endif
+
+public:
+    thread_topology() {
+        for (int i = 0; i < THREAD_ROLE_COUNT; ++i) {
+            role_priority[i] = SDL_THREAD_PRIORITY_NORMAL;
+            priority_warned[i] = false;
+            pin_warned[i] = false;
+        }
+        // capture must keep up whatever else is going on, background work only
+        // gets what the live path leaves
+        role_priority[THREAD_ROLE_CAPTURE] = SDL_THREAD_PRIORITY_HIGH;
+        role_priority[THREAD_ROLE_BACKGROUND] = SDL_THREAD_PRIORITY_LOW;
+        process_cpus = current_cpus();
+    }
+
+    // Before the threads start. CPUs the process may not use are left out, false
+    // if none are left.
+    bool set_cpus(const thread_role role, const std::vector<int> & cpus) {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<int> allowed;
+        if (process_cpus.empty()) {
+            allowed = cpus;
+        } else {
+            std::set_intersection(cpus.begin(), cpus.end(), process_cpus.begin(), process_cpus.end(),
+                                  std::back_inserter(allowed));
+        }
+        if (allowed.empty()) {
+            SDL_Log("None of the CPUs %s for %s threads are available to the process (%s)", format_cpu_list(cpus).c_str(),
+                    thread_role_name(role), format_cpu_list(process_cpus).c_str());
+            return false;
+        }
+        if (allowed.size() < cpus.size()) {
+            SDL_Log("%s threads: leaving out CPUs the process can't use, %s remain", thread_role_name(role),
+                    format_cpu_list(allowed).c_str());
+        }
+#if !defined(__linux__)
+        SDL_Log("%s threads: pinning to CPUs is only supported on Linux", thread_role_name(role));
+#endif
+        role_cpus[role] = allowed;
+        any_pinned = true;
+        return true;
+    }
+
+    void set_priority(const thread_role role, const SDL_ThreadPriority priority) {
+        std::lock_guard<std::mutex> lock(mutex);
+        role_priority[role] = priority;
+    }
+
+    // CPUs the role's threads are pinned to, empty if they aren't
+    std::vector<int> cpus(const thread_role role) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return role_cpus[role];
+    }
+
+    SDL_ThreadPriority priority(const thread_role role) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return role_priority[role];
+    }
+
+    const std::vector<int> & available_cpus() const {
+        return process_cpus;
+    }
+
+    // On the thread itself, when it starts
+    void enter(const thread_role role, const char * name) {
+        std::unique_lock<std::mutex> lock(mutex);
+        thread_placement placement;
+        placement.name = name;
+        placement.role = role;
+        placement.tid = current_tid();
+        placement.priority = role_priority[role];
+        const std::vector<int> cpus = !role_cpus[role].empty() ? role_cpus[role] : process_cpus;
+        const bool pin = any_pinned && !cpus.empty();
+        lock.unlock();
+
+        placement.priority_set = SDL_SetCurrentThreadPriority(placement.priority);
+#if defined(__linux__)
+        placement.pinned = pin && pin_current(cpus);
+#endif
+        placement.cpus = current_cpus();
+        placement.last_cpu = last_cpu_of(placement.tid);
+
+        lock.lock();
+        if (!placement.priority_set && !priority_warned[role]) {
+            priority_warned[role] = true;
+            SDL_Log("Couldn't set %s priority for %s threads: %s", thread_priority_name(placement.priority),
+                    thread_role_name(role), SDL_GetError());
+        }
+#if defined(__linux__)
+        if (pin && !placement.pinned && !pin_warned[role]) {
+            pin_warned[role] = true;
+            SDL_Log("Couldn't pin %s threads to CPUs %s", thread_role_name(role), format_cpu_list(cpus).c_str());
+        }
+#endif
+        threads.push_back(placement);
+    }
+
+    // On the thread itself, before it exits
+    void leave() {
+        const long tid = current_tid();
+        std::lock_guard<std::mutex> lock(mutex);
+        for (size_t i = 0; i < threads.size(); ++i) {
+            if (threads[i].tid == tid) {
+                threads.erase(threads.begin() + i);
+                return;
+            }
+        }
+    }
+
+    // The living threads, with the CPU each ran on last read again
+    void snapshot(std::vector<thread_placement> & placements) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            placements = threads;
+        }
+        for (size_t i = 0; i < placements.size(); ++i) {
+            placements[i].last_cpu = last_cpu_of(placements[i].tid);
+        }
+    }
+};
+
+inline thread_topology & app_thread_topology() {
+    static thread_topology topology;
+    return topology;
+}
+
+// Applies a role to the current thread for as long as it's in scope
+class thread_role_scope {
+private:
+    thread_role_scope(const thread_role_scope &) = delete;
+    thread_role_scope & operator=(const thread_role_scope &) = delete;
+
+public:
+    thread_role_scope(const thread_role role, const char * name) {
+        app_thread_topology().enter(role, name);
+    }
+
+    ~thread_role_scope() {
+        app_thread_topology().leave();
+    }
+};
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// A transcribed segment, timestamps in milliseconds from the start of the audio
+struct transcript_segment {
+    int64_t t0_ms = 0;
+    int64_t t1_ms = 0;
+    std::string text;
+    // interim text may still change with the next decode, final text won't
+    bool final = true;
+};
+
+enum transcript_format {
+    TRANSCRIPT_FORMAT_TXT,
+    TRANSCRIPT_FORMAT_SRT,
+    TRANSCRIPT_FORMAT_JSONL,
+};
+
+inline bool parse_transcript_format(const std::string & name, transcript_format * format) {
+    if (name == "txt") {
+        *format = TRANSCRIPT_FORMAT_TXT;
+    } else if (name == "srt") {
+        *format = TRANSCRIPT_FORMAT_SRT;
+    } else if (name == "jsonl") {
+        *format = TRANSCRIPT_FORMAT_JSONL;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+inline const char * transcript_format_extension(const transcript_format format) {
+    switch (format) {
+        case TRANSCRIPT_FORMAT_SRT:   return ".srt";
+        case TRANSCRIPT_FORMAT_JSONL: return ".jsonl";
+        case TRANSCRIPT_FORMAT_TXT:
+        default:                      return ".txt";
+    }
+}
+
+// 00:01:02,345
+inline std::string srt_timestamp(int64_t ms) {
+    char buffer[32];
+    const int64_t hours = ms / 3600000;
+    const int64_t minutes = ms / 60000 % 60;
+    const int64_t seconds = ms / 1000 % 60;
+    snprintf(buffer, sizeof(buffer), "%02lld:%02lld:%02lld,%03lld",
+             (long long) hours, (long long) minutes, (long long) seconds, (long long) (ms % 1000));
+    return buffer;
+}
+
+inline std::string json_escape(const std::string & text) {
+    std::string escaped;
+    escaped.reserve(text.size() + 2);
+    for (size_t i = 0; i < text.size(); ++i) {
+        const char c = text[i];
+        switch (c) {
+            case '"':  escaped += "\\\""; break;
+            case '\\': escaped += "\\\\"; break;
+            case '\n': escaped += "\\n";  break;
+            case '\r': escaped += "\\r";  break;
+            case '\t': escaped += "\\t";  break;
+            default:
+                if ((unsigned char) c < 0x20) {
+                    char buffer[8];
+                    snprintf(buffer, sizeof(buffer), "\\u%04x", (unsigned char) c);
+                    escaped += buffer;
+                } else {
+                    escaped += c;
+                }
+        }
+    }
+    return escaped;
+}
+
+// Formats one segment, `index` is the 1-based SRT sequence number and `source`
+// names the audio the segment came from in JSONL records. JSONL records also get
+// the wall clock time the segment was recognized at, if there is one (ms since the epoch).
+inline std::string format_transcript_segment(const transcript_segment & segment,
+                                             const transcript_format format,
+                                             const size_t index,
+                                             const std::string & source,
+                                             const int64_t wall_ms = -1) {
+    switch (format) {
+        case TRANSCRIPT_FORMAT_SRT:
+            return std::to_string(index) + "\n" +
+                srt_timestamp(segment.t0_ms) + " --> " + srt_timestamp(segment.t1_ms) + "\n" +
+                segment.text + "\n\n";
+        case TRANSCRIPT_FORMAT_JSONL: {
+            char buffer[96];
+            const int n = snprintf(buffer, sizeof(buffer), "\"start\":%.3f,\"end\":%.3f,",
+                                   segment.t0_ms / 1000.0, segment.t1_ms / 1000.0);
+            if (wall_ms >= 0) {
+                snprintf(buffer + n, sizeof(buffer) - n, "\"time\":%lld.%03lld,",
+                         (long long) (wall_ms / 1000), (long long) (wall_ms % 1000));
+            }
+            return "{\"source\":\"" + json_escape(source) + "\"," + buffer +
+                "\"text\":\"" + json_escape(segment.text) + "\"}\n";
+        }
+        case TRANSCRIPT_FORMAT_TXT:
+        default:
+            return segment.text + "\n";
+    }
+}
+
+inline bool write_transcript(const std::string & filename,
+                             const std::vector<transcript_segment> & segments,
+                             const transcript_format format,
+                             const std::string & source) {
+    FILE *file = fopen(filename.c_str(), "wb");
+    if (!file) {
+        return false;
+    }
+    for (size_t i = 0; i < segments.size(); ++i) {
+        const std::string line = format_transcript_segment(segments[i], format, i + 1, source);
+        fwrite(line.data(), 1, line.size(), file);
+    }
+    return fclose(file) == 0;
+}
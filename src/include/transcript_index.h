@@ -0,0 +1,249 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <map>
+#include <string>
+#include <vector>
+#include "transcript_store.h"
+
+// Inverted index over the words of a transcript_store, for searching hours of
+// history from the UI.
+//
+// Every word maps to the ids of the entries it occurs in, delta encoded as
+// varints, so a posting is one or two bytes. The store only ever appends and
+// publishes entries in order, so the index catches up with it from the thread
+// which searches: ids arrive sorted without any locking and the decoders don't
+// pay for indexing. Queries intersect the postings of their words, with the last
+// word matched as a prefix while it's being typed.
+//
+// Revised entries come out of order, their words are posted to a separate
+// uncompressed list which is merged in at query time. The words of the text
+// they replaced still find them.
+class transcript_index {
+private:
+    struct postings {
+        std::vector<uint8_t> data;
+        uint32_t last_id = 0;
+        uint32_t count = 0;
+
+        void add(const uint32_t id) {
+            // a word repeated within an entry is posted once
+            if (count > 0 && id == last_id) {
+                return;
+            }
+            uint32_t delta = count > 0 ? id - last_id : id;
+            while (delta >= 0x80) {
+                data.push_back((uint8_t) (delta | 0x80));
+                delta >>= 7;
+            }
+            data.push_back((uint8_t) delta);
+            last_id = id;
+            count++;
+        }
+
+        void decode(std::vector<uint32_t> & ids) const {
+            uint32_t id = 0;
+            size_t pos = 0;
+            for (uint32_t i = 0; i < count; ++i) {
+                uint32_t delta = 0;
+                int shift = 0;
+                while (data[pos] & 0x80) {
+                    delta |= (uint32_t) (data[pos++] & 0x7f) << shift;
+                    shift += 7;
+                }
+                delta |= (uint32_t) data[pos++] << shift;
+                id = i == 0 ? delta : id + delta;
+                ids.push_back(id);
+            }
+        }
+    };
+
+    // ordered, so prefixes are a range
+    std::map<std::string, postings> terms;
+    // words of revised entries, ids in the order of the revisions
+    std::map<std::string, std::vector<uint32_t> > revised_terms;
+    size_t n_revisions_indexed = 0;
+    // entry start times per stream, in the order the stream produced them
+    std::map<std::string, std::vector<std::pair<int64_t, uint32_t> > > stream_times;
+    size_t n_indexed = 0;
+    size_t n_postings_bytes = 0;
+
+    // a prefix like "a" could pull in most of the dictionary
+    static const size_t MAX_PREFIX_TERMS = 256;
+
+    static bool is_word_byte(const unsigned char c) {
+        return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c >= 0x80;
+    }
+
+public:
+    // Lowercase words of the text; UTF-8 sequences are kept as part of words,
+    // apostrophes only inside of them ("don't")
+    static void tokenize(const std::string & text, std::vector<std::string> & words) {
+        std::string word;
+        for (size_t i = 0; i < text.size(); ++i) {
+            const unsigned char c = (unsigned char) text[i];
+            if (is_word_byte(c)) {
+                word += (char) (c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c);
+            } else if (c == '\'' && !word.empty() && i + 1 < text.size() && is_word_byte((unsigned char) text[i + 1])) {
+                word += '\'';
+            } else if (!word.empty()) {
+                words.push_back(word);
+                word.clear();
+            }
+        }
+        if (!word.empty()) {
+            words.push_back(word);
+        }
+    }
+
+    // Indexes the entries published since the last call
+    void update(const transcript_store & store) {
+        const size_t n = store.size();
+        std::vector<std::string> words;
+        for (; n_indexed < n; ++n_indexed) {
+            const transcript_entry & entry = store[n_indexed];
+            const uint32_t id = (uint32_t) n_indexed;
+            words.clear();
+            tokenize(entry.segment.text, words);
+            for (size_t i = 0; i < words.size(); ++i) {
+                postings & p = terms[words[i]];
+                const size_t before = p.data.size();
+                p.add(id);
+                n_postings_bytes += p.data.size() - before;
+            }
+            stream_times[entry.stream].push_back(std::make_pair(entry.segment.t0_ms, id));
+        }
+
+        if (store.revision_count() == n_revisions_indexed) {
+            return;
+        }
+        std::vector<uint32_t> ids;
+        store.revised_since(n_revisions_indexed, ids);
+        n_revisions_indexed += ids.size();
+        for (size_t i = 0; i < ids.size(); ++i) {
+            words.clear();
+            tokenize(store.segment(ids[i]).text, words);
+            for (size_t w = 0; w < words.size(); ++w) {
+                revised_terms[words[w]].push_back(ids[i]);
+            }
+        }
+    }
+
+    // Ids of the entries containing every word of the query, oldest first, at
+    // most max_results of the newest. The last word also matches longer words
+    // unless the query ends in a space.
+    void search(const std::string & query, const size_t max_results, std::vector<uint32_t> & results) const {
+        results.clear();
+        std::vector<std::string> words;
+        tokenize(query, words);
+        if (words.empty()) {
+            return;
+        }
+        const bool last_is_prefix = is_word_byte((unsigned char) query[query.size() - 1]);
+
+        std::vector<std::vector<uint32_t> > lists(words.size());
+        for (size_t w = 0; w < words.size(); ++w) {
+            bool merged = false;
+            if (w + 1 == words.size() && last_is_prefix) {
+                size_t n_terms = 0;
+                for (std::map<std::string, postings>::const_iterator it = terms.lower_bound(words[w]);
+                     it != terms.end() && it->first.compare(0, words[w].size(), words[w]) == 0 && n_terms < MAX_PREFIX_TERMS;
+                     ++it, ++n_terms) {
+                    it->second.decode(lists[w]);
+                }
+                size_t n_revised_terms = 0;
+                for (std::map<std::string, std::vector<uint32_t> >::const_iterator it = revised_terms.lower_bound(words[w]);
+                     it != revised_terms.end() && it->first.compare(0, words[w].size(), words[w]) == 0 && n_revised_terms < MAX_PREFIX_TERMS;
+                     ++it, ++n_revised_terms) {
+                    lists[w].insert(lists[w].end(), it->second.begin(), it->second.end());
+                }
+                // revised lists are in revision order and may repeat ids
+                merged = n_terms > 1 || n_revised_terms > 0;
+            } else {
+                std::map<std::string, postings>::const_iterator it = terms.find(words[w]);
+                if (it != terms.end()) {
+                    it->second.decode(lists[w]);
+                }
+                std::map<std::string, std::vector<uint32_t> >::const_iterator revised = revised_terms.find(words[w]);
+                if (revised != revised_terms.end()) {
+                    lists[w].insert(lists[w].end(), revised->second.begin(), revised->second.end());
+                    merged = true;
+                }
+            }
+            if (merged) {
+                std::sort(lists[w].begin(), lists[w].end());
+                lists[w].erase(std::unique(lists[w].begin(), lists[w].end()), lists[w].end());
+            }
+            if (lists[w].empty()) {
+                return;
+            }
+        }
+
+        // shortest list first, every intersection only gets shorter
+        std::sort(lists.begin(), lists.end(),
+                  [](const std::vector<uint32_t> & a, const std::vector<uint32_t> & b) { return a.size() < b.size(); });
+        results.swap(lists[0]);
+        std::vector<uint32_t> intersection;
+        for (size_t w = 1; w < lists.size() && !results.empty(); ++w) {
+            intersection.clear();
+            std::set_intersection(results.begin(), results.end(), lists[w].begin(), lists[w].end(),
+                                  std::back_inserter(intersection));
+            results.swap(intersection);
+        }
+        if (results.size() > max_results) {
+            results.erase(results.begin(), results.end() - max_results);
+        }
+    }
+
+    // Id of the first entry, of any stream, starting at or after t_ms into its
+    // stream, or -1 if there is none
+    int64_t find_time(const int64_t t_ms) const {
+        int64_t best = -1;
+        for (std::map<std::string, std::vector<std::pair<int64_t, uint32_t> > >::const_iterator it = stream_times.begin();
+             it != stream_times.end(); ++it) {
+            const std::vector<std::pair<int64_t, uint32_t> > & times = it->second;
+            std::vector<std::pair<int64_t, uint32_t> >::const_iterator found =
+                std::lower_bound(times.begin(), times.end(), std::make_pair(t_ms, (uint32_t) 0));
+            if (found != times.end() && (best < 0 || found->second < best)) {
+                best = found->second;
+            }
+        }
+        return best;
+    }
+
+    size_t indexed() const {
+        return n_indexed;
+    }
+
+    size_t term_count() const {
+        return terms.size();
+    }
+
+    size_t postings_bytes() const {
+        return n_postings_bytes;
+    }
+};
+
+// "1:02:03", "2:03" or "123" as milliseconds, for jumping to a point of the transcript
+inline bool parse_transcript_time(const std::string & text, int64_t * ms) {
+    int64_t seconds = 0;
+    int64_t field = -1;
+    for (size_t i = 0; i < text.size(); ++i) {
+        const char c = text[i];
+        if (c >= '0' && c <= '9') {
+            field = (field < 0 ? 0 : field) * 10 + (c - '0');
+        } else if (c == ':' && field >= 0) {
+            seconds = (seconds + field) * 60;
+            field = -1;
+        } else if (c != ' ') {
+            return false;
+        }
+    }
+    if (field < 0) {
+        return false;
+    }
+    *ms = (seconds + field) * 1000;
+    return true;
+}
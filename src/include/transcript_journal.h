@@ -0,0 +1,305 @@
+#pragma once
+
+#include <atomic>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <SDL3/SDL.h>
+#include "mpsc_queue.h"
+#include "transcript_format.h"
+#include "worker.h"
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+struct transcript_journal_params {
+    // the journal is written to base_path + ".srt" and base_path + ".jsonl"
+    std::string base_path;
+    bool srt = true;
+    bool jsonl = true;
+    // files bigger than this are moved aside to base_path.N.srt/.jsonl and new ones started, 0 never
+    uint64_t rotate_bytes = 64ull << 20;
+    // how often queued segments are written out, the most a `tail -f` lags behind
+    Uint32 flush_interval_ms = 250;
+    // how often the files are synced to disk, the most a crash can lose
+    Uint32 sync_interval_ms = 2000;
+};
+
+// Append-only journal of every final segment, as SRT and JSONL files which can be
+// tailed while they are being written.
+//
+// The decode slots only move the segment into a lock-free queue, the formatting
+// and all file I/O happen on the journal's own thread, which a timer wakes up
+// every flush interval. Syncs are batched, at most one per sync interval. If the
+// I/O thread falls so far behind that the queue fills up, segments are dropped
+// and counted instead of ever making a decoder wait.
+class transcript_journal {
+private:
+    struct record {
+        transcript_segment segment;
+        std::string stream;
+        int64_t wall_ms = 0;
+    };
+
+    struct output {
+        transcript_format format;
+        std::string extension;
+        FILE *file = NULL;
+        uint64_t bytes = 0;
+        // SRT sequence number, per file
+        size_t n_records = 0;
+    };
+
+    static const size_t QUEUE_CAPACITY = 4096;
+
+    transcript_journal_params params;
+    mpsc_queue<record> queue;
+    std::atomic<bool> running;
+    worker writer;
+    SDL_TimerID timer = 0;
+
+    output outputs[2];
+    int n_outputs = 0;
+    int next_rotation = 1;
+    Uint64 last_sync_ticks = 0;
+    bool unsynced = false;
+    bool failed = false;
+
+    std::atomic<uint64_t> records_written;
+    std::atomic<uint64_t> records_dropped;
+
+    transcript_journal(const transcript_journal &) = delete;
+    transcript_journal & operator=(const transcript_journal &) = delete;
+
+    static Uint32 SDLCALL on_timer(void *userdata, SDL_TimerID timer_id, Uint32 interval) {
+        ((transcript_journal *) userdata)->writer.notify();
+        return interval;
+    }
+
+    static bool file_exists(const std::string & path) {
+        FILE *file = fopen(path.c_str(), "rb");
+        if (file) {
+            fclose(file);
+        }
+        return file != NULL;
+    }
+
+    static bool file_is_empty(const std::string & path) {
+        FILE *file = fopen(path.c_str(), "rb");
+        if (!file) {
+            return true;
+        }
+        const bool empty = fseek(file, 0, SEEK_END) == 0 && ftell(file) == 0;
+        fclose(file);
+        return empty;
+    }
+
+    std::string path_of(const output & out) const {
+        return params.base_path + out.extension;
+    }
+
+    std::string rotated_path_of(const output & out, const int index) const {
+        return params.base_path + "." + std::to_string(index) + out.extension;
+    }
+
+    bool open_output(output & out) {
+        // append only, whatever is in the file already is never overwritten
+        out.file = fopen(path_of(out).c_str(), "ab");
+        if (!out.file) {
+            SDL_Log("Couldn't open transcript journal %s", path_of(out).c_str());
+            return false;
+        }
+        out.bytes = 0;
+        out.n_records = 0;
+        return true;
+    }
+
+    static void sync_file(FILE *file) {
+        fflush(file);
+#ifdef _WIN32
+        _commit(_fileno(file));
+#else
+        fsync(fileno(file));
+#endif
+    }
+
+    // Moves the current files aside under the next free index and starts new ones.
+    // Both formats rotate together, so base.3.srt and base.3.jsonl hold the same segments.
+    bool rotate() {
+        while (true) {
+            bool taken = false;
+            for (int i = 0; i < n_outputs; ++i) {
+                taken = taken || file_exists(rotated_path_of(outputs[i], next_rotation));
+            }
+            if (!taken) {
+                break;
+            }
+            next_rotation++;
+        }
+        bool ok = true;
+        for (int i = 0; i < n_outputs; ++i) {
+            output &out = outputs[i];
+            if (out.file) {
+                sync_file(out.file);
+                fclose(out.file);
+                out.file = NULL;
+            }
+            if (!file_is_empty(path_of(out)) && rename(path_of(out).c_str(), rotated_path_of(out, next_rotation).c_str()) != 0) {
+                SDL_Log("Couldn't rotate transcript journal %s", path_of(out).c_str());
+            }
+            ok = open_output(out) && ok;
+        }
+        next_rotation++;
+        unsynced = false;
+        return ok;
+    }
+
+    void write_record(const record & r) {
+        for (int i = 0; i < n_outputs; ++i) {
+            output &out = outputs[i];
+            if (!out.file) {
+                continue;
+            }
+            const std::string line = format_transcript_segment(r.segment, out.format, ++out.n_records, r.stream, r.wall_ms);
+            const bool written = fwrite(line.data(), 1, line.size(), out.file) == line.size();
+            // log once when it starts failing and once when it recovers
+            if (written == failed) {
+                SDL_Log(written ? "Writing transcript journal %s again" : "Couldn't write transcript journal %s",
+                        path_of(out).c_str());
+                failed = !written;
+            }
+            out.bytes += line.size();
+        }
+        records_written.fetch_add(1, std::memory_order_relaxed);
+        unsynced = true;
+
+        if (params.rotate_bytes == 0) {
+            return;
+        }
+        for (int i = 0; i < n_outputs; ++i) {
+            if (outputs[i].bytes >= params.rotate_bytes) {
+                rotate();
+                break;
+            }
+        }
+    }
+
+    // Journal thread
+    void write() {
+        record r;
+        bool wrote = false;
+        while (queue.try_pop(r)) {
+            write_record(r);
+            wrote = true;
+        }
+        if (wrote) {
+            // readers tailing the files see the segments now, the disk may see them later
+            for (int i = 0; i < n_outputs; ++i) {
+                if (outputs[i].file) {
+                    fflush(outputs[i].file);
+                }
+            }
+        }
+        if (unsynced && SDL_GetTicks() - last_sync_ticks >= params.sync_interval_ms) {
+            sync();
+        }
+    }
+
+    void sync() {
+        for (int i = 0; i < n_outputs; ++i) {
+            if (outputs[i].file) {
+                sync_file(outputs[i].file);
+            }
+        }
+        last_sync_ticks = SDL_GetTicks();
+        unsynced = false;
+    }
+
+public:
+    transcript_journal() : queue(QUEUE_CAPACITY), running(false), records_written(0), records_dropped(0) {
+    }
+
+    ~transcript_journal() {
+        stop();
+    }
+
+    bool start(const transcript_journal_params & journal_params) {
+        params = journal_params;
+        n_outputs = 0;
+        if (params.srt) {
+            outputs[n_outputs].format = TRANSCRIPT_FORMAT_SRT;
+            outputs[n_outputs++].extension = transcript_format_extension(TRANSCRIPT_FORMAT_SRT);
+        }
+        if (params.jsonl) {
+            outputs[n_outputs].format = TRANSCRIPT_FORMAT_JSONL;
+            outputs[n_outputs++].extension = transcript_format_extension(TRANSCRIPT_FORMAT_JSONL);
+        }
+        // the journal of a previous session is kept, this one starts fresh files
+        // so the SRT numbering starts at 1
+        if (!rotate()) {
+            stop();
+            return false;
+        }
+        last_sync_ticks = SDL_GetTicks();
+        if (!writer.start("transcript_journal", std::bind(&transcript_journal::write, this), THREAD_ROLE_IO)) {
+            stop();
+            return false;
+        }
+        timer = SDL_AddTimer(params.flush_interval_ms, on_timer, this);
+        if (!timer) {
+            SDL_Log("Couldn't create transcript journal timer: %s", SDL_GetError());
+            stop();
+            return false;
+        }
+        running.store(true);
+        SDL_Log("Writing the transcript journal to %s.*", params.base_path.c_str());
+        return true;
+    }
+
+    // Any thread, never blocks. Returns false if the segment was dropped
+    bool append(const transcript_segment & segment, const std::string & stream) {
+        if (!running.load(std::memory_order_relaxed)) {
+            return false;
+        }
+        record r;
+        r.segment = segment;
+        r.stream = stream;
+        SDL_Time now = 0;
+        r.wall_ms = SDL_GetCurrentTime(&now) ? now / 1000000 : -1;
+        if (!queue.try_push(std::move(r))) {
+            records_dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        return true;
+    }
+
+    uint64_t written() const {
+        return records_written.load(std::memory_order_relaxed);
+    }
+
+    // Segments the journal thread couldn't keep up with
+    uint64_t dropped() const {
+        return records_dropped.load(std::memory_order_relaxed);
+    }
+
+    // Writes out and syncs everything queued so far, then closes the files
+    void stop() {
+        running.store(false);
+        if (timer) {
+            SDL_RemoveTimer(timer);
+            timer = 0;
+        }
+        writer.stop();
+        write();
+        for (int i = 0; i < n_outputs; ++i) {
+            if (outputs[i].file) {
+                sync_file(outputs[i].file);
+                fclose(outputs[i].file);
+                outputs[i].file = NULL;
+            }
+        }
+    }
+};
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <SDL3/SDL.h>
+#include "transcript_format.h"
+
+struct transcript_entry {
+    transcript_segment segment;
+    // name of the speech stream the segment came from
+    std::string stream;
+};
+
+// Append-only store of every recognized segment of a session.
+//
+// Entries are kept in fixed size blocks which never move, so once an entry is
+// published it can be read without a lock: writers append under a mutex and
+// then publish the new size, the UI thread reads everything below size().
+// Rendering only ever touches the entries on screen, however long the session.
+//
+// A published entry's segment can be revised later, e.g. by a more accurate
+// model. The revision is a new immutable segment which the entry points to from
+// then on, revisions are kept until the store goes, so readers never see one
+// change or disappear under them.
+class transcript_store {
+public:
+    static const size_t BLOCK_SIZE = 1024;
+    static const size_t MAX_BLOCKS = 1024;
+
+private:
+    std::unique_ptr<transcript_entry[]> blocks[MAX_BLOCKS];
+    // the newest revision of every entry, NULL if it has none
+    std::unique_ptr<std::atomic<const transcript_segment *>[]> revised[MAX_BLOCKS];
+    std::atomic<size_t> count;
+    std::mutex append_mutex;
+    bool full_reported = false;
+
+    mutable std::mutex revise_mutex;
+    std::vector<std::unique_ptr<transcript_segment> > revisions;
+    // ids of the revised entries in the order they were revised
+    std::vector<uint32_t> revised_ids;
+    std::atomic<size_t> n_revisions;
+
+    transcript_store(const transcript_store &) = delete;
+    transcript_store & operator=(const transcript_store &) = delete;
+
+public:
+    transcript_store() : count(0), n_revisions(0) {
+    }
+
+    // Safe to call from any thread. Returns false once the store is full,
+    // otherwise the entry's index goes to *index if it is given.
+    bool append(const transcript_entry & entry, size_t * index = NULL) {
+        std::lock_guard<std::mutex> lock(append_mutex);
+        const size_t n = count.load(std::memory_order_relaxed);
+        const size_t block = n / BLOCK_SIZE;
+        if (block >= MAX_BLOCKS) {
+            if (!full_reported) {
+                SDL_Log("Transcript is full, dropping segments after %zu", n);
+                full_reported = true;
+            }
+            return false;
+        }
+        if (!blocks[block]) {
+            blocks[block].reset(new transcript_entry[BLOCK_SIZE]);
+            revised[block].reset(new std::atomic<const transcript_segment *>[BLOCK_SIZE]);
+            for (size_t i = 0; i < BLOCK_SIZE; ++i) {
+                revised[block][i].store(NULL, std::memory_order_relaxed);
+            }
+        }
+        blocks[block][n % BLOCK_SIZE] = entry;
+        count.store(n + 1, std::memory_order_release);
+        if (index) {
+            *index = n;
+        }
+        return true;
+    }
+
+    // Safe to call from any thread, i must be below a value size() returned
+    void revise(size_t i, const transcript_segment & segment) {
+        std::lock_guard<std::mutex> lock(revise_mutex);
+        revisions.push_back(std::unique_ptr<transcript_segment>(new transcript_segment(segment)));
+        revised_ids.push_back((uint32_t) i);
+        revised[i / BLOCK_SIZE][i % BLOCK_SIZE].store(revisions.back().get(), std::memory_order_release);
+        n_revisions.store(revised_ids.size(), std::memory_order_release);
+    }
+
+    // The entry's newest segment, revised or as it was appended
+    const transcript_segment & segment(size_t i) const {
+        const transcript_segment *revision = revised[i / BLOCK_SIZE][i % BLOCK_SIZE].load(std::memory_order_acquire);
+        return revision ? *revision : blocks[i / BLOCK_SIZE][i % BLOCK_SIZE].segment;
+    }
+
+    bool is_revised(size_t i) const {
+        return revised[i / BLOCK_SIZE][i % BLOCK_SIZE].load(std::memory_order_acquire) != NULL;
+    }
+
+    // Revisions made so far
+    size_t revision_count() const {
+        return n_revisions.load(std::memory_order_acquire);
+    }
+
+    // Appends the ids of the entries revised since the first `first` revisions
+    void revised_since(size_t first, std::vector<uint32_t> & ids) const {
+        std::lock_guard<std::mutex> lock(revise_mutex);
+        for (size_t i = first; i < revised_ids.size(); ++i) {
+            ids.push_back(revised_ids[i]);
+        }
+    }
+
+    // Number of entries which can be read
+    size_t size() const {
+        return count.load(std::memory_order_acquire);
+    }
+
+    // i must be below a value size() returned. The entry as it was appended, see segment()
+    const transcript_entry & operator[](size_t i) const {
+        return blocks[i / BLOCK_SIZE][i % BLOCK_SIZE];
+    }
+};
@@ -0,0 +1,178 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstddef>
+
+// Interface for voice activity detectors, so the cheap energy based detector
+// below can be swapped for something smarter without touching the recognizer.
+class voice_activity_detector {
+public:
+    virtual ~voice_activity_detector() {}
+
+    // Does the audio contain speech at all?
+    virtual bool has_speech(const float * data, size_t length) = 0;
+
+    // Has the speech in the audio ended, i.e. are the last `last_length` samples quiet
+    // compared to the rest of the audio?
+    virtual bool speech_ended(const float * data, size_t length, size_t last_length) = 0;
+};
+
+// Energy detector on high-pass filtered audio, the same idea as vad_simple() in the
+// whisper.cpp stream example. The input is never modified, the filter runs on the fly.
+class energy_vad : public voice_activity_detector {
+private:
+    int sample_rate;
+    // speech has ended if the energy of the tail drops below vad_thold * average energy
+    float vad_thold;
+    // cut-off of the high-pass filter which removes hum and DC offset
+    float freq_thold;
+    // audio with an average energy below this is treated as silence
+    float energy_thold;
+
+    // average absolute amplitude of the high-pass filtered audio in [begin, end)
+    float energy(const float * data, size_t begin, size_t end) const {
+        if (end <= begin) {
+            return 0.0f;
+        }
+        const float pi = 3.14159265358979f;
+        const float rc = 1.0f / (2.0f * pi * freq_thold);
+        const float dt = 1.0f / sample_rate;
+        const float alpha = rc / (rc + dt);
+
+        float y = 0.0f;
+        float sum = 0.0f;
+        for (size_t i = begin + 1; i < end; ++i) {
+            y = alpha * (y + data[i] - data[i - 1]);
+            sum += std::fabs(y);
+        }
+        return sum / (end - begin);
+    }
+
+public:
+    energy_vad(const int sample_rate,
+               const float vad_thold = 0.6f,
+               const float freq_thold = 100.0f,
+               const float energy_thold = 0.001f) :
+        sample_rate(sample_rate),
+        vad_thold(vad_thold),
+        freq_thold(freq_thold),
+        energy_thold(energy_thold) {
+    }
+
+    bool has_speech(const float * data, size_t length) override {
+        return energy(data, 0, length) > energy_thold;
+    }
+
+    bool speech_ended(const float * data, size_t length, size_t last_length) override {
+        if (last_length >= length) {
+            return false;
+        }
+        const float energy_all = energy(data, 0, length);
+        const float energy_last = energy(data, length - last_length, length);
+        return energy_last <= vad_thold * energy_all;
+    }
+};
+
+enum vad_decision {
+    VAD_WAIT,   // not enough audio yet
+    VAD_SKIP,   // silence, consume the samples without running whisper
+    VAD_DECODE, // run whisper on the samples
+};
+
+// Sits between the audio ring buffer and the recognizer and decides, for the
+// samples which haven't been consumed yet, whether they are worth decoding.
+// Silent steps are skipped, and a step is flushed early as soon as an utterance ends.
+class vad_gate {
+private:
+    voice_activity_detector * detector;
+    size_t n_samples_step;
+    size_t n_samples_last;
+    bool in_utterance = false;
+
+    uint64_t windows_decoded = 0;
+    uint64_t windows_skipped = 0;
+    uint64_t samples_decoded = 0;
+    uint64_t samples_skipped = 0;
+
+public:
+    vad_gate(voice_activity_detector * detector, const size_t n_samples_step, const size_t n_samples_last) :
+        detector(detector),
+        n_samples_step(n_samples_step),
+        n_samples_last(n_samples_last) {
+    }
+
+    // Decoder side, takes effect with the next decide()
+    void set_step(const size_t n_samples) {
+        n_samples_step = n_samples;
+    }
+
+    // `flush` is set once the input has ended, whatever is left is decoded if it has speech
+    vad_decision decide(const float * samples, size_t length, bool flush = false) {
+        if (length == 0 || (length < n_samples_last && !flush)) {
+            return VAD_WAIT;
+        }
+
+        const bool speech = detector->has_speech(samples, length);
+        if (flush) {
+            in_utterance = false;
+            if (!speech) {
+                windows_skipped++;
+                samples_skipped += length;
+                return VAD_SKIP;
+            }
+            windows_decoded++;
+            samples_decoded += length;
+            return VAD_DECODE;
+        }
+        if (!in_utterance) {
+            if (speech) {
+                in_utterance = true;
+            } else if (length >= n_samples_step) {
+                windows_skipped++;
+                samples_skipped += length;
+                return VAD_SKIP;
+            } else {
+                return VAD_WAIT;
+            }
+        }
+
+        if (!speech) {
+            // nothing but silence since the last decode, the utterance is over
+            in_utterance = false;
+            windows_skipped++;
+            samples_skipped += length;
+            return VAD_SKIP;
+        }
+
+        const bool ended = detector->speech_ended(samples, length, n_samples_last);
+        if (!ended && length < n_samples_step) {
+            return VAD_WAIT;
+        }
+        if (ended) {
+            in_utterance = false;
+        }
+        windows_decoded++;
+        samples_decoded += length;
+        return VAD_DECODE;
+    }
+
+    // An utterance started and hasn't ended yet
+    bool in_speech() const {
+        return in_utterance;
+    }
+
+    uint64_t decoded_windows() const {
+        return windows_decoded;
+    }
+
+    uint64_t skipped_windows() const {
+        return windows_skipped;
+    }
+
+    // Fraction of the audio which didn't need a whisper_full call
+    float skipped_ratio() const {
+        const uint64_t total = samples_decoded + samples_skipped;
+        return total ? (float) samples_skipped / total : 0.0f;
+    }
+};
@@ -0,0 +1,253 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include "audio_convert.h"
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Read-only memory mapping of a whole file
+class mapped_file {
+private:
+    const uint8_t *mapped = NULL;
+    size_t mapped_size = 0;
+#ifdef _WIN32
+    HANDLE file_handle = INVALID_HANDLE_VALUE;
+    HANDLE mapping_handle = NULL;
+#endif
+
+    mapped_file(const mapped_file &) = delete;
+    mapped_file & operator=(const mapped_file &) = delete;
+
+public:
+    mapped_file() {}
+
+    bool open(const std::string & filename) {
+        close();
+#ifdef _WIN32
+        file_handle = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (file_handle == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file_handle, &size) || size.QuadPart == 0) {
+            close();
+            return false;
+        }
+        mapping_handle = CreateFileMappingA(file_handle, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (!mapping_handle) {
+            close();
+            return false;
+        }
+        mapped = (const uint8_t *) MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0);
+        if (!mapped) {
+            close();
+            return false;
+        }
+        mapped_size = (size_t) size.QuadPart;
+#else
+        const int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0) {
+            ::close(fd);
+            return false;
+        }
+        void *ptr = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        // the mapping keeps the file alive
+        ::close(fd);
+        if (ptr == MAP_FAILED) {
+            return false;
+        }
+        // audio is read front to back, let the kernel read ahead
+        madvise(ptr, (size_t) st.st_size, MADV_SEQUENTIAL);
+        mapped = (const uint8_t *) ptr;
+        mapped_size = (size_t) st.st_size;
+#endif
+        return true;
+    }
+
+    void close() {
+#ifdef _WIN32
+        if (mapped) {
+            UnmapViewOfFile(mapped);
+        }
+        if (mapping_handle) {
+            CloseHandle(mapping_handle);
+        }
+        if (file_handle != INVALID_HANDLE_VALUE) {
+            CloseHandle(file_handle);
+        }
+        mapping_handle = NULL;
+        file_handle = INVALID_HANDLE_VALUE;
+#else
+        if (mapped) {
+            munmap((void *) mapped, mapped_size);
+        }
+#endif
+        mapped = NULL;
+        mapped_size = 0;
+    }
+
+    const uint8_t * data() const {
+        return mapped;
+    }
+
+    size_t size() const {
+        return mapped_size;
+    }
+
+    ~mapped_file() {
+        close();
+    }
+};
+
+// Reads WAV (RIFF or RF64, as written by wav_writer) and headerless PCM files
+// through a memory mapping. The samples are never copied: samples() points
+// straight into the mapped file.
+class wav_reader {
+private:
+    mapped_file file;
+    const uint8_t *sample_data = NULL;
+    uint64_t sample_bytes = 0;
+
+    uint32_t rate = 0;
+    uint16_t n_channels = 0;
+    pcm_sample_format format = PCM_S16;
+
+    template <typename T>
+    static T get(const uint8_t * ptr) {
+        T value;
+        memcpy(&value, ptr, sizeof(T));
+        return value;
+    }
+
+    static bool ends_with(const std::string & text, const char * suffix) {
+        const size_t n = strlen(suffix);
+        return text.size() >= n && text.compare(text.size() - n, n, suffix) == 0;
+    }
+
+    bool parse_wav() {
+        const uint8_t *ptr = file.data();
+        const size_t size = file.size();
+        if (size < 12 || (memcmp(ptr, "RIFF", 4) != 0 && memcmp(ptr, "RF64", 4) != 0) || memcmp(ptr + 8, "WAVE", 4) != 0) {
+            return false;
+        }
+
+        uint64_t ds64_data_size = 0;
+        bool has_fmt = false;
+        size_t pos = 12;
+        while (pos + 8 <= size) {
+            const uint8_t *chunk = ptr + pos;
+            uint64_t chunk_size = get<uint32_t>(chunk + 4);
+            if (memcmp(chunk, "ds64", 4) == 0 && chunk_size >= 24 && pos + 8 + 24 <= size) {
+                ds64_data_size = get<uint64_t>(chunk + 16);
+            } else if (memcmp(chunk, "fmt ", 4) == 0 && chunk_size >= 16 && pos + 8 + 16 <= size) {
+                uint16_t audio_format = get<uint16_t>(chunk + 8);
+                n_channels = get<uint16_t>(chunk + 10);
+                rate = get<uint32_t>(chunk + 12);
+                const uint16_t bits_per_sample = get<uint16_t>(chunk + 22);
+                // WAVE_FORMAT_EXTENSIBLE keeps the real format at the start of the sub format GUID
+                if (audio_format == 0xFFFE && chunk_size >= 40 && pos + 8 + 40 <= size) {
+                    audio_format = get<uint16_t>(chunk + 8 + 24);
+                }
+                if (audio_format == 1 && bits_per_sample == 16) {
+                    format = PCM_S16;
+                } else if (audio_format == 1 && bits_per_sample == 24) {
+                    format = PCM_S24;
+                } else if (audio_format == 3 && bits_per_sample == 32) {
+                    format = PCM_F32;
+                } else {
+                    return false;
+                }
+                has_fmt = true;
+            } else if (memcmp(chunk, "data", 4) == 0) {
+                if (chunk_size == UINT32_MAX && ds64_data_size) {
+                    chunk_size = ds64_data_size;
+                }
+                // files whose header was never finalized claim less than they have
+                const uint64_t remaining = size - pos - 8;
+                if (chunk_size == 0 || chunk_size > remaining) {
+                    chunk_size = remaining;
+                }
+                sample_data = chunk + 8;
+                sample_bytes = chunk_size;
+                return has_fmt && n_channels > 0;
+            }
+            // chunks are padded to an even size
+            pos += 8 + (size_t) chunk_size + (chunk_size & 1);
+        }
+        return false;
+    }
+
+public:
+    // Headerless files are taken as 16 kHz mono, .s16/.pcm as 16-bit and anything else as float
+    bool open(const std::string & filename, const uint32_t raw_sample_rate = 16000) {
+        sample_data = NULL;
+        sample_bytes = 0;
+        if (!file.open(filename)) {
+            return false;
+        }
+        if (ends_with(filename, ".wav") || ends_with(filename, ".WAV")) {
+            if (!parse_wav()) {
+                file.close();
+                return false;
+            }
+        } else {
+            rate = raw_sample_rate;
+            n_channels = 1;
+            format = ends_with(filename, ".s16") || ends_with(filename, ".pcm") ? PCM_S16 : PCM_F32;
+            sample_data = file.data();
+            sample_bytes = file.size();
+        }
+        return true;
+    }
+
+    uint32_t sample_rate() const {
+        return rate;
+    }
+
+    uint16_t channels() const {
+        return n_channels;
+    }
+
+    pcm_sample_format sample_format() const {
+        return format;
+    }
+
+    // Number of frames, one sample per channel
+    uint64_t frames() const {
+        return sample_bytes / (pcm_sample_size(format) * n_channels);
+    }
+
+    // Interleaved samples in the file's own format
+    const void * samples() const {
+        return sample_data;
+    }
+
+    // Converts frames to mono float, averaging the channels
+    void to_mono_float(uint64_t first_frame, size_t n_frames, float * out) const {
+        const size_t frame_size = pcm_sample_size(format) * n_channels;
+        downmix_to_mono(format, sample_data + first_frame * frame_size, n_channels, n_frames, out);
+    }
+
+    // Mono float samples at the given rate can be used without any conversion,
+    // as long as the data chunk happens to be aligned for floats
+    bool is_float_mono(const uint32_t sample_rate) const {
+        return format == PCM_F32 && n_channels == 1 && rate == sample_rate &&
+            (uintptr_t) sample_data % sizeof(float) == 0;
+    }
+};
@@ -1,10 +1,45 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
 #include <fstream>
+#include <string>
+#include <vector>
 
+// Writes 16-bit PCM or 32-bit float WAV files.
+//
+// Samples are converted block by block into a large write buffer which goes to
+// the file in one call when it's full. The RIFF/data sizes are patched once per
+// flush, so a file being recorded stays readable, and for good on close().
+// Files which grow past 4 GB are turned into RF64: the JUNK chunk reserved
+// after the RIFF header becomes the ds64 chunk holding the 64-bit sizes.
 class wav_writer {
 private:
+    static const size_t WRITE_BUFFER_SIZE = 1 << 20;
+    // samples converted at a time, small enough to stay in L1
+    static const size_t CONVERT_BLOCK_SIZE = 1024;
+    // size of the JUNK/ds64 chunk body
+    static const uint32_t DS64_SIZE = 28;
+
     std::ofstream file;
-    uint32_t dataSize = 0;
     std::string wav_filename;
+    std::vector<char> buffer;
+    size_t buffer_pos = 0;
+
+    uint16_t bits_per_sample = 16;
+    uint16_t channels = 1;
+    bool is_float = false;
+
+    uint64_t dataSize = 0;
+    // where the data chunk size lives, and the fact chunk for float files
+    std::streamoff data_size_offset = 0;
+    std::streamoff fact_offset = 0;
+    std::streamoff header_size = 0;
+
+    template <typename T>
+    void put(const T value) {
+        file.write(reinterpret_cast<const char *>(&value), sizeof(T));
+    }
 
     bool write_header(const uint32_t sample_rate,
                       const uint16_t bits_per_sample,
@@ -13,40 +48,125 @@ private:
         file.write("RIFF", 4);
         file.write("\0\0\0\0", 4);    // Placeholder for file size
         file.write("WAVE", 4);
+
+        // Reserved for the ds64 chunk in case the file ends up larger than 4 GB
+        file.write("JUNK", 4);
+        put<uint32_t>(DS64_SIZE);
+        const char zeros[DS64_SIZE] = {0};
+        file.write(zeros, DS64_SIZE);
+
         file.write("fmt ", 4);
 
-        const uint32_t sub_chunk_size = 16;
-        const uint16_t audio_format = 1;      // PCM format
+        // non-PCM formats need the cbSize field and a fact chunk
+        const uint32_t sub_chunk_size = is_float ? 18 : 16;
+        const uint16_t audio_format = is_float ? 3 : 1;      // IEEE float or PCM format
         const uint32_t byte_rate = sample_rate * channels * bits_per_sample / 8;
         const uint16_t block_align = channels * bits_per_sample / 8;
 
-        file.write(reinterpret_cast<const char *>(&sub_chunk_size), 4);
-        file.write(reinterpret_cast<const char *>(&audio_format), 2);
-        file.write(reinterpret_cast<const char *>(&channels), 2);
-        file.write(reinterpret_cast<const char *>(&sample_rate), 4);
-        file.write(reinterpret_cast<const char *>(&byte_rate), 4);
-        file.write(reinterpret_cast<const char *>(&block_align), 2);
-        file.write(reinterpret_cast<const char *>(&bits_per_sample), 2);
+        put<uint32_t>(sub_chunk_size);
+        put<uint16_t>(audio_format);
+        put<uint16_t>(channels);
+        put<uint32_t>(sample_rate);
+        put<uint32_t>(byte_rate);
+        put<uint16_t>(block_align);
+        put<uint16_t>(bits_per_sample);
+        if (is_float) {
+            put<uint16_t>(0);
+            file.write("fact", 4);
+            put<uint32_t>(4);
+            fact_offset = file.tellp();
+            file.write("\0\0\0\0", 4);    // Placeholder for sample frames
+        }
+        // Pads the samples to a 4-byte offset, so readers which map the file
+        // can use float data in place
+        if ((file.tellp() + (std::streamoff) 8) % 4 != 0) {
+            file.write("JUNK", 4);
+            put<uint32_t>(2);
+            file.write("\0\0", 2);
+        }
         file.write("data", 4);
+        data_size_offset = file.tellp();
         file.write("\0\0\0\0", 4);    // Placeholder for data size
+        header_size = file.tellp();
 
-        return true;
+        return file.good();
+    }
+
+    // Rewrites the sizes in the header, leaves the write position at the end
+    void update_header() {
+        const uint64_t riff_size = header_size - 8 + dataSize;
+        const uint64_t frames = dataSize / (channels * bits_per_sample / 8);
+        const bool rf64 = riff_size > UINT32_MAX;
+
+        file.seekp(0, std::ios::beg);
+        file.write(rf64 ? "RF64" : "RIFF", 4);
+        put<uint32_t>(rf64 ? UINT32_MAX : (uint32_t) riff_size);
+        if (rf64) {
+            file.seekp(12, std::ios::beg);
+            file.write("ds64", 4);
+            put<uint32_t>(DS64_SIZE);
+            put<uint64_t>(riff_size);
+            put<uint64_t>(dataSize);
+            put<uint64_t>(frames);
+            put<uint32_t>(0);    // no table entries
+        }
+        if (fact_offset) {
+            file.seekp(fact_offset, std::ios::beg);
+            put<uint32_t>(frames > UINT32_MAX ? UINT32_MAX : (uint32_t) frames);
+        }
+        file.seekp(data_size_offset, std::ios::beg);
+        put<uint32_t>(rf64 ? UINT32_MAX : (uint32_t) dataSize);
+        file.seekp(0, std::ios::end);
+    }
+
+    bool flush() {
+        if (buffer_pos == 0) {
+            return true;
+        }
+        file.write(buffer.data(), buffer_pos);
+        dataSize += buffer_pos;
+        buffer_pos = 0;
+        update_header();
+        return file.good();
+    }
+
+    // Clamped float to int16 conversion, written so the compiler can vectorize it.
+    // NaNs become silence, the cast of a NaN is undefined
+    static void convert_to_int16(const float * data, int16_t * out, size_t length) {
+        for (size_t i = 0; i < length; ++i) {
+            float sample = data[i] * 32767.0f;
+            sample = sample == sample ? sample : 0.0f;
+            sample = sample > 32767.0f ? 32767.0f : sample;
+            sample = sample < -32768.0f ? -32768.0f : sample;
+            out[i] = (int16_t) sample;
+        }
     }
 
     // It is assumed that PCM data is normalized to a range from -1 to 1
     bool write_audio(const float * data, size_t length) {
-        for (size_t i = 0; i < length; ++i) {
-            const int16_t intSample = int16_t(data[i] * 32767);
-            file.write(reinterpret_cast<const char *>(&intSample), sizeof(int16_t));
-            dataSize += sizeof(int16_t);
+        if (!file.is_open()) {
+            return false;
         }
-        if (file.is_open()) {
-            file.seekp(4, std::ios::beg);
-            uint32_t fileSize = 36 + dataSize;
-            file.write(reinterpret_cast<char *>(&fileSize), 4);
-            file.seekp(40, std::ios::beg);
-            file.write(reinterpret_cast<char *>(&dataSize), 4);
-            file.seekp(0, std::ios::end);
+        const size_t sample_size = is_float ? sizeof(float) : sizeof(int16_t);
+        while (length > 0) {
+            if (buffer.size() - buffer_pos < sample_size * CONVERT_BLOCK_SIZE && !flush()) {
+                return false;
+            }
+            size_t n = (buffer.size() - buffer_pos) / sample_size;
+            n = n < CONVERT_BLOCK_SIZE ? n : CONVERT_BLOCK_SIZE;
+            n = n < length ? n : length;
+
+            char *out = buffer.data() + buffer_pos;
+            if (is_float) {
+                memcpy(out, data, n * sizeof(float));
+            } else {
+                int16_t block[CONVERT_BLOCK_SIZE];
+                convert_to_int16(data, block, n);
+                memcpy(out, block, n * sizeof(int16_t));
+            }
+            buffer_pos += n * sample_size;
+            data += n;
+            length -= n;
         }
         return true;
     }
@@ -54,24 +174,37 @@ private:
     bool open_wav(const std::string & filename) {
         if (filename != wav_filename) {
             if (file.is_open()) {
-                file.close();
+                close();
             }
         }
         if (!file.is_open()) {
             file.open(filename, std::ios::binary);
             wav_filename = filename;
             dataSize = 0;
+            buffer_pos = 0;
+            fact_offset = 0;
         }
         return file.is_open();
     }
 
 public:
+    // bits_per_sample is 16 for PCM or 32 for float samples
     bool open(const std::string & filename,
               const    uint32_t   sample_rate,
               const    uint16_t   bits_per_sample,
               const    uint16_t   channels) {
 
+        if (bits_per_sample != 16 && bits_per_sample != 32) {
+            return false;
+        }
+        if (file.is_open() && filename == wav_filename) {
+            return true;
+        }
         if (open_wav(filename)) {
+            this->bits_per_sample = bits_per_sample;
+            this->channels = channels;
+            is_float = bits_per_sample == 32;
+            buffer.resize(WRITE_BUFFER_SIZE);
             write_header(sample_rate, bits_per_sample, channels);
         } else {
             return false;
@@ -81,17 +214,24 @@ public:
     }
 
     bool close() {
+        if (!file.is_open()) {
+            return true;
+        }
+        const bool flushed = flush();
+        update_header();
         file.close();
-        return true;
+        return flushed && !file.fail();
     }
 
     bool write(const float * data, size_t length) {
         return write_audio(data, length);
     }
 
+    uint64_t bytes_written() const {
+        return dataSize + buffer_pos;
+    }
+
     ~wav_writer() {
-        if (file.is_open()) {
-            file.close();
-        }
+        close();
     }
 };
@@ -0,0 +1,296 @@
+#pragma once
+
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <SDL3/SDL.h>
+#include "whisper.h"
+
+// Recognition settings for the live pipeline, from the command line or a config file.
+//
+// Every setting has a long option name which is also its config file key, so
+// `--step-ms 2000` on the command line and `step-ms = 2000` in the file are the
+// same thing. The command line is applied after the file and wins.
+struct whisper_params {
+    // total inference threads over all streams, 0 picks a default
+    int32_t n_threads  = 0;
+    int32_t step_ms    = 3000;
+    // the longest window whisper runs on, also how much audio a stream can buffer
+    int32_t length_ms  = 30000;
+    int32_t keep_ms    = 100;
+    int32_t max_tokens = 32;
+    // encoder context, 0 is the model's full 30 s
+    int32_t audio_ctx  = 0;
+
+    float vad_thold    = 0.6f;
+    float freq_thold   = 100.0f;
+
+    bool translate     = false;
+    bool no_fallback   = false;
+    bool print_special = false;
+    bool no_context    = true;
+    bool no_timestamps = false;
+    bool use_gpu       = true;
+    bool flash_attn    = false;
+    // commit text once consecutive decodes agree on it, with interim text until then
+    bool local_agreement = true;
+    // compute the spectrogram as audio arrives instead of for every window,
+    // without local agreement only
+    bool incremental_mel = true;
+
+    // let adaptive_tuner adjust threads, audio context and step length at runtime
+    bool adaptive      = false;
+    int32_t target_latency_ms = 5000;
+
+    // what a live input does when recognition falls behind: drop, coalesce or degrade
+    std::string overload = "drop";
+    // hard limit on how far the transcript of a live input may lag behind
+    int32_t max_latency_ms = 10000;
+
+    std::string language  = "en";
+    std::string model     = "out/models/ggml-base.en.bin";
+
+    // a larger model which transcribes the final segments again in the background, none if empty
+    std::string refine_model;
+    // its threads, 0 takes the cores the live streams leave
+    int32_t refine_threads = 0;
+};
+
+inline bool whisper_params_parse_bool(const std::string & value, bool * out) {
+    if (value == "true" || value == "1" || value == "yes" || value == "on") {
+        *out = true;
+    } else if (value == "false" || value == "0" || value == "no" || value == "off") {
+        *out = false;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Sets one setting by its long name. Returns false for an unknown name or a bad value.
+inline bool whisper_params_set(whisper_params & params, const std::string & key, const std::string & value) {
+    if (key == "threads") {
+        params.n_threads = atoi(value.c_str());
+    } else if (key == "step-ms") {
+        params.step_ms = atoi(value.c_str());
+    } else if (key == "length-ms") {
+        params.length_ms = atoi(value.c_str());
+    } else if (key == "keep-ms") {
+        params.keep_ms = atoi(value.c_str());
+    } else if (key == "max-tokens") {
+        params.max_tokens = atoi(value.c_str());
+    } else if (key == "audio-ctx") {
+        params.audio_ctx = atoi(value.c_str());
+    } else if (key == "vad-thold") {
+        params.vad_thold = (float) atof(value.c_str());
+    } else if (key == "freq-thold") {
+        params.freq_thold = (float) atof(value.c_str());
+    } else if (key == "translate") {
+        return whisper_params_parse_bool(value, &params.translate);
+    } else if (key == "no-fallback") {
+        return whisper_params_parse_bool(value, &params.no_fallback);
+    } else if (key == "print-special") {
+        return whisper_params_parse_bool(value, &params.print_special);
+    } else if (key == "no-context") {
+        return whisper_params_parse_bool(value, &params.no_context);
+    } else if (key == "no-timestamps") {
+        return whisper_params_parse_bool(value, &params.no_timestamps);
+    } else if (key == "use-gpu") {
+        return whisper_params_parse_bool(value, &params.use_gpu);
+    } else if (key == "flash-attn") {
+        return whisper_params_parse_bool(value, &params.flash_attn);
+    } else if (key == "local-agreement") {
+        return whisper_params_parse_bool(value, &params.local_agreement);
+    } else if (key == "incremental-mel") {
+        return whisper_params_parse_bool(value, &params.incremental_mel);
+    } else if (key == "adaptive") {
+        return whisper_params_parse_bool(value, &params.adaptive);
+    } else if (key == "target-latency-ms") {
+        params.target_latency_ms = atoi(value.c_str());
+    } else if (key == "overload") {
+        // checked by whisper_params_validate()
+        params.overload = value;
+    } else if (key == "max-latency-ms") {
+        params.max_latency_ms = atoi(value.c_str());
+    } else if (key == "language") {
+        params.language = value;
+    } else if (key == "model") {
+        params.model = value;
+    } else if (key == "refine-model") {
+        params.refine_model = value;
+    } else if (key == "refine-threads") {
+        params.refine_threads = atoi(value.c_str());
+    } else {
+        return false;
+    }
+    return true;
+}
+
+inline bool whisper_params_is_flag(const std::string & key) {
+    return key == "translate" || key == "no-fallback" || key == "print-special" || key == "no-context" ||
+        key == "no-timestamps" || key == "use-gpu" || key == "flash-attn" || key == "local-agreement" ||
+        key == "incremental-mel" || key == "adaptive";
+}
+
+// Takes argv[*i] (and its value) if it is a recognition setting and advances *i past it.
+// Returns 1 if the argument was taken, 0 if it isn't a recognition setting and -1 on a bad value.
+// Flags may be given bare (--translate) or with a value (--translate false).
+inline int whisper_params_parse_arg(int argc, char *argv[], int * i, whisper_params & params) {
+    std::string arg = argv[*i];
+    if (arg == "-m") {
+        arg = "--model";
+    } else if (arg == "-t") {
+        arg = "--threads";
+    } else if (arg == "-l") {
+        arg = "--language";
+    } else if (arg == "-tr") {
+        arg = "--translate";
+    }
+    if (arg.compare(0, 2, "--") != 0) {
+        return 0;
+    }
+    const std::string key = arg.substr(2);
+    if (whisper_params_is_flag(key)) {
+        bool value = true;
+        if (*i + 1 < argc && whisper_params_parse_bool(argv[*i + 1], &value)) {
+            ++*i;
+        }
+        return whisper_params_set(params, key, value ? "true" : "false") ? 1 : -1;
+    }
+    // every setting which isn't a flag takes "0", which tells known names from unknown ones
+    whisper_params probe;
+    if (!whisper_params_set(probe, key, "0")) {
+        return 0;
+    }
+    if (*i + 1 >= argc) {
+        SDL_Log("Missing value for %s", arg.c_str());
+        return -1;
+    }
+    ++*i;
+    return whisper_params_set(params, key, argv[*i]) ? 1 : -1;
+}
+
+// Reads `key = value` lines, # starts a comment
+inline bool whisper_params_load_config(const std::string & filename, whisper_params & params) {
+    std::ifstream file(filename.c_str());
+    if (!file) {
+        SDL_Log("Couldn't open config file %s", filename.c_str());
+        return false;
+    }
+    std::string line;
+    int line_number = 0;
+    while (std::getline(file, line)) {
+        ++line_number;
+        const size_t comment = line.find('#');
+        if (comment != std::string::npos) {
+            line.erase(comment);
+        }
+        const size_t equals = line.find('=');
+        const size_t first = line.find_first_not_of(" \t\r");
+        if (first == std::string::npos) {
+            continue;
+        }
+        if (equals == std::string::npos) {
+            SDL_Log("%s:%d: expected key = value", filename.c_str(), line_number);
+            return false;
+        }
+        std::string key = line.substr(0, equals);
+        std::string value = line.substr(equals + 1);
+        key.erase(0, key.find_first_not_of(" \t"));
+        key.erase(key.find_last_not_of(" \t\r") + 1);
+        value.erase(0, value.find_first_not_of(" \t"));
+        value.erase(value.find_last_not_of(" \t\r") + 1);
+        if (!whisper_params_set(params, key, value)) {
+            SDL_Log("%s:%d: unknown setting or bad value: %s = %s", filename.c_str(), line_number, key.c_str(), value.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+// Rejects settings the pipeline can't work with
+inline bool whisper_params_validate(const whisper_params & params) {
+    if (params.step_ms <= 0 || params.keep_ms < 0 || params.length_ms < params.step_ms + params.keep_ms) {
+        SDL_Log("Need 0 < step-ms and step-ms + keep-ms <= length-ms, got step %d, keep %d, length %d",
+                params.step_ms, params.keep_ms, params.length_ms);
+        return false;
+    }
+    if (params.length_ms > 30000) {
+        SDL_Log("length-ms can't be over 30000, whisper doesn't look at more than 30 s at once");
+        return false;
+    }
+    if (params.overload != "drop" && params.overload != "coalesce" && params.overload != "degrade") {
+        SDL_Log("overload must be drop, coalesce or degrade, got %s", params.overload.c_str());
+        return false;
+    }
+    if (params.max_latency_ms < params.step_ms || params.max_latency_ms > params.length_ms) {
+        SDL_Log("Need step-ms <= max-latency-ms <= length-ms, got %d", params.max_latency_ms);
+        return false;
+    }
+    if (params.audio_ctx < 0 || params.audio_ctx > 1500) {
+        SDL_Log("audio-ctx must be between 0 and 1500, got %d", params.audio_ctx);
+        return false;
+    }
+    return true;
+}
+
+inline void whisper_params_print_usage(const whisper_params & defaults) {
+    SDL_Log("recognition settings, also accepted as `key = value` in a --config file:");
+    SDL_Log("  -m,  --model FILE           whisper model (default: %s)", defaults.model.c_str());
+    SDL_Log("  -t,  --threads N            inference threads shared by all streams (default: 4 per stream)");
+    SDL_Log("       --step-ms N            audio per decode step (default: %d)", defaults.step_ms);
+    SDL_Log("       --length-ms N          longest window and stream buffer (default: %d)", defaults.length_ms);
+    SDL_Log("       --keep-ms N            audio of the previous step decoded again (default: %d)", defaults.keep_ms);
+    SDL_Log("       --max-tokens N         tokens per segment (default: %d)", defaults.max_tokens);
+    SDL_Log("       --audio-ctx N          encoder context, 0 = full (default: %d)", defaults.audio_ctx);
+    SDL_Log("       --vad-thold N          voice activity threshold (default: %.2f)", defaults.vad_thold);
+    SDL_Log("       --freq-thold N         high-pass cutoff in Hz (default: %.1f)", defaults.freq_thold);
+    SDL_Log("  -l,  --language LANG        spoken language (default: %s)", defaults.language.c_str());
+    SDL_Log("  -tr, --translate            translate to English");
+    SDL_Log("       --no-fallback          no temperature fallback while decoding");
+    SDL_Log("       --print-special        print special tokens");
+    SDL_Log("       --no-context [BOOL]    don't carry text between steps (default: %s)", defaults.no_context ? "true" : "false");
+    SDL_Log("       --no-timestamps        no segment timestamps");
+    SDL_Log("       --use-gpu [BOOL]       (default: %s)", defaults.use_gpu ? "true" : "false");
+    SDL_Log("       --flash-attn           use flash attention");
+    SDL_Log("       --local-agreement [BOOL]  final text only once two decodes agree on it (default: %s)",
+            defaults.local_agreement ? "true" : "false");
+    SDL_Log("       --incremental-mel [BOOL]  compute the spectrogram as audio arrives, only with");
+    SDL_Log("                              --local-agreement false, the default live path doesn't use it (default: %s)",
+            defaults.incremental_mel ? "true" : "false");
+    SDL_Log("       --adaptive             tune threads, audio context and step length at runtime");
+    SDL_Log("       --target-latency-ms N  latency the adaptive tuner aims for (default: %d)", defaults.target_latency_ms);
+    SDL_Log("       --overload MODE        when a live input falls behind: drop the oldest audio, coalesce");
+    SDL_Log("                              the backlog into one window or degrade decoding (default: %s)", defaults.overload.c_str());
+    SDL_Log("       --max-latency-ms N     latency ceiling of live inputs, older audio is dropped (default: %d)",
+            defaults.max_latency_ms);
+    SDL_Log("       --refine-model FILE    larger model which revises the final segments in the background");
+    SDL_Log("       --refine-threads N     threads of the refinement model (default: the cores the live streams leave)");
+}
+
+inline whisper_context_params whisper_params_context(const whisper_params & params) {
+    whisper_context_params cparams = whisper_context_default_params();
+    cparams.use_gpu = params.use_gpu;
+    cparams.flash_attn = params.flash_attn;
+    return cparams;
+}
+
+// Decoding parameters for a step; threads and the abort callback are up to the caller
+inline whisper_full_params whisper_params_full(const whisper_params & params) {
+    whisper_full_params wparams = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
+    wparams.print_progress   = false;
+    wparams.print_special    = params.print_special;
+    wparams.print_realtime   = false;
+    wparams.print_timestamps = !params.no_timestamps;
+    wparams.translate        = params.translate;
+    wparams.no_context       = params.no_context;
+    wparams.no_timestamps    = params.no_timestamps;
+    wparams.max_tokens       = params.max_tokens;
+    wparams.language         = params.language.c_str();
+    wparams.audio_ctx        = params.audio_ctx;
+    // disable temperature fallback
+    if (params.no_fallback) {
+        wparams.temperature_inc = 0.0f;
+    }
+    return wparams;
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <SDL3/SDL.h>
+#include "thread_topology.h"
+
+// A thread which sleeps until it is notified and then runs its function once.
+//
+// Notifications which arrive while the function is running are coalesced into a
+// single extra run, so producers can call notify() as often as they like without
+// queueing work. stop() wakes the thread up, waits for the current run to finish
+// and joins it.
+//
+// The thread takes on its role's CPUs and priority, see thread_topology.
+class worker {
+private:
+    SDL_Thread *thread = NULL;
+    std::function<void()> func;
+    std::string thread_name;
+    thread_role role = THREAD_ROLE_IO;
+
+    std::mutex mutex;
+    std::condition_variable condition;
+    bool pending = false;
+    std::atomic<bool> stopping;
+
+    worker(const worker &) = delete;
+    worker & operator=(const worker &) = delete;
+
+    static int SDLCALL run(void *ptr) {
+        worker *self = (worker *) ptr;
+        thread_role_scope scope(self->role, self->thread_name.c_str());
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(self->mutex);
+                self->condition.wait(lock, [self] { return self->pending || self->stopping.load(); });
+                if (self->stopping.load()) {
+                    break;
+                }
+                self->pending = false;
+            }
+            self->func();
+        }
+        return 0;
+    }
+
+public:
+    worker() : stopping(false) {
+    }
+
+    bool start(const char * name, std::function<void()> fn, const thread_role worker_role) {
+        if (thread) {
+            return false;
+        }
+        func = fn;
+        thread_name = name;
+        role = worker_role;
+        pending = false;
+        stopping.store(false);
+        thread = SDL_CreateThread(run, name, this);
+        if (!thread) {
+            SDL_Log("Couldn't create %s thread: %s", name, SDL_GetError());
+            return false;
+        }
+        return true;
+    }
+
+    // Safe to call from any thread, including SDL audio callbacks
+    void notify() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            pending = true;
+        }
+        condition.notify_one();
+    }
+
+    // Long running functions can poll this to bail out early on shutdown
+    bool is_stopping() const {
+        return stopping.load();
+    }
+
+    void stop() {
+        if (!thread) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping.store(true);
+        }
+        condition.notify_one();
+        SDL_WaitThread(thread, NULL);
+        thread = NULL;
+    }
+
+    ~worker() {
+        stop();
+    }
+};
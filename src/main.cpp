@@ -5,7 +5,12 @@
 #include <sstream>
 #include <vector>
 #include <queue>
+#include <mutex>
+#include <atomic>
 #include <thread>
+#include <memory>
+#include <algorithm>
+#include <map>
 #include "imgui.h"
 #include "imgui_impl_sdl3.h"
 #include "imgui_impl_sdlrenderer3.h"
@@ -14,6 +19,28 @@
 #include <SDL3/SDL_main.h>
 #include "src/app_config.h"
 #include "wav_writer.h"
+#include "audio_ring_buffer.h"
+#include "worker.h"
+#include "batch_transcriber.h"
+#include "speech_stream.h"
+#include "decode_scheduler.h"
+#include "audio_source.h"
+#include "metrics.h"
+#include "transcript_store.h"
+#include "transcript_journal.h"
+#include "transcript_index.h"
+#include "audio_clock.h"
+#include "audio_history.h"
+#include "history_transcriber.h"
+#include "segment_refiner.h"
+#include "segment_server.h"
+#include "thread_topology.h"
+#include "camera_capture.h"
+#include "camera_recorder.h"
+#include "frame_pacer.h"
+#include "model_loader.h"
+#include "whisper_params.h"
+#include "adaptive_tuner.h"
 #define WHISPER_SAMPLE_RATE 16000
 
 // We are using ImGUI for creating any UI elements.
@@ -32,7 +59,6 @@ static const int HEIGHT = 480;
 static const int PADDING = 10;
 static SDL_Window *window = NULL;
 static SDL_Renderer *renderer = NULL;
-static SDL_AudioStream *stream = NULL;
 static ImGuiIO *ioRef = NULL;
 static ImFont *font = NULL;
 
@@ -46,193 +72,407 @@ const std::string APP_VERSION = APP_VERSION_MAJOR + \
 
 static const std::string WINDOW_TITLE = APP_NAME + std::string(" ") + APP_VERSION;
 
-static const int n_samples_step = (1e-3 * 3000) * WHISPER_SAMPLE_RATE;
-static const int n_samples_len  = (1e-3 * 10000) * WHISPER_SAMPLE_RATE;
-
-// TODO: We sometimes need to pla around with n_samples_keep to get the best results
-static const int n_samples_keep = (1e-3 * 100) * WHISPER_SAMPLE_RATE;
-static const int n_samples_30s  = (1e-3 * 30000) * WHISPER_SAMPLE_RATE;
+// The step, length and keep sizes come from the recognition settings, see whisper_params.h
+// An utterance has ended when the last n_samples_vad_last samples are quiet
+static const int n_samples_vad_last = (1e-3 * 1000) * WHISPER_SAMPLE_RATE;
 static const int AUDIO_CHUNK_SIZE = 10240;
 static const int AUDIO_MAX_CHUNK_SIZE = AUDIO_CHUNK_SIZE * 10;
 // overallocate the audio buffer to avoid reallocation
-static const std::vector<float> audio_buffer(AUDIO_MAX_CHUNK_SIZE, 0.0f);
+static std::vector<float> audio_buffer(AUDIO_MAX_CHUNK_SIZE, 0.0f);
 static int audio_buffer_pos = 0;
 
-// We will keep filling this buffer with new audio samples in audio_buffer
-// once the size reaches n_samples_step, we will try to do speech recognition
-static std::vector<float> audio_buffer_for_speech_recognition(n_samples_30s, 0.0f);
-static int audio_buffer_for_speech_recognition_pos = 0;
-static std::mutex audio_buffer_for_speech_recognition_mutex;
-
-// why do we need old audio buffer? because we need n_samples_keep samples from the old buffer
-// so that we can concatenate it with the new buffer
-static std::vector<float> audio_buffer_for_speech_recognition_old(n_samples_keep, 0.0f);
-static int audio_buffer_for_speech_recognition_old_pos = 0;
-
-static std::vector<float> audio_buffer_for_speech_recognition_combined(n_samples_30s + n_samples_keep, 0.0f);
-
-// They are used to store the tokens from the last full length segment as the prompt
-static std::vector<whisper_token> prompt_tokens_for_speech_recognition(n_samples_30s);
-
+// Per-stream metrics, registered in add_audio_input()
+struct stream_metrics {
+    metric_counter *captured_samples = NULL;
+    metric_counter *dropped_samples = NULL;
+    metric_counter *shed_samples = NULL;
+    metric_counter *coalesced_samples = NULL;
+    metric_counter *degraded_samples = NULL;
+    metric_gauge *ring_fill = NULL;
+    metric_gauge *lag = NULL;
+    metric_histogram *step_seconds = NULL;
+    metric_histogram *queue_lag_seconds = NULL;
+};
+
+// Every audio source (recording device or replayed file) feeds its own speech stream.
+// The capture worker keeps filling the stream's ring with new audio samples from the
+// source, and the decode scheduler runs whisper on it once the VAD gate lets it through.
+struct audio_input {
+    std::unique_ptr<audio_source> source;
+    std::unique_ptr<speech_stream> speech;
+    // Only with --history-minutes
+    std::unique_ptr<audio_history> history;
+    // Only with --refine-model, the audio the live recognizer took, at its positions
+    std::unique_ptr<audio_history> recognized_audio;
+    stream_metrics metrics;
+};
+static std::vector<audio_input> audio_inputs;
+
+// Shown in the Metrics tab and optionally exported for Prometheus, see register_metrics()
+static metrics_registry metrics;
+static metrics_exporter metrics_file_exporter;
+static metric_histogram *capture_pass_seconds = NULL;
+static metric_histogram *frame_seconds = NULL;
+static metric_histogram *texture_upload_seconds = NULL;
+static metric_counter *camera_frames_total = NULL;
+static metric_counter *camera_frames_dropped = NULL;
+// Startup, relative to SDL_Init
+static Uint64 app_start_ticks = 0;
+static bool first_frame_shown = false;
+static std::atomic<bool> first_transcript_shown(false);
+static metric_gauge *startup_first_frame_seconds = NULL;
+static metric_gauge *startup_model_load_seconds = NULL;
+static metric_gauge *startup_first_transcript_seconds = NULL;
+static metric_gauge *tuner_threads = NULL;
+static metric_gauge *tuner_step_seconds = NULL;
+static metric_gauge *tuner_fitted_audio_ctx = NULL;
+static metric_gauge *tuner_load = NULL;
 
 static struct whisper_context *whisper_ctx = NULL;
+// Recognition settings of the live pipeline, from --config and the command line.
+// The decode scheduler's whisper_full_params point into it.
+static whisper_params recognition;
+// Only with --adaptive
+static std::unique_ptr<adaptive_tuner> tuner;
+// Loads the model in the background in live mode, whisper_ctx is set once it's done
+static model_loader whisper_loader;
+
+// Headless transcription of audio files, see run_batch()
+static bool batch_mode = false;
+// no window, ImGui or camera, only the audio and the recognizer
+static bool headless = false;
+// newline-delimited JSON segments for local clients
+static segment_server segment_stream_server;
+static metric_gauge *server_clients = NULL;
+static metric_counter *server_dropped = NULL;
+static metric_counter *server_slow_clients = NULL;
+static metric_counter *server_bytes_sent = NULL;
+
+// The capture worker is woken up by the audio stream put callbacks once a chunk is available,
+// the decode scheduler by the capture worker once a stream has enough audio for the VAD gate
+static worker get_audio_data_worker;
+static decode_scheduler speech_scheduler;
 // static std::string audio_filename;
 // static wav_writer wavWriter;
 
-static std::deque<std::string> text_speech_recognition;
-static int text_speech_recognition_size = 1000;
+// Every final segment of the session, appended by the decode slots and read by the UI without a lock
+static transcript_store transcript;
+// Only with --journal, the final segments also go to SRT and JSONL files
+static transcript_journal journal;
+static metric_counter *journal_segments = NULL;
+static metric_counter *journal_dropped = NULL;
+// Searched from the Audio Stream tab, kept up with the store on the UI thread
+static transcript_index transcript_search;
+static char transcript_query[256] = "";
+static std::vector<uint32_t> transcript_matches;
+static size_t transcript_matches_indexed = 0;
+static double transcript_search_us = 0.0;
+// Entry to scroll the transcript to on the next frame, and the last one jumped to, -1 none
+static int transcript_jump = -1;
+static int transcript_highlight = -1;
+// Only with --refine-model, revises the final segments with the larger model
+static segment_refiner refiner;
+// a stream with more buffered than this is behind, and the refiner waits
+static size_t refine_behind_samples = 0;
+static metric_counter *refine_segments = NULL;
+static metric_counter *refine_windows = NULL;
+static metric_counter *refine_aborted = NULL;
+static metric_counter *refine_skipped = NULL;
+// Transcribes stretches of the audio history again, from the History tab
+static history_transcriber history_jobs;
+struct history_form {
+    bool initialized = false;
+    // index into audio_inputs
+    int input = 0;
+    // captured time, h:mm:ss, m:ss or seconds
+    char from[16] = "";
+    char to[16] = "";
+    char model[512] = "";
+    char language[16] = "";
+    int beam_size = 5;
+    int n_threads = 0;
+    bool translate = false;
+    std::string error;
+    int last_status = HISTORY_JOB_IDLE;
+    std::vector<transcript_segment> result;
+    double result_seconds = 0.0;
+};
+static history_form history_ui;
+
+// thread placement for the UI, read again once a second
+static std::vector<thread_placement> thread_placements;
+static Uint64 thread_placements_ticks = 0;
+// The text of each stream which isn't final yet, by stream name
+static std::map<std::string, std::string> interim_text;
+static std::mutex interim_text_mutex;
 
 static SDL_CameraID camera_id = 0;
 static SDL_Camera *camera = NULL;
 static SDL_CameraSpec spec;
+// Acquires the frames off the render thread, see update_camera_frame()
+static camera_capture camera_frames;
 
 static SDL_Surface *current_frame = NULL;
 static SDL_Texture *current_frame_texture = NULL;
 static bool current_frame_texture_updated = false;
+// Only with --record-camera, started once the camera's format is known
+static camera_recorder camera_recording;
+static camera_recorder_params camera_recording_params;
+static metric_counter *camera_recorded_frames = NULL;
+static metric_counter *camera_recording_dropped = NULL;
+// the first input's audio against SDL_GetTicksNS(), for lining the camera up with it
+static audio_clock capture_clock;
+// when the UI draws, see SDL_AppIterate()
+static frame_pacer ui_pacer;
+static metric_counter *frames_skipped = NULL;
 static int video_stream_width = 0;
 static ImVec4 clear_color = ImVec4(0.45f, 0.55f, 0.60f, 1.00f);
 
 
-// TODO: We can parse this from the command line arguments
-// struct whisper_params {
-//     int32_t n_threads  = std::min(4, (int32_t) std::thread::hardware_concurrency());
-//     int32_t step_ms    = 3000;
-//     int32_t length_ms  = 10000;
-//     int32_t keep_ms    = 200;
-//     int32_t capture_id = -1;
-//     int32_t max_tokens = 32;
-//     int32_t audio_ctx  = 0;
-
-//     float vad_thold    = 0.6f;
-//     float freq_thold   = 100.0f;
-
-//     bool translate     = false;
-//     bool no_fallback   = false;
-//     bool print_special = false;
-//     bool no_context    = true;
-//     bool no_timestamps = false;
-//     bool tinydiarize   = false;
-//     bool save_audio    = false; // save audio to wav file
-//     bool use_gpu       = true;
-//     bool flash_attn    = false;
-
-//     std::string language  = "en";
-//     std::string model     = "out/models/ggml-base.en.bin";
-//     std::string fname_out;
-// };
+
+static double seconds_since(const Uint64 start) {
+    return (double) (SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+}
 
 void get_audio_data() {
-    if (SDL_GetAudioStreamAvailable(stream) < AUDIO_CHUNK_SIZE) {
-        return;
-    }
-    const int data_available = SDL_GetAudioStreamData(stream, (void *) audio_buffer.data(), sizeof(float) * audio_buffer.size());
-    if (data_available == -1) {
-        SDL_Log("Couldn't get audio stream data: %s", SDL_GetError());
-        return;
+    const Uint64 start = SDL_GetPerformanceCounter();
+    bool has_ready_stream = false;
+    for (size_t i = 0; i < audio_inputs.size(); ++i) {
+        audio_input &input = audio_inputs[i];
+        while (true) {
+            // Files wait for the recognizer instead of having their samples dropped
+            size_t max_samples = audio_buffer.size();
+            if (!input.source->is_live()) {
+                max_samples = std::min(max_samples, input.speech->writable());
+            }
+            const float *data = NULL;
+            const size_t n_samples = max_samples ? input.source->read(&data, max_samples, audio_buffer.data()) : 0;
+            if (n_samples == 0) {
+                break;
+            }
+            audio_buffer_pos = n_samples;
+
+            // Never blocks, if the recognizer is behind the samples which don't fit are dropped
+            const size_t n_recognized = input.speech->push(data, n_samples);
+            if (input.history) {
+                input.history->write(data, n_samples, n_recognized);
+            }
+            if (input.recognized_audio) {
+                input.recognized_audio->write(data, n_recognized, n_recognized);
+            }
+            if (i == 0) {
+                capture_clock.advance(n_samples, n_recognized);
+            }
+            input.source->consume(n_samples);
+            input.metrics.captured_samples->add(n_samples);
+            // wavWriter.write(data, n_samples);
+        }
+        // the ring is the only writer of dropped samples, the counter catches up with it
+        input.metrics.dropped_samples->add(input.speech->dropped_samples() - input.metrics.dropped_samples->value());
+        input.metrics.ring_fill->set((double) input.speech->backlog() / input.speech->capacity());
+        if (input.source->finished()) {
+            input.speech->end_of_stream();
+        }
+        // The VAD gate needs to look at the audio before a full step is buffered to flush early
+        has_ready_stream = has_ready_stream || input.speech->ready();
     }
-    audio_buffer_pos = data_available / sizeof(float);
 
-    {
-        std::lock_guard<std::mutex> lock(audio_buffer_for_speech_recognition_mutex);
-        memcpy(
-            audio_buffer_for_speech_recognition.data() + audio_buffer_for_speech_recognition_pos,
-            audio_buffer.data(),
-            sizeof(float) * audio_buffer_pos
-        );
-        audio_buffer_for_speech_recognition_pos += audio_buffer_pos;
+    if (has_ready_stream) {
+        speech_scheduler.notify();
     }
-    // SDL_Log("Got audio stream data: %d bytes, buffer_size in bytes: %lu", data_available, audio_buffer.size() * sizeof(float));
-    // wavWriter.write(audio_buffer.data(), data_available / sizeof(float));
+    capture_pass_seconds->observe(seconds_since(start));
 }
 
-whisper_context* setup_whisper() {
-    // TODO: Parse whisper params and model from command line arguments
-    struct whisper_context_params cparams = whisper_context_default_params();
-    std::string model = "out/models/ggml-base.en.bin";
-
-    prompt_tokens_for_speech_recognition.clear();
+// Called by the audio sources, for devices on the SDL audio thread, whenever new audio can be read
+void on_audio_available() {
+    get_audio_data_worker.notify();
+}
 
-    struct whisper_context *ctx = whisper_init_from_file_with_params(model.c_str(), cparams);
-    if (!ctx) {
-        SDL_Log("Couldn't initialize whisper context");
-        return nullptr;
+// Called by the decode scheduler after every step, from any decode slot
+void on_decode_step(const speech_stream &stream, const decode_step &step) {
+    for (size_t i = 0; i < audio_inputs.size(); ++i) {
+        if (audio_inputs[i].speech.get() != &stream) {
+            continue;
+        }
+        const stream_metrics &m = audio_inputs[i].metrics;
+        const double lag = (double) step.backlog / WHISPER_SAMPLE_RATE;
+        m.lag->set(lag);
+        if (step.decoded) {
+            m.step_seconds->observe(step.seconds);
+            m.queue_lag_seconds->observe(lag);
+        }
+        m.ring_fill->set((double) stream.backlog() / stream.capacity());
+        // the stream keeps the totals, the counters catch up with them
+        m.shed_samples->add(stream.shed_samples() - m.shed_samples->value());
+        m.coalesced_samples->add(stream.coalesced_samples() - m.coalesced_samples->value());
+        m.degraded_samples->add(stream.degraded_samples() - m.degraded_samples->value());
     }
-    return ctx;
+    if (tuner) {
+        tuner_threads->set(tuner->n_threads());
+        tuner_step_seconds->set((double) tuner->step() / WHISPER_SAMPLE_RATE);
+        tuner_fitted_audio_ctx->set(tuner->fitted_audio_ctx() ? 1.0 : 0.0);
+        tuner_load->set(tuner->average_load());
+    }
+    // streams replayed from files wait for room in their ring
+    on_audio_available();
 }
 
-void run_whisper() {
-    if (audio_buffer_for_speech_recognition_pos < n_samples_step) {
+// Called by the decode scheduler for every recognized segment, from any decode slot
+void on_speech_segment(const speech_stream &stream, const transcript_segment &segment) {
+    if (!segment.final) {
+        // replaces the stream's previous interim text
+        {
+            std::lock_guard<std::mutex> lock(interim_text_mutex);
+            interim_text[stream.name()] = segment.text;
+        }
+        segment_stream_server.publish(segment, stream.name());
+        ui_pacer.request_redraw();
         return;
     }
-    const int n_samples_to_keep = std::min(n_samples_keep, audio_buffer_for_speech_recognition_old_pos);
-    // SDL_Log("n_samples_to_keep: %d", n_samples_to_keep);
-    audio_buffer_for_speech_recognition_combined.clear();
-    memcpy(
-        audio_buffer_for_speech_recognition_combined.data(),
-        audio_buffer_for_speech_recognition_old.data() + audio_buffer_for_speech_recognition_old_pos - n_samples_to_keep,
-        sizeof(float) * n_samples_to_keep
-    );
-
-    int audio_buffer_for_speech_recognition_combined_size = n_samples_to_keep;
-    {
-        std::lock_guard<std::mutex> lock(audio_buffer_for_speech_recognition_mutex);
-        memcpy(
-            audio_buffer_for_speech_recognition_combined.data() + n_samples_to_keep,
-            audio_buffer_for_speech_recognition.data(),
-            sizeof(float) * audio_buffer_for_speech_recognition_pos
-        );
-
-        memcpy(
-            audio_buffer_for_speech_recognition_old.data(),
-            audio_buffer_for_speech_recognition.data() + audio_buffer_for_speech_recognition_pos - n_samples_to_keep,
-            sizeof(float) * n_samples_to_keep
-        );
-
-        audio_buffer_for_speech_recognition_combined_size += audio_buffer_for_speech_recognition_pos;
-        audio_buffer_for_speech_recognition_old_pos = n_samples_to_keep;
-        audio_buffer_for_speech_recognition_pos = 0;
+    SDL_Log("%s: %s", stream.name().c_str(), segment.text.c_str());
+    if (!first_transcript_shown.exchange(true)) {
+        const Uint64 elapsed = SDL_GetTicks() - app_start_ticks;
+        SDL_Log("Startup: first transcript after %llu ms", (unsigned long long) elapsed);
+        startup_first_transcript_seconds->set(elapsed / 1000.0);
     }
 
-    whisper_full_params wparams = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
-    wparams.prompt_tokens = prompt_tokens_for_speech_recognition.data();
-
-    if (whisper_full(whisper_ctx, wparams, audio_buffer_for_speech_recognition_combined.data(), audio_buffer_for_speech_recognition_combined_size) != 0) {
-        SDL_Log("Failed to process audio");
-        return;
+    transcript_entry entry;
+    entry.segment = segment;
+    entry.stream = stream.name();
+    size_t id = 0;
+    if (transcript.append(entry, &id) && refiner.is_running()) {
+        for (size_t i = 0; i < audio_inputs.size(); ++i) {
+            if (audio_inputs[i].speech.get() == &stream) {
+                refiner.add(stream.name(), audio_inputs[i].recognized_audio.get(), id, segment);
+            }
+        }
     }
+    journal.append(segment, stream.name());
+    segment_stream_server.publish(segment, stream.name());
+    ui_pacer.request_redraw();
+}
 
-    prompt_tokens_for_speech_recognition.clear();
+// Whether any stream has fallen behind, from the refiner's thread. It only goes
+// on while the live path keeps up
+static bool live_streams_behind() {
+    for (size_t i = 0; i < audio_inputs.size(); ++i) {
+        if (audio_inputs[i].speech->backlog() > refine_behind_samples) {
+            return true;
+        }
+    }
+    return false;
+}
 
+// Cores a thread role may use, all of them unless it's pinned
+static int role_core_count(const thread_role role) {
+    const size_t n_pinned = app_thread_topology().cpus(role).size();
+    if (n_pinned > 0) {
+        return (int) n_pinned;
+    }
+    return SDL_GetNumLogicalCPUCores() > 0 ? SDL_GetNumLogicalCPUCores() : 1;
+}
 
-    const int n_segments = whisper_full_n_segments(whisper_ctx);
-    for (int i = 0; i < n_segments; ++i) {
-        const char *text = whisper_full_get_segment_text(whisper_ctx, i);
-        SDL_Log("%s", text);
+// Inference threads of the live streams when --threads doesn't say
+static int live_thread_budget() {
+    const int n_cores = role_core_count(THREAD_ROLE_DECODE);
+    // the tuner takes what it needs of the cores, leaving one for rendering and capture;
+    // otherwise whisper's default of up to 4 threads for every stream
+    return tuner ? std::max(1, n_cores - 1) : std::min(n_cores, 4 * (int) audio_inputs.size());
+}
 
-        if (text_speech_recognition.size() >= text_speech_recognition_size) {
-            text_speech_recognition.pop_front();
-        }
+// The model weights are shared between several whisper_states (one per speech
+// stream or batch worker), so the context doesn't need a default state
+whisper_context* setup_whisper(const std::string &model, const whisper_context_params &cparams, bool with_state = false) {
+    struct whisper_context *ctx = with_state ?
+        whisper_init_from_file_with_params(model.c_str(), cparams) :
+        whisper_init_from_file_with_params_no_state(model.c_str(), cparams);
+    if (!ctx) {
+        SDL_Log("Couldn't initialize whisper context");
+        return nullptr;
+    }
+    return ctx;
+}
 
-        text_speech_recognition.push_back(text);
+// Gives an audio source its own speech stream
+bool add_audio_input(audio_source *source) {
+    speech_stream_params params;
+    params.n_samples_step = recognition.step_ms * WHISPER_SAMPLE_RATE / 1000;
+    params.n_samples_keep = recognition.keep_ms * WHISPER_SAMPLE_RATE / 1000;
+    params.n_samples_max = recognition.length_ms * WHISPER_SAMPLE_RATE / 1000;
+    params.n_samples_vad_last = n_samples_vad_last;
+    params.vad_thold = recognition.vad_thold;
+    params.freq_thold = recognition.freq_thold;
+    params.local_agreement = recognition.local_agreement;
+    params.incremental_mel = recognition.incremental_mel;
+    // files wait for the recognizer, devices can't
+    params.bounded_latency = source->is_live();
+    params.overload = recognition.overload == "coalesce" ? OVERLOAD_COALESCE :
+        (recognition.overload == "degrade" ? OVERLOAD_DEGRADE : OVERLOAD_DROP_OLDEST);
+    params.n_samples_max_latency = recognition.max_latency_ms * WHISPER_SAMPLE_RATE / 1000;
+
+    audio_input input;
+    input.source.reset(source);
+    // the stream gets its whisper_state once the model is loaded, see on_model_loaded()
+    input.speech.reset(new speech_stream(source->name(), params));
+
+    const std::string stream = metrics_registry::label("stream", source->name());
+    stream_metrics &m = input.metrics;
+    m.captured_samples = metrics.counter("afsha_captured_samples_total", "Audio samples read from the source.", stream);
+    m.dropped_samples = metrics.counter("afsha_dropped_samples_total", "Audio samples dropped because the recognizer was behind.", stream);
+    m.shed_samples = metrics.counter("afsha_overload_dropped_samples_total",
+                                     "Audio samples skipped to keep a live input within its latency ceiling.", stream);
+    m.coalesced_samples = metrics.counter("afsha_overload_coalesced_samples_total",
+                                          "Audio samples decoded in a window longer than a step because the input was behind.", stream);
+    m.degraded_samples = metrics.counter("afsha_overload_degraded_samples_total",
+                                         "Audio samples decoded with cheaper settings because the input was behind.", stream);
+    m.ring_fill = metrics.gauge("afsha_ring_fill_ratio", "How full the stream's audio ring is, 1 means samples are being dropped.", stream);
+    m.lag = metrics.gauge("afsha_recognizer_lag_seconds", "Audio waiting for recognition at the last step.", stream);
+    m.step_seconds = metrics.histogram("afsha_recognizer_step_seconds", "Wall time of a whisper step.",
+                                       metric_histogram::exponential_buckets(0.01, 2.0, 12), stream);
+    m.queue_lag_seconds = metrics.histogram("afsha_recognizer_queue_lag_seconds", "Audio waiting for recognition when a step started.",
+                                            metric_histogram::exponential_buckets(0.1, 2.0, 10), stream);
+    audio_inputs.push_back(std::move(input));
+    return true;
+}
 
-        const int token_count = whisper_full_n_tokens(whisper_ctx, i);
-        for (int j = 0; j < token_count; ++j) {
-            prompt_tokens_for_speech_recognition.push_back(whisper_full_get_token_id(whisper_ctx, i, j));
-        }
+bool open_capture_device(SDL_AudioDeviceID device_id) {
+    sdl_audio_source *source = new sdl_audio_source(AUDIO_CHUNK_SIZE);
+    if (!source->open(device_id)) {
+        delete source;
+        return false;
     }
+    return add_audio_input(source);
 }
 
-void run_function_in_loop(void (*func)()) {
-    while (true) {
-        func();
-        SDL_Delay(1);
+bool open_audio_file(const std::string &filename, bool realtime) {
+    file_audio_source *source = new file_audio_source(realtime);
+    if (!source->open(filename)) {
+        delete source;
+        return false;
     }
+    return add_audio_input(source);
 }
 
-int run_function_sdl(void *ptr) {
-    void (*func)() = (void (*)()) ptr;
-    run_function_in_loop(func);
-    return 0;
+// Metrics which aren't per stream, the streams register theirs in add_audio_input()
+void register_metrics() {
+    capture_pass_seconds = metrics.histogram("afsha_capture_pass_seconds", "Time the capture thread takes to drain all sources.",
+                                             metric_histogram::exponential_buckets(0.00001, 2.0, 14));
+    frame_seconds = metrics.histogram("afsha_frame_seconds", "CPU time to build and draw a frame, without waiting for vsync.",
+                                      metric_histogram::exponential_buckets(0.001, 2.0, 10));
+    frames_skipped = metrics.counter("afsha_frames_skipped_total", "UI iterations which drew nothing because nothing had changed.");
+    texture_upload_seconds = metrics.histogram("afsha_texture_upload_seconds", "Time to upload a camera frame to its texture.",
+                                               metric_histogram::exponential_buckets(0.0001, 2.0, 12));
+    camera_frames_total = metrics.counter("afsha_camera_frames_total", "Frames acquired from the camera.");
+    camera_frames_dropped = metrics.counter("afsha_camera_frames_dropped_total", "Camera frames replaced by a newer one before they were shown.");
+    startup_first_frame_seconds = metrics.gauge("afsha_startup_first_frame_seconds", "Time from startup to the first rendered frame.");
+    startup_model_load_seconds = metrics.gauge("afsha_startup_model_load_seconds", "Time it took to load the whisper model.");
+    startup_first_transcript_seconds = metrics.gauge("afsha_startup_first_transcript_seconds", "Time from startup to the first recognized segment.");
+    if (tuner) {
+        tuner_threads = metrics.gauge("afsha_tuner_threads", "Threads per decode picked by the adaptive tuner.");
+        tuner_step_seconds = metrics.gauge("afsha_tuner_step_seconds", "Step length picked by the adaptive tuner.");
+        tuner_fitted_audio_ctx = metrics.gauge("afsha_tuner_fitted_audio_ctx", "1 if the encoder context is fitted to the window.");
+        tuner_load = metrics.gauge("afsha_tuner_load", "Average decode time over the audio decoded, above 1 the recognizer falls behind.");
+    }
 }
 
 int get_window_device_pixel_ratio() {
@@ -260,26 +500,304 @@ static void PrintCameraSpecs(SDL_CameraID camera_id)
     }
 }
 
-SDL_AppResult SDL_AppInit(void **appstate, int argc, char *argv[]) {
+static void print_batch_usage(const char *program) {
+    SDL_Log("usage: %s --batch [options] file1.wav [file2.wav ...]", program);
+    SDL_Log("       --config FILE         read recognition settings from FILE, the command line overrides them");
+    SDL_Log("  -w,  --workers N           number of files transcribed in parallel (default: cores / 4)");
+    SDL_Log("  -t,  --threads N           threads per file (default: cores / workers)");
+    SDL_Log("  -of, --output-format FMT   txt, srt or jsonl (default: txt)");
+    SDL_Log("  -o,  --output-dir DIR      write transcripts to DIR instead of next to the input");
+    SDL_Log("the recognition settings below apply too, except for --threads and the streaming ones (step, VAD, overload)");
+    whisper_params_print_usage(whisper_params());
+}
 
-    SDL_SetAppMetadata(APP_NAME, APP_VERSION.c_str(), APP_IDENTIFIER);
+// Transcribes the files given on the command line without a window, camera or microphone
+SDL_AppResult run_batch(int argc, char *argv[]) {
+    batch_params params;
+    whisper_params whisper;
+    // the config file comes first wherever it is given, so the command line wins
+    for (int i = 1; i + 1 < argc; ++i) {
+        if (std::string(argv[i]) == "--config" && !whisper_params_load_config(argv[i + 1], whisper)) {
+            return SDL_APP_FAILURE;
+        }
+    }
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const bool has_value = i + 1 < argc;
+        if (arg == "--batch") {
+            continue;
+        } else if (arg == "--config" && has_value) {
+            ++i;
+        } else if ((arg == "-w" || arg == "--workers") && has_value) {
+            params.n_workers = atoi(argv[++i]);
+        } else if ((arg == "-t" || arg == "--threads") && has_value) {
+            // per file here, rather than shared by all streams
+            params.n_threads = atoi(argv[++i]);
+        } else if ((arg == "-of" || arg == "--output-format") && has_value) {
+            if (!parse_transcript_format(argv[++i], &params.format)) {
+                SDL_Log("Unknown output format: %s", argv[i]);
+                print_batch_usage(argv[0]);
+                return SDL_APP_FAILURE;
+            }
+        } else if ((arg == "-o" || arg == "--output-dir") && has_value) {
+            params.output_dir = argv[++i];
+        } else {
+            const int taken = whisper_params_parse_arg(argc, argv, &i, whisper);
+            if (taken < 0) {
+                SDL_Log("Bad value for %s", arg.c_str());
+                print_batch_usage(argv[0]);
+                return SDL_APP_FAILURE;
+            } else if (taken > 0) {
+                continue;
+            }
+            if (!arg.empty() && arg[0] == '-') {
+                SDL_Log("Unknown argument: %s", arg.c_str());
+                print_batch_usage(argv[0]);
+                return SDL_APP_FAILURE;
+            }
+            params.files.push_back(arg);
+        }
+    }
+    if (params.files.empty()) {
+        print_batch_usage(argv[0]);
+        return SDL_APP_FAILURE;
+    }
 
-    if (!SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_CAMERA)) {
-        SDL_Log("Couldn't initialize SDL: %s", SDL_GetError());
+    whisper_ctx = setup_whisper(whisper.model, whisper_params_context(whisper));
+    if (!whisper_ctx) {
         return SDL_APP_FAILURE;
     }
+    // points into `whisper`, which outlives the transcriber
+    params.wparams = whisper_params_full(whisper);
 
+    batch_transcriber transcriber(whisper_ctx, params);
+    return transcriber.run() ? SDL_APP_SUCCESS : SDL_APP_FAILURE;
+}
+
+// Everything but the recognition settings, which go to `recognition`
+struct live_params {
+    // indices into SDL_GetAudioRecordingDevices(), empty means the default device
+    std::vector<int> capture_indices;
+    // WAV or raw PCM files replayed through the same pipeline as the microphone
+    std::vector<std::string> files;
+    // replay files at the pace they were recorded, or as fast as they can be decoded
+    bool realtime = true;
+    // how many streams may be decoded at the same time, 0 means all of them
+    int n_decoders = 0;
+    // Prometheus text file the metrics are written to, none if empty
+    std::string metrics_file;
+    int metrics_interval_ms = 5000;
+    model_load_mode load_mode = MODEL_LOAD_READ;
+    // base path of the SRT and JSONL transcript journal, none if empty
+    std::string journal;
+    int journal_rotate_mb = 64;
+    // minutes of audio every input keeps on disk for transcribing again, 0 none
+    int history_minutes = 0;
+    std::string history_dir = ".";
+    // CPUs and priorities by thread role, the rest keep their defaults
+    std::vector<std::pair<thread_role, std::vector<int> > > role_cpus;
+    std::vector<std::pair<thread_role, SDL_ThreadPriority> > role_priorities;
+    frame_pacing_mode render_mode = FRAME_PACING_CONTINUOUS;
+    // frames per second at most, 0 leaves it to vsync
+    int max_fps = 0;
+    bool headless = false;
+    // Unix domain socket the segments are streamed to, none if empty
+    std::string socket_path;
+    // camera recording, none if empty
+    std::string record_camera;
+    camera_recording_format record_format = CAMERA_RECORDING_Y4M;
+    int record_pool = 8;
+};
+
+static void print_live_usage(const char *program) {
+    SDL_Log("usage: %s [options]", program);
+    SDL_Log("      --config FILE    read recognition settings from FILE, the command line overrides them");
+    SDL_Log("  -c, --capture N      recording device index, repeat for several streams (default: default device)");
+    SDL_Log("  -f, --file FILE      replay a WAV or raw PCM file as a stream, repeatable");
+    SDL_Log("      --replay MODE    realtime or fast (default: realtime)");
+    SDL_Log("      --decoders N     streams decoded at the same time (default: all)");
+    SDL_Log("      --metrics-file FILE  write Prometheus metrics to FILE, e.g. for the node exporter's textfile collector");
+    SDL_Log("      --metrics-interval MS  how often the metrics file is written (default: 5000)");
+    SDL_Log("      --load MODE      read or mmap the model file (default: read)");
+    SDL_Log("      --journal PATH   append every final segment to PATH.srt and PATH.jsonl");
+    SDL_Log("      --journal-rotate-mb N  start new journal files past N MB, 0 never (default: 64)");
+    SDL_Log("      --history-minutes N  keep the last N minutes of every input on disk to transcribe again (default: 0)");
+    SDL_Log("      --history-dir DIR  where the audio history files go (default: .)");
+    SDL_Log("      --headless       no window or camera, e.g. for a server with --socket or --journal");
+    SDL_Log("      --socket PATH    stream the segments as JSON lines to clients of a Unix domain socket (Linux)");
+    SDL_Log("      --record-camera FILE  record the camera to FILE, with the frame times in FILE.timestamps.csv");
+    SDL_Log("      --record-format FMT  y4m or raw (default: y4m)");
+    SDL_Log("      --record-pool N  camera frames which can wait for the disk before frames are dropped (default: 8)");
+    SDL_Log("      --render MODE    continuous, or on-demand to draw only when something changed (default: continuous)");
+    SDL_Log("      --max-fps N      draw at most N frames per second, 0 for the display's rate (default: 0)");
+    SDL_Log("      --cpus ROLE=LIST  pin a thread role to CPUs, e.g. decode=2-15, repeatable (Linux)");
+    SDL_Log("      --priority ROLE=LEVEL  low, normal, high or time-critical (default: capture high, background low)");
+    SDL_Log("                       roles: capture, decode, background, ui, io");
+    SDL_Log("      --batch          transcribe files instead, see --batch --help");
+    whisper_params_print_usage(whisper_params());
+}
+
+// "decode=2-15" into the role and what follows the '='
+static bool split_role_arg(const std::string & arg, thread_role * role, std::string * value) {
+    const size_t eq = arg.find('=');
+    if (eq == std::string::npos || !parse_thread_role(arg.substr(0, eq), role)) {
+        return false;
+    }
+    *value = arg.substr(eq + 1);
+    return true;
+}
+
+bool parse_live_args(int argc, char *argv[], live_params &params, whisper_params &whisper) {
+    // the config file comes first wherever it is given, so the command line wins
+    for (int i = 1; i + 1 < argc; ++i) {
+        if (std::string(argv[i]) == "--config" && !whisper_params_load_config(argv[i + 1], whisper)) {
+            return false;
+        }
+    }
+
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const bool has_value = i + 1 < argc;
+        const int taken = whisper_params_parse_arg(argc, argv, &i, whisper);
+        if (taken < 0) {
+            SDL_Log("Bad value for %s", arg.c_str());
+            print_live_usage(argv[0]);
+            return false;
+        } else if (taken > 0) {
+            continue;
+        }
+        if (arg == "--config" && has_value) {
+            ++i;
+        } else if ((arg == "-c" || arg == "--capture") && has_value) {
+            params.capture_indices.push_back(atoi(argv[++i]));
+        } else if ((arg == "-f" || arg == "--file") && has_value) {
+            params.files.push_back(argv[++i]);
+        } else if (arg == "--replay" && has_value) {
+            const std::string mode = argv[++i];
+            if (mode != "realtime" && mode != "fast") {
+                SDL_Log("Unknown replay mode: %s", mode.c_str());
+                print_live_usage(argv[0]);
+                return false;
+            }
+            params.realtime = mode == "realtime";
+        } else if (arg == "--decoders" && has_value) {
+            params.n_decoders = atoi(argv[++i]);
+        } else if (arg == "--metrics-file" && has_value) {
+            params.metrics_file = argv[++i];
+        } else if (arg == "--metrics-interval" && has_value) {
+            params.metrics_interval_ms = atoi(argv[++i]);
+        } else if (arg == "--journal" && has_value) {
+            params.journal = argv[++i];
+        } else if (arg == "--journal-rotate-mb" && has_value) {
+            params.journal_rotate_mb = atoi(argv[++i]);
+        } else if (arg == "--history-minutes" && has_value) {
+            params.history_minutes = atoi(argv[++i]);
+        } else if (arg == "--history-dir" && has_value) {
+            params.history_dir = argv[++i];
+        } else if (arg == "--headless") {
+            params.headless = true;
+        } else if (arg == "--socket" && has_value) {
+            params.socket_path = argv[++i];
+        } else if (arg == "--record-camera" && has_value) {
+            params.record_camera = argv[++i];
+        } else if (arg == "--record-format" && has_value) {
+            const std::string format = argv[++i];
+            if (format != "y4m" && format != "raw") {
+                SDL_Log("Unknown recording format: %s", format.c_str());
+                print_live_usage(argv[0]);
+                return false;
+            }
+            params.record_format = format == "raw" ? CAMERA_RECORDING_RAW : CAMERA_RECORDING_Y4M;
+        } else if (arg == "--record-pool" && has_value) {
+            params.record_pool = atoi(argv[++i]);
+            if (params.record_pool < 1) {
+                SDL_Log("Bad value for %s: %s", arg.c_str(), argv[i]);
+                print_live_usage(argv[0]);
+                return false;
+            }
+        } else if (arg == "--render" && has_value) {
+            const std::string mode = argv[++i];
+            if (mode != "continuous" && mode != "on-demand") {
+                SDL_Log("Unknown render mode: %s", mode.c_str());
+                print_live_usage(argv[0]);
+                return false;
+            }
+            params.render_mode = mode == "on-demand" ? FRAME_PACING_ON_DEMAND : FRAME_PACING_CONTINUOUS;
+        } else if (arg == "--max-fps" && has_value) {
+            params.max_fps = atoi(argv[++i]);
+        } else if ((arg == "--cpus" || arg == "--priority") && has_value) {
+            const std::string value = argv[++i];
+            thread_role role;
+            std::string setting;
+            std::vector<int> cpus;
+            SDL_ThreadPriority priority;
+            if (!split_role_arg(value, &role, &setting) ||
+                (arg == "--cpus" ? !parse_cpu_list(setting, cpus) : !parse_thread_priority(setting, &priority))) {
+                SDL_Log("Bad value for %s: %s", arg.c_str(), value.c_str());
+                print_live_usage(argv[0]);
+                return false;
+            }
+            if (arg == "--cpus") {
+                params.role_cpus.push_back(std::make_pair(role, cpus));
+            } else {
+                params.role_priorities.push_back(std::make_pair(role, priority));
+            }
+        } else if (arg == "--load" && has_value) {
+            const std::string mode = argv[++i];
+            if (mode != "read" && mode != "mmap") {
+                SDL_Log("Unknown model load mode: %s", mode.c_str());
+                print_live_usage(argv[0]);
+                return false;
+            }
+            params.load_mode = mode == "mmap" ? MODEL_LOAD_MMAP : MODEL_LOAD_READ;
+        } else if (arg.compare(0, 5, "-psn_") == 0) {
+            // macOS passes a process serial number when launched from Finder
+            continue;
+        } else {
+            SDL_Log("Unknown argument: %s", arg.c_str());
+            print_live_usage(argv[0]);
+            return false;
+        }
+    }
+    return whisper_params_validate(whisper);
+}
+
+// Runs on the model loader thread once the weights are in memory: gives every
+// stream its whisper_state and starts decoding the audio buffered so far
+void on_model_loaded(whisper_context *ctx, int n_decoders) {
+    whisper_ctx = ctx;
+    startup_model_load_seconds->set(whisper_loader.elapsed_ms() / 1000.0);
+
+    for (size_t i = 0; i < audio_inputs.size(); ++i) {
+        // a stream without a state would decode on the context's missing default state
+        if (audio_inputs[i].speech->init(whisper_ctx)) {
+            speech_scheduler.add_stream(audio_inputs[i].speech.get());
+        }
+    }
+    speech_scheduler.set_step_callback(on_decode_step);
+    speech_scheduler.set_full_params(whisper_params_full(recognition));
+    speech_scheduler.set_tuner(tuner.get());
+    const int n_threads = recognition.n_threads > 0 ? recognition.n_threads : live_thread_budget();
+    if (speech_scheduler.start(whisper_ctx, n_threads, n_decoders, on_speech_segment)) {
+        speech_scheduler.notify();
+    }
+    // the loading progress bar stops moving here
+    ui_pacer.request_redraw();
+}
+
+// The window, ImGui and the camera, everything headless mode goes without
+static bool init_ui() {
     Uint32 window_flags = SDL_WINDOW_RESIZABLE | SDL_WINDOW_HIDDEN | SDL_WINDOW_HIGH_PIXEL_DENSITY;
     window = SDL_CreateWindow(WINDOW_TITLE.c_str(), WIDTH, HEIGHT, window_flags);
     if (!window) {
         SDL_Log("Couldn't create window: %s", SDL_GetError());
-        return SDL_APP_FAILURE;
+        return false;
     }
     renderer = SDL_CreateRenderer(window, nullptr);
     SDL_SetRenderVSync(renderer, 1);
     if (renderer == nullptr) {
         SDL_Log("Error: SDL_CreateRenderer(): %s", SDL_GetError());
-        return SDL_APP_FAILURE;
+        return false;
     }
     SDL_Log("Renderer: %s", SDL_GetRendererName(renderer));
 
@@ -346,40 +864,15 @@ SDL_AppResult SDL_AppInit(void **appstate, int argc, char *argv[]) {
     // ImGui::GetIO().Fonts->AddFontDefault(&cfg);
 
 
-    // Setup audio stream
-    SDL_AudioSpec audio_spec;
-    SDL_zero(audio_spec);
-
-    // NOTE: Do not change the spec format to anything other than F32LE
-    audio_spec.freq = WHISPER_SAMPLE_RATE;
-    audio_spec.format = SDL_AUDIO_F32LE;
-    audio_spec.channels = 1;
-
-    stream = SDL_OpenAudioDeviceStream(SDL_AUDIO_DEVICE_DEFAULT_RECORDING, &audio_spec, NULL, NULL);
-    if (!stream) {
-        SDL_Log("Couldn't create audio stream: %s", SDL_GetError());
-        return SDL_APP_FAILURE;
-    }
-
-    SDL_AudioDeviceID dev_id = SDL_GetAudioStreamDevice(stream);
-    if (!dev_id) {
-        SDL_Log("Couldn't get audio stream device: %s", SDL_GetError());
-        return SDL_APP_FAILURE;
-    }
-    const char *device_name = SDL_GetAudioDeviceName(dev_id);
-    SDL_Log("Got audio stream: freq: %d, channels: %d, format: %d", audio_spec.freq, audio_spec.channels, audio_spec.format);
-    /* SDL_OpenAudioDeviceStream starts the device paused. You have to tell it to start! */
-    SDL_ResumeAudioStreamDevice(stream);
-
     int devcount = 0;
     SDL_CameraID *devices = SDL_GetCameras(&devcount);
     if (!devices) {
         SDL_Log("SDL_GetCameras failed: %s", SDL_GetError());
-        return SDL_APP_FAILURE;
+        return false;
     }
     if (devcount == 0) {
         SDL_Log("No cameras found");
-        return SDL_APP_FAILURE;
+        return false;
     } else {
         SDL_Log("Found %d cameras", devcount);
         // TODO: Fix this later if needed
@@ -396,6 +889,146 @@ SDL_AppResult SDL_AppInit(void **appstate, int argc, char *argv[]) {
     camera = SDL_OpenCamera(camera_id, &spec);
     if (!camera) {
         SDL_Log("Failed to open camera device: %s", SDL_GetError());
+        return false;
+    }
+    if (!camera_frames.start(camera, (float) spec.framerate_numerator / spec.framerate_denominator,
+                             [](const SDL_Surface *frame, Uint64 timestamp_ns) {
+                                 camera_recording.add(frame, timestamp_ns);
+                                 ui_pacer.request_redraw();
+                             })) {
+        return false;
+    }
+    return true;
+}
+
+SDL_AppResult SDL_AppInit(void **appstate, int argc, char *argv[]) {
+
+    SDL_SetAppMetadata(APP_NAME, APP_VERSION.c_str(), APP_IDENTIFIER);
+
+    for (int i = 1; i < argc; ++i) {
+        if (std::string(argv[i]) == "--batch") {
+            batch_mode = true;
+            return run_batch(argc, argv);
+        }
+    }
+
+    live_params live;
+    if (!parse_live_args(argc, argv, live, recognition)) {
+        return SDL_APP_FAILURE;
+    }
+    // before any thread starts, they take their placement from it
+    thread_topology &topology = app_thread_topology();
+    for (size_t i = 0; i < live.role_priorities.size(); ++i) {
+        topology.set_priority(live.role_priorities[i].first, live.role_priorities[i].second);
+    }
+    for (size_t i = 0; i < live.role_cpus.size(); ++i) {
+        if (!topology.set_cpus(live.role_cpus[i].first, live.role_cpus[i].second)) {
+            return SDL_APP_FAILURE;
+        }
+        SDL_Log("%s threads on CPUs %s", thread_role_name(live.role_cpus[i].first),
+                format_cpu_list(topology.cpus(live.role_cpus[i].first)).c_str());
+    }
+    if (recognition.adaptive) {
+        adaptive_tuner_params tuner_params;
+        tuner_params.sample_rate = WHISPER_SAMPLE_RATE;
+        tuner_params.target_latency_s = recognition.target_latency_ms / 1000.0f;
+        tuner_params.initial_step_samples = recognition.step_ms * WHISPER_SAMPLE_RATE / 1000;
+        // a step needs room for the overlap inside the longest window
+        tuner_params.max_step_samples = std::min(10000, recognition.length_ms - recognition.keep_ms) * WHISPER_SAMPLE_RATE / 1000;
+        tuner_params.min_step_samples = std::min(n_samples_vad_last, tuner_params.initial_step_samples);
+        tuner.reset(new adaptive_tuner(tuner_params));
+        refine_behind_samples = 2 * (size_t) tuner_params.max_step_samples;
+    } else {
+        refine_behind_samples = 2 * (size_t) recognition.step_ms * WHISPER_SAMPLE_RATE / 1000;
+    }
+
+    headless = live.headless;
+    if (!SDL_Init(headless ? SDL_INIT_AUDIO : SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_CAMERA)) {
+        SDL_Log("Couldn't initialize SDL: %s", SDL_GetError());
+        return SDL_APP_FAILURE;
+    }
+    app_start_ticks = SDL_GetTicks();
+    if (!headless) {
+        // before the threads which ask it for frames start
+        ui_pacer.init(live.render_mode, std::max(live.max_fps, 0), 1000);
+    }
+
+    register_metrics();
+
+    // Setup audio streams, one per recording device or file
+    for (size_t i = 0; i < live.files.size(); ++i) {
+        if (!open_audio_file(live.files[i], live.realtime)) {
+            return SDL_APP_FAILURE;
+        }
+    }
+    if (live.capture_indices.empty() && live.files.empty()) {
+        if (!open_capture_device(SDL_AUDIO_DEVICE_DEFAULT_RECORDING)) {
+            return SDL_APP_FAILURE;
+        }
+    } else {
+        int n_recording_devices = 0;
+        SDL_AudioDeviceID *recording_devices = SDL_GetAudioRecordingDevices(&n_recording_devices);
+        for (size_t i = 0; i < live.capture_indices.size(); ++i) {
+            const int index = live.capture_indices[i];
+            if (!recording_devices || index < 0 || index >= n_recording_devices) {
+                SDL_Log("No recording device with index %d, found %d devices", index, n_recording_devices);
+                SDL_free(recording_devices);
+                return SDL_APP_FAILURE;
+            }
+            if (!open_capture_device(recording_devices[index])) {
+                SDL_free(recording_devices);
+                return SDL_APP_FAILURE;
+            }
+        }
+        SDL_free(recording_devices);
+    }
+
+    // Before the live model, its decode slots hand the refiner the final segments
+    if (!recognition.refine_model.empty()) {
+        for (size_t i = 0; i < audio_inputs.size(); ++i) {
+            // the refiner runs behind the live path, two minutes is plenty of slack
+            audio_inputs[i].recognized_audio.reset(new audio_history());
+            if (!audio_inputs[i].recognized_audio->open("", WHISPER_SAMPLE_RATE, 120)) {
+                return SDL_APP_FAILURE;
+            }
+        }
+        segment_refiner_params refine_params;
+        refine_params.model = recognition.refine_model;
+        refine_params.cparams = whisper_params_context(recognition);
+        refine_params.wparams = whisper_params_full(recognition);
+        // whole windows of up to 20 s instead of short steps
+        refine_params.wparams.max_tokens = 0;
+        refine_params.wparams.audio_ctx = 0;
+        refine_params.wparams.no_context = true;
+        refine_params.wparams.print_timestamps = false;
+        int n_refine_threads = recognition.refine_threads;
+        if (n_refine_threads <= 0 && !app_thread_topology().cpus(THREAD_ROLE_BACKGROUND).empty()) {
+            // the background role has cores of its own
+            n_refine_threads = role_core_count(THREAD_ROLE_BACKGROUND);
+        } else if (n_refine_threads <= 0) {
+            const int n_cores = SDL_GetNumLogicalCPUCores() > 0 ? SDL_GetNumLogicalCPUCores() : 1;
+            const int n_live_threads = recognition.n_threads > 0 ? recognition.n_threads : live_thread_budget();
+            n_refine_threads = std::max(1, n_cores - n_live_threads);
+        }
+        refine_params.n_threads = n_refine_threads;
+        if (!refiner.start(refine_params, &transcript, live_streams_behind)) {
+            return SDL_APP_FAILURE;
+        }
+        refine_segments = metrics.counter("afsha_refine_segments_total", "Final segments revised by the refinement model.");
+        refine_windows = metrics.counter("afsha_refine_windows_total", "Windows of segments the refinement model transcribed.");
+        refine_aborted = metrics.counter("afsha_refine_aborted_total", "Refinement decodes given up because a live stream fell behind.");
+        refine_skipped = metrics.counter("afsha_refine_skipped_total", "Windows not refined because their audio was gone or decoding failed.");
+    }
+
+    // The model loads while the window, camera and audio start up
+    const int n_decoders = live.n_decoders;
+    if (!whisper_loader.start(recognition.model, whisper_params_context(recognition), live.load_mode,
+                              [n_decoders](whisper_context *ctx) { on_model_loaded(ctx, n_decoders); })) {
+        return SDL_APP_FAILURE;
+    }
+
+
+    if (!headless && !init_ui()) {
         return SDL_APP_FAILURE;
     }
 
@@ -405,24 +1038,89 @@ SDL_AppResult SDL_AppInit(void **appstate, int argc, char *argv[]) {
     // strftime(buffer, sizeof(buffer), "%Y%m%d%H%M%S", localtime(&now));
     // audio_filename = std::string(buffer) + ".wav";
 
-    // wavWriter.open(audio_filename, audio_spec.freq, 16, audio_spec.channels);
-
-    whisper_ctx = setup_whisper();
-    if (!whisper_ctx) {
-        SDL_Log("Couldn't initialize whisper context");
-        return SDL_APP_FAILURE;
-    }
+    // wavWriter.open(audio_filename, WHISPER_SAMPLE_RATE, 16, 1);
 
     // TODO: Maybe don't do this and run_whisper in the main thread?
     // I have seen frame rates dropping when running whisper in the main thread
     // get_audio_data();
     // run_whisper();
-    SDL_DetachThread(
-        SDL_CreateThread(run_function_sdl, "get_audio_data_loop", (void *) get_audio_data)
-    );
-    SDL_DetachThread(
-        SDL_CreateThread(run_function_sdl, "run_whisper_loop", (void *) run_whisper)
-    );
+    // Audio is buffered in the stream rings until the model is loaded and the decoders start
+    if (!get_audio_data_worker.start("get_audio_data_worker", get_audio_data, THREAD_ROLE_CAPTURE)) {
+        return SDL_APP_FAILURE;
+    }
+
+    // the rest of the registry, the exporter's thread reads it from here on
+    if (!live.journal.empty()) {
+        journal_segments = metrics.counter("afsha_journal_segments_total", "Segments written to the transcript journal.");
+        journal_dropped = metrics.counter("afsha_journal_dropped_total", "Segments dropped because the journal thread fell behind.");
+    }
+    if (!live.socket_path.empty()) {
+        server_clients = metrics.gauge("afsha_server_clients", "Clients connected to the segment socket.");
+        server_dropped = metrics.counter("afsha_server_dropped_total", "Segments dropped because the segment server fell behind.");
+        server_slow_clients = metrics.counter("afsha_server_slow_clients_total", "Clients disconnected for not reading their segments.");
+        server_bytes_sent = metrics.counter("afsha_server_bytes_sent_total", "Bytes sent to the segment socket's clients.");
+    }
+    // no camera when headless, see below
+    if (!live.record_camera.empty() && !headless) {
+        camera_recorded_frames = metrics.counter("afsha_camera_recorded_frames_total", "Camera frames written to the recording.");
+        camera_recording_dropped = metrics.counter("afsha_camera_recording_dropped_total", "Camera frames not recorded because the disk fell behind or their size changed.");
+    }
+
+    if (!live.metrics_file.empty() &&
+        !metrics_file_exporter.start(&metrics, live.metrics_file, std::max(live.metrics_interval_ms, 100))) {
+        return SDL_APP_FAILURE;
+    }
+
+    if (!live.journal.empty()) {
+        transcript_journal_params journal_params;
+        journal_params.base_path = live.journal;
+        journal_params.rotate_bytes = (uint64_t) std::max(live.journal_rotate_mb, 0) << 20;
+        if (!journal.start(journal_params)) {
+            return SDL_APP_FAILURE;
+        }
+    }
+
+    if (!live.socket_path.empty()) {
+        segment_server_params server_params;
+        server_params.socket_path = live.socket_path;
+        if (!segment_stream_server.start(server_params)) {
+            return SDL_APP_FAILURE;
+        }
+    }
+
+    capture_clock.set_sample_rate(WHISPER_SAMPLE_RATE);
+    if (!live.record_camera.empty()) {
+        if (headless) {
+            SDL_Log("No camera when headless, not recording %s", live.record_camera.c_str());
+        } else {
+            // started once the camera's format is known, see SDL_AppEvent()
+            camera_recording_params.path = live.record_camera;
+            camera_recording_params.format = live.record_format;
+            camera_recording_params.pool_frames = live.record_pool;
+            camera_recording_params.clock = &capture_clock;
+        }
+    }
+
+    if (live.history_minutes > 0) {
+        for (size_t i = 0; i < audio_inputs.size(); ++i) {
+            const std::string path = live.history_dir + "/afsha-history-" + std::to_string(i) + ".pcm";
+            audio_inputs[i].history.reset(new audio_history());
+            if (!audio_inputs[i].history->open(path, WHISPER_SAMPLE_RATE, live.history_minutes * 60)) {
+                return SDL_APP_FAILURE;
+            }
+            SDL_Log("%s: keeping %d minutes of audio in %s", audio_inputs[i].source->name().c_str(),
+                    live.history_minutes, path.c_str());
+        }
+    }
+
+    for (size_t i = 0; i < audio_inputs.size(); ++i) {
+        if (!audio_inputs[i].source->start(on_audio_available)) {
+            return SDL_APP_FAILURE;
+        }
+    }
+
+    // last, SDL's own threads started above keep the CPUs the process started with
+    app_thread_topology().enter(THREAD_ROLE_UI, "main");
 
     SDL_Log("SDL_AppInit complete");
     return SDL_APP_CONTINUE;  /* carry on with the program! */
@@ -437,7 +1135,10 @@ SDL_AppResult SDL_AppEvent(void *appstate, SDL_Event *event) {
     // - When io.WantCaptureMouse is true, do not dispatch mouse input data to your main application, or clear/overwrite your copy of the mouse data.
     // - When io.WantCaptureKeyboard is true, do not dispatch keyboard input data to your main application, or clear/overwrite your copy of the keyboard data.
     // Generally you may always pass all inputs to dear imgui, and hide them from your application based on those two flags.
-    ImGui_ImplSDL3_ProcessEvent(event);
+    if (!headless) {
+        ImGui_ImplSDL3_ProcessEvent(event);
+        ui_pacer.on_event(event);
+    }
     // SDL_Log("SDL_AppEvent called with event type %d", event->type);
     if (event->type == SDL_EVENT_QUIT) {
         SDL_Log("SDL_EVENT_QUIT event received");
@@ -455,6 +1156,11 @@ SDL_AppResult SDL_AppEvent(void *appstate, SDL_Event *event) {
         }
         SDL_Log("Camera Spec: %dx%d %.2f FPS %s",
                 camera_spec.width, camera_spec.height, fps, SDL_GetPixelFormatName(camera_spec.format));
+        if (!camera_recording_params.path.empty() && !camera_recording.is_recording() && camera_spec.framerate_denominator != 0) {
+            camera_recording_params.framerate_numerator = camera_spec.framerate_numerator;
+            camera_recording_params.framerate_denominator = camera_spec.framerate_denominator;
+            camera_recording.start(camera_recording_params, camera_spec.width, camera_spec.height, camera_spec.format);
+        }
     } else if (event->type == SDL_EVENT_CAMERA_DEVICE_DENIED) {
         // TODO: Debug this. This event is not being triggered when I deny camera access
         // This might just be a MacOS issue
@@ -469,16 +1175,16 @@ void update_camera_frame() {
     if (!camera) {
         return;
     }
-    SDL_Surface *next_frame = SDL_AcquireCameraFrame(camera, NULL);
+    camera_frames_total->add(camera_frames.frames_captured() - camera_frames_total->value());
+    camera_frames_dropped->add(camera_frames.frames_dropped() - camera_frames_dropped->value());
 
-    // There is no space for NULL in my home
+    // The capture thread releases the previous frame, and there is nothing to upload
+    // while the camera hasn't delivered a new one
+    SDL_Surface *next_frame = camera_frames.next_frame();
     if (!next_frame) {
         return;
     }
     // SDL_Log("Got camera frame: %p", next_frame);
-    if (current_frame && next_frame) {
-        SDL_ReleaseCameraFrame(camera, current_frame);
-    }
     current_frame = next_frame;
 
     if (!current_frame_texture) {
@@ -500,27 +1206,433 @@ void update_camera_frame() {
             return;
         }
     }
-    // TODO: Docs say the below statement
-    // This is a fairly slow function, intended for use with static textures that do not change often.
-    SDL_UpdateTexture(current_frame_texture, NULL, current_frame->pixels, current_frame->pitch);
+    const Uint64 start = SDL_GetPerformanceCounter();
+    if (!upload_camera_frame(current_frame_texture, current_frame)) {
+        SDL_Log("Couldn't upload camera frame: %s", SDL_GetError());
+    }
+    texture_upload_seconds->observe(seconds_since(start));
 }
 
 /* This function runs once at shutdown. */
 void SDL_AppQuit(void *appstate, SDL_AppResult result) {
     SDL_Log("SDL_AppQuit called with result %d, cleaning up", result);
+    if (batch_mode) {
+        whisper_free(whisper_ctx);
+        return;
+    }
+    for (size_t i = 0; i < audio_inputs.size(); ++i) {
+        audio_inputs[i].source->stop();
+    }
+    get_audio_data_worker.stop();
+    // the loader may still be about to start the scheduler
+    whisper_loader.stop();
+    speech_scheduler.stop();
+    // after the decoders, so every segment they produced is written
+    journal.stop();
+    segment_stream_server.stop();
+    refiner.stop();
+    metrics_file_exporter.stop();
+    history_jobs.stop();
+    // frees the whisper_states, which have to go before the context
+    audio_inputs.clear();
     whisper_free(whisper_ctx);
-    ImGui_ImplSDLRenderer3_Shutdown();
-    ImGui_ImplSDL3_Shutdown();
-    ImGui::DestroyContext();
+    // headless, or the window never came up
+    if (ioRef) {
+        ImGui_ImplSDLRenderer3_Shutdown();
+        ImGui_ImplSDL3_Shutdown();
+        ImGui::DestroyContext();
+    }
 
     // wavWriter.close();
-    SDL_DestroyAudioStream(stream);
-    SDL_ReleaseCameraFrame(camera, current_frame);
+    camera_frames.stop();
+    // the camera thread no longer adds frames
+    camera_recording.stop();
+    current_frame = NULL;
     SDL_CloseCamera(camera);
     SDL_DestroyTexture(current_frame_texture);
     /* SDL will clean up the window/renderer for us. */
 }
 
+// One line per final segment followed by the interim text in grey. The clipper only
+// lays out the lines on screen, so a frame costs the same however long the session is
+void show_transcript() {
+    const bool show_stream = audio_inputs.size() > 1;
+    const int n_entries = (int) transcript.size();
+    const int jump = transcript_jump < n_entries ? transcript_jump : -1;
+    transcript_jump = -1;
+    if (jump >= 0) {
+        transcript_highlight = jump;
+    }
+    ImGuiListClipper clipper;
+    clipper.Begin(n_entries);
+    if (jump >= 0) {
+        clipper.IncludeItemByIndex(jump);
+    }
+    while (clipper.Step()) {
+        for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; ++i) {
+            const transcript_entry &entry = transcript[i];
+            // the refinement model's text once it revised the segment
+            const std::string &text = transcript.segment(i).text;
+            if (i == transcript_highlight) {
+                ImGui::TextColored(ImVec4(1.0f, 0.85f, 0.3f, 1.0f), "%s%s%s%s", show_stream ? "[" : "",
+                                   show_stream ? entry.stream.c_str() : "", show_stream ? "]" : "", text.c_str());
+                if (i == jump) {
+                    ImGui::SetScrollHereY(0.25f);
+                }
+            } else if (show_stream) {
+                ImGui::Text("[%s]%s", entry.stream.c_str(), text.c_str());
+            } else {
+                ImGui::TextUnformatted(text.c_str(), text.c_str() + text.size());
+            }
+            if (transcript.is_revised(i) && ImGui::IsItemHovered()) {
+                ImGui::SetTooltip("Live:%s", entry.segment.text.c_str());
+            }
+        }
+    }
+    clipper.End();
+    {
+        std::lock_guard<std::mutex> lock(interim_text_mutex);
+        for (std::map<std::string, std::string>::const_iterator it = interim_text.begin(); it != interim_text.end(); ++it) {
+            if (it->second.empty()) {
+                continue;
+            }
+            if (show_stream) {
+                ImGui::TextDisabled("[%s]%s", it->first.c_str(), it->second.c_str());
+            } else {
+                ImGui::TextDisabled("%s", it->second.c_str());
+            }
+        }
+    }
+    // Follow new segments only while the view is at the bottom, so scrolling
+    // up to read the history isn't undone by the next segment
+    if (jump < 0 && ImGui::GetScrollY() >= ImGui::GetScrollMaxY()) {
+        ImGui::SetScrollHereY(1.0f);
+    }
+}
+
+static std::string format_entry_time(const int64_t t_ms) {
+    const int64_t seconds = t_ms / 1000;
+    char text[32];
+    if (seconds >= 3600) {
+        snprintf(text, sizeof(text), "%d:%02d:%02d", (int) (seconds / 3600), (int) (seconds / 60 % 60), (int) (seconds % 60));
+    } else {
+        snprintf(text, sizeof(text), "%d:%02d", (int) (seconds / 60), (int) (seconds % 60));
+    }
+    return text;
+}
+
+// Search box over the transcript history. Words find the segments containing all
+// of them, newest first, "@1:02:03" jumps to that point of the session. Clicking
+// a match scrolls the transcript below to it.
+void show_transcript_search() {
+    transcript_search.update(transcript);
+
+    ImGui::SetNextItemWidth(-1.0f);
+    const bool edited = ImGui::InputTextWithHint("##search", "Search the transcript, or @m:ss to go to a time",
+                                                 transcript_query, sizeof(transcript_query));
+    const std::string query = transcript_query;
+    if (query.empty()) {
+        transcript_matches.clear();
+        return;
+    }
+
+    if (query[0] == '@') {
+        int64_t t_ms = 0;
+        if (!parse_transcript_time(query.substr(1), &t_ms)) {
+            ImGui::TextDisabled("Times are h:mm:ss, m:ss or seconds");
+            return;
+        }
+        const int64_t id = transcript_search.find_time(t_ms);
+        if (id < 0) {
+            ImGui::TextDisabled("Nothing transcribed at %s yet", format_entry_time(t_ms).c_str());
+        } else {
+            const std::string label = "Go to [" + format_entry_time(transcript[id].segment.t0_ms) + "]" + transcript.segment(id).text;
+            if (ImGui::Selectable(label.c_str()) || edited) {
+                transcript_jump = (int) id;
+            }
+        }
+        return;
+    }
+
+    // again whenever segments were indexed, so new ones show up while the query is open
+    if (edited || transcript_matches_indexed != transcript_search.indexed()) {
+        const Uint64 start = SDL_GetPerformanceCounter();
+        transcript_search.search(query, 1000, transcript_matches);
+        transcript_search_us = seconds_since(start) * 1e6;
+        transcript_matches_indexed = transcript_search.indexed();
+    }
+    ImGui::TextDisabled("%zu matches%s in %.0f us, %zu segments and %zu words indexed",
+                        transcript_matches.size(), transcript_matches.size() >= 1000 ? " (newest)" : "",
+                        transcript_search_us, transcript_search.indexed(), transcript_search.term_count());
+    if (transcript_matches.empty()) {
+        return;
+    }
+
+    const bool show_stream = audio_inputs.size() > 1;
+    const int n_matches = (int) transcript_matches.size();
+    const float height = ImGui::GetTextLineHeightWithSpacing() * (n_matches < 6 ? n_matches : 6) + 4.0f;
+    ImGui::BeginChild("Search results", ImVec2(0.0f, height), ImGuiChildFlags_Borders, ImGuiWindowFlags_None);
+    ImGuiListClipper clipper;
+    clipper.Begin(n_matches);
+    while (clipper.Step()) {
+        for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; ++i) {
+            const uint32_t id = transcript_matches[n_matches - 1 - i];
+            const transcript_entry &entry = transcript[id];
+            const std::string label = "[" + format_entry_time(entry.segment.t0_ms) + "]" +
+                                      (show_stream ? "[" + entry.stream + "]" : std::string()) + transcript.segment(id).text;
+            ImGui::PushID(i);
+            if (ImGui::Selectable(label.c_str())) {
+                transcript_jump = (int) id;
+            }
+            ImGui::PopID();
+        }
+    }
+    clipper.End();
+    ImGui::EndChild();
+}
+
+static bool has_audio_history() {
+    for (size_t i = 0; i < audio_inputs.size(); ++i) {
+        if (audio_inputs[i].history) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static int64_t history_ms(const audio_history &history, const uint64_t position) {
+    return (int64_t) (position * 1000 / history.sample_rate());
+}
+
+// Copies the selected stretch of an input's history into a job, false with form.error set if it can't
+static bool make_history_job(history_form &form, history_job &job) {
+    if (form.input < 0 || form.input >= (int) audio_inputs.size() || !audio_inputs[form.input].history) {
+        form.error = "Pick an input";
+        return false;
+    }
+    const audio_history &history = *audio_inputs[form.input].history;
+    int64_t from_ms = 0;
+    int64_t to_ms = 0;
+    if (!parse_transcript_time(form.from, &from_ms) || !parse_transcript_time(form.to, &to_ms) || to_ms <= from_ms) {
+        form.error = "From and to are times like 1:02:03, 2:03 or 123, to after from";
+        return false;
+    }
+    const uint64_t first = std::max((uint64_t) from_ms * history.sample_rate() / 1000, history.oldest());
+    const uint64_t last = std::min((uint64_t) to_ms * history.sample_rate() / 1000, history.written());
+    if (last <= first) {
+        form.error = "Nothing of that is in the history";
+        return false;
+    }
+    job.stream = audio_inputs[form.input].source->name();
+    job.samples.resize((size_t) (last - first));
+    if (!history.read(first, job.samples.size(), job.samples.data())) {
+        form.error = "That audio was overwritten meanwhile";
+        return false;
+    }
+    job.start_ms = history_ms(history, first);
+    job.params = recognition;
+    job.params.model = form.model;
+    job.params.language = form.language;
+    job.params.translate = form.translate;
+    job.beam_size = form.beam_size;
+    job.n_threads = form.n_threads;
+    return true;
+}
+
+// Transcribes a stretch of the recorded audio again, e.g. with a larger model or
+// beam search, while the live streams carry on. Times are captured time, which
+// is the transcript's time unless the recognizer fell behind and dropped audio.
+void show_history() {
+    history_form &form = history_ui;
+    if (!form.initialized) {
+        snprintf(form.model, sizeof(form.model), "%s", recognition.model.c_str());
+        snprintf(form.language, sizeof(form.language), "%s", recognition.language.c_str());
+        const int n_cores = SDL_GetNumLogicalCPUCores() > 0 ? SDL_GetNumLogicalCPUCores() : 1;
+        form.n_threads = std::max(1, n_cores / 2);
+        form.initialized = true;
+    }
+
+    ImGui::SeparatorText("Recorded");
+    for (size_t i = 0; i < audio_inputs.size(); ++i) {
+        if (!audio_inputs[i].history) {
+            continue;
+        }
+        const audio_history &history = *audio_inputs[i].history;
+        const std::string label = audio_inputs[i].source->name() + "  " + format_entry_time(history_ms(history, history.oldest())) +
+                                  " - " + format_entry_time(history_ms(history, history.written()));
+        if (ImGui::Selectable(label.c_str(), form.input == (int) i)) {
+            form.input = (int) i;
+        }
+    }
+    if (transcript_highlight >= 0 && transcript_highlight < (int) transcript.size() &&
+        ImGui::Button("Select the highlighted segment")) {
+        const transcript_entry &entry = transcript[transcript_highlight];
+        for (size_t i = 0; i < audio_inputs.size(); ++i) {
+            if (audio_inputs[i].history && audio_inputs[i].source->name() == entry.stream) {
+                const audio_history &history = *audio_inputs[i].history;
+                // a second around it, the segment's boundaries are only as good as the step
+                const int64_t from_ms = std::max<int64_t>(history_ms(history, history.position_of(entry.segment.t0_ms)) - 1000, 0);
+                const int64_t to_ms = history_ms(history, history.position_of(entry.segment.t1_ms)) + 1000;
+                form.input = (int) i;
+                snprintf(form.from, sizeof(form.from), "%s", format_entry_time(from_ms).c_str());
+                snprintf(form.to, sizeof(form.to), "%s", format_entry_time(to_ms + 999).c_str());
+                break;
+            }
+        }
+    }
+
+    ImGui::SeparatorText("Transcribe again");
+    ImGui::InputText("From", form.from, sizeof(form.from));
+    ImGui::InputText("To", form.to, sizeof(form.to));
+    ImGui::InputText("Model", form.model, sizeof(form.model));
+    ImGui::InputText("Language", form.language, sizeof(form.language));
+    ImGui::SliderInt("Beam size", &form.beam_size, 0, 8);
+    ImGui::SliderInt("Threads", &form.n_threads, 1, std::max(1, SDL_GetNumLogicalCPUCores()));
+    ImGui::Checkbox("Translate", &form.translate);
+
+    const history_job_status status = history_jobs.get_status();
+    // the result is copied once per job
+    if (status != form.last_status && status == HISTORY_JOB_DONE) {
+        history_jobs.get_result(form.result, &form.result_seconds);
+    }
+    form.last_status = status;
+    if (history_jobs.busy()) {
+        char overlay[64];
+        snprintf(overlay, sizeof(overlay), status == HISTORY_JOB_LOADING ? "Loading the model" : "%.0f%%",
+                 history_jobs.progress() * 100.0f);
+        ImGui::ProgressBar(status == HISTORY_JOB_LOADING ? 0.0f : history_jobs.progress(), ImVec2(-1.0f, 0.0f), overlay);
+        if (ImGui::Button("Cancel")) {
+            history_jobs.cancel();
+        }
+    } else if (ImGui::Button("Transcribe")) {
+        history_job job;
+        form.error.clear();
+        if (make_history_job(form, job)) {
+            // whisper_ctx is set before the loader reports the model ready
+            if (whisper_loader.get_status() == MODEL_READY) {
+                history_jobs.set_live_context(whisper_ctx, recognition.model);
+            }
+            if (history_jobs.submit(job)) {
+                form.result.clear();
+                // a short job may be done before the next frame looks at the status
+                form.last_status = HISTORY_JOB_RUNNING;
+            }
+        }
+    }
+    if (!form.error.empty()) {
+        ImGui::TextWrapped("%s", form.error.c_str());
+    }
+
+    if (status == HISTORY_JOB_FAILED) {
+        ImGui::TextWrapped("Transcribing failed or was cancelled, see the log");
+    } else if (status == HISTORY_JOB_DONE) {
+        const history_job &job = history_jobs.current_job();
+        ImGui::TextDisabled("%s, %.1f s of audio in %.1f s", job.stream.c_str(),
+                            (double) job.samples.size() / WHISPER_SAMPLE_RATE, form.result_seconds);
+        for (size_t i = 0; i < form.result.size(); ++i) {
+            ImGui::TextWrapped("[%s]%s", format_entry_time(form.result[i].t0_ms).c_str(), form.result[i].text.c_str());
+        }
+    }
+}
+
+void show_threads() {
+    thread_topology &topology = app_thread_topology();
+    const Uint64 now = SDL_GetTicks();
+    if (thread_placements_ticks == 0 || now - thread_placements_ticks >= 1000) {
+        topology.snapshot(thread_placements);
+        thread_placements_ticks = now;
+    }
+    const std::vector<int> &available = topology.available_cpus();
+    if (available.empty()) {
+        ImGui::TextWrapped("%d logical cores, CPU placement isn't available on this platform", SDL_GetNumLogicalCPUCores());
+    } else {
+        ImGui::TextWrapped("%d logical cores, the process may use %s", SDL_GetNumLogicalCPUCores(), format_cpu_list(available).c_str());
+    }
+    for (int r = 0; r < THREAD_ROLE_COUNT; ++r) {
+        const std::vector<int> cpus = topology.cpus((thread_role) r);
+        ImGui::Text("%s: %s priority, CPUs %s", thread_role_name((thread_role) r), thread_priority_name(topology.priority((thread_role) r)),
+                    cpus.empty() ? "not pinned" : format_cpu_list(cpus).c_str());
+    }
+    if (!ImGui::BeginTable("Threads", 5, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg)) {
+        return;
+    }
+    ImGui::TableSetupColumn("Thread");
+    ImGui::TableSetupColumn("Role");
+    ImGui::TableSetupColumn("Priority");
+    ImGui::TableSetupColumn("Allowed CPUs");
+    ImGui::TableSetupColumn("Last CPU");
+    ImGui::TableHeadersRow();
+    for (size_t i = 0; i < thread_placements.size(); ++i) {
+        const thread_placement &t = thread_placements[i];
+        ImGui::TableNextRow();
+        ImGui::TableNextColumn();
+        ImGui::Text("%s (%ld)", t.name.c_str(), t.tid);
+        ImGui::TableNextColumn();
+        ImGui::TextUnformatted(thread_role_name(t.role));
+        ImGui::TableNextColumn();
+        // what was asked for, greyed out if the OS didn't allow it
+        if (t.priority_set) {
+            ImGui::TextUnformatted(thread_priority_name(t.priority));
+        } else {
+            ImGui::TextDisabled("%s (denied)", thread_priority_name(t.priority));
+        }
+        ImGui::TableNextColumn();
+        if (t.cpus.empty()) {
+            ImGui::TextDisabled("unknown");
+        } else {
+            ImGui::Text("%s%s", format_cpu_list(t.cpus).c_str(), t.pinned ? " (pinned)" : "");
+        }
+        ImGui::TableNextColumn();
+        if (t.last_cpu < 0) {
+            ImGui::TextDisabled("-");
+        } else {
+            ImGui::Text("%d", t.last_cpu);
+        }
+    }
+    ImGui::EndTable();
+    ImGui::TextDisabled("whisper's compute threads run on the CPUs of the decode slot or background thread that starts them");
+}
+
+void show_metrics() {
+    if (!ImGui::BeginTable("Metrics", 2, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg)) {
+        return;
+    }
+    ImGui::TableSetupColumn("Metric");
+    ImGui::TableSetupColumn("Value");
+    ImGui::TableHeadersRow();
+    const std::vector<std::unique_ptr<metrics_registry::entry> > &entries = metrics.all();
+    for (size_t i = 0; i < entries.size(); ++i) {
+        const metrics_registry::entry &e = *entries[i];
+        ImGui::TableNextRow();
+        ImGui::TableNextColumn();
+        if (e.labels.empty()) {
+            ImGui::TextUnformatted(e.name.c_str());
+        } else {
+            ImGui::Text("%s{%s}", e.name.c_str(), e.labels.c_str());
+        }
+        if (ImGui::IsItemHovered()) {
+            ImGui::SetTooltip("%s", e.help.c_str());
+        }
+        ImGui::TableNextColumn();
+        switch (e.type) {
+            case METRIC_COUNTER:
+                ImGui::Text("%llu", (unsigned long long) e.counter->value());
+                break;
+            case METRIC_GAUGE:
+                ImGui::Text("%.3f", e.gauge->value());
+                break;
+            case METRIC_HISTOGRAM: {
+                // all histograms are in seconds
+                const metric_histogram &h = *e.histogram;
+                ImGui::Text("n=%llu p50 %.2f ms p95 %.2f ms p99 %.2f ms", (unsigned long long) h.count(),
+                            h.quantile(0.5) * 1000.0, h.quantile(0.95) * 1000.0, h.quantile(0.99) * 1000.0);
+                break;
+            }
+        }
+    }
+    ImGui::EndTable();
+}
+
 void show_current_state() {
     // Note: https://pthom.github.io/imgui_manual_online/manual/imgui_manual.html
     // This website is great for learning how to use ImGui
@@ -544,7 +1656,25 @@ void show_current_state() {
     );
     ImGui::TextWrapped("Application version: %s", APP_VERSION.c_str());
     ImGui::TextWrapped("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / ioRef->Framerate, ioRef->Framerate);
+    if (ui_pacer.get_mode() == FRAME_PACING_ON_DEMAND) {
+        ImGui::TextWrapped("Drawing on demand: %llu frames drawn, %llu skipped", (unsigned long long) ui_pacer.drawn(),
+                           (unsigned long long) ui_pacer.skipped());
+    }
     ImGui::TextWrapped("Application window size: %.0f x %.0f", ioRef->DisplaySize.x, ioRef->DisplaySize.y);
+    switch (whisper_loader.get_status()) {
+        case MODEL_LOADING: {
+            char overlay[64];
+            snprintf(overlay, sizeof(overlay), "Loading model %.0f%%", whisper_loader.progress() * 100.0f);
+            ImGui::ProgressBar(whisper_loader.progress(), ImVec2(-1.0f, 0.0f), overlay);
+            break;
+        }
+        case MODEL_READY:
+            ImGui::TextWrapped("Model: %s (loaded in %.1f s)", whisper_loader.path().c_str(), whisper_loader.elapsed_ms() / 1000.0f);
+            break;
+        case MODEL_FAILED:
+            ImGui::TextWrapped("Couldn't load the whisper model %s, see the log", whisper_loader.path().c_str());
+            break;
+    }
     ImVec2 available_size = ImGui::GetContentRegionAvail();
     // TODO: Add a little padding in the width
     video_stream_width = available_size.x;
@@ -564,8 +1694,8 @@ void show_current_state() {
             char buffer[80];
             strftime(buffer, sizeof(buffer), "Today: %Y-%m-%d %H:%M:%S", localtime(&now));
             ImGui::SeparatorText(buffer);
-            int video_stream_height = (int) ((float) current_frame->h * video_stream_width / current_frame->w);
-            if (current_frame_texture != NULL) {
+            if (current_frame_texture != NULL && current_frame != NULL) {
+                int video_stream_height = (int) ((float) current_frame->h * video_stream_width / current_frame->w);
                 ImGui::Image((ImTextureID)(intptr_t) current_frame_texture, ImVec2(video_stream_width, video_stream_height));
             }
             ImGui::EndChild();
@@ -573,35 +1703,81 @@ void show_current_state() {
         }
 
         if (ImGui::BeginTabItem("Audio Stream")) {
+            show_transcript_search();
             ImGui::BeginChild(
                 "Audio Stream",
                 ImVec2(0.0f, 0.0f),
                 ImGuiChildFlags_None,
-                ImGuiWindowFlags_AlwaysVerticalScrollbar
+                ImGuiWindowFlags_AlwaysVerticalScrollbar | ImGuiWindowFlags_HorizontalScrollbar
             );
-            std::string text_in_queue = "";
-            for (const auto &text : text_speech_recognition) {
-                text_in_queue += text + "\n";
-            }
-            ImGui::TextWrapped(text_in_queue.c_str());
-            // scroll to the bottom
-            // TODO: Since show_current_state() is called every frame, this will scroll to the bottom every frame.
-            // This causes issues when the user tries to scroll up to see the previous text.
-            // ImGui::SetScrollHereY(1.0f);
+            show_transcript();
             ImGui::EndChild();
             ImGui::EndTabItem();
         }
+
+        if (has_audio_history() && ImGui::BeginTabItem("History")) {
+            show_history();
+            ImGui::EndTabItem();
+        }
+
+        if (ImGui::BeginTabItem("Metrics")) {
+            show_metrics();
+            ImGui::EndTabItem();
+        }
+
+        if (ImGui::BeginTabItem("Threads")) {
+            show_threads();
+            ImGui::EndTabItem();
+        }
     }
     ImGui::EndTabBar();
     ImGui::End();
 }
 
+// The counters of the threads which keep their own totals catch up with them
+static void update_counters() {
+    if (journal_segments) {
+        journal_segments->add(journal.written() - journal_segments->value());
+        journal_dropped->add(journal.dropped() - journal_dropped->value());
+    }
+    if (refine_segments) {
+        refine_segments->add(refiner.refined() - refine_segments->value());
+        refine_windows->add(refiner.windows() - refine_windows->value());
+        refine_aborted->add(refiner.aborted() - refine_aborted->value());
+        refine_skipped->add(refiner.skipped() - refine_skipped->value());
+    }
+    if (server_clients) {
+        server_clients->set(segment_stream_server.client_count());
+        server_dropped->add(segment_stream_server.dropped() - server_dropped->value());
+        server_slow_clients->add(segment_stream_server.slow_clients() - server_slow_clients->value());
+        server_bytes_sent->add(segment_stream_server.bytes_sent() - server_bytes_sent->value());
+    }
+    if (camera_recorded_frames) {
+        camera_recorded_frames->add(camera_recording.recorded() - camera_recorded_frames->value());
+        camera_recording_dropped->add(camera_recording.dropped() - camera_recording_dropped->value());
+    }
+}
+
 SDL_AppResult SDL_AppIterate(void *appstate) {
+    if (headless) {
+        // nothing to draw, the main thread only wakes up for events such as quit
+        update_counters();
+        SDL_WaitEventTimeout(NULL, 1000);
+        return SDL_APP_CONTINUE;
+    }
     if (SDL_GetWindowFlags(window) & SDL_WINDOW_MINIMIZED)
     {
         SDL_Delay(10);
         return SDL_APP_CONTINUE;
     }
+    // progress bars move, and the text cursor blinks, without any event
+    ui_pacer.set_animating(whisper_loader.get_status() == MODEL_LOADING || history_jobs.busy() || ioRef->WantTextInput);
+    const bool draw = ui_pacer.begin_frame();
+    frames_skipped->add(ui_pacer.skipped() - frames_skipped->value());
+    if (!draw) {
+        return SDL_APP_CONTINUE;
+    }
+    const Uint64 frame_start = SDL_GetPerformanceCounter();
     SDL_RenderClear(renderer);
     // Start the Dear ImGui frame
     ImGui_ImplSDLRenderer3_NewFrame();
@@ -616,13 +1792,22 @@ SDL_AppResult SDL_AppIterate(void *appstate) {
     // return SDL_AppResult
     show_current_state();
     update_camera_frame();
+    update_counters();
 
     // Rendering
     ImGui::Render();
     SDL_SetRenderScale(renderer, ioRef->DisplayFramebufferScale.x, ioRef->DisplayFramebufferScale.y);
     SDL_SetRenderDrawColorFloat(renderer, clear_color.x, clear_color.y, clear_color.z, clear_color.w);
     ImGui_ImplSDLRenderer3_RenderDrawData(ImGui::GetDrawData(), renderer);
+    // SDL_RenderPresent waits for vsync, which isn't ours to measure
+    frame_seconds->observe(seconds_since(frame_start));
     SDL_RenderPresent(renderer);
+    if (!first_frame_shown) {
+        first_frame_shown = true;
+        const Uint64 elapsed = SDL_GetTicks() - app_start_ticks;
+        SDL_Log("Startup: first frame after %llu ms", (unsigned long long) elapsed);
+        startup_first_frame_seconds->set(elapsed / 1000.0);
+    }
 
     return SDL_APP_CONTINUE;  /* carry on with the program! */
 }